@@ -0,0 +1,178 @@
+// self
+#include "async_log_sink.hpp"
+
+// c++
+#include <algorithm>
+
+// fmt
+#include <fmt/format.h>
+
+
+#define WRITE_IDLE_INTERVAL_MS 5
+#define BLOCK_RETRY_INTERVAL_US 200
+#define DROPPED_REPORT_INTERVAL_MS 1000
+
+
+
+AsyncLogSink::AsyncLogSink(std::shared_ptr<spdlog::sinks::sink> target, uint32_t queue_size, LogOverflowPolicy policy)
+	: m_stopping(false)
+	, m_flush_requested(false)
+	, m_policy(policy)
+	, m_dropped_count(0)
+	, m_target(target)
+	, m_queue(queue_size)
+	, m_write_thread(nullptr)
+{
+	m_write_thread = new std::thread(write_loop, this);
+}
+
+
+AsyncLogSink::~AsyncLogSink()
+{
+	m_stopping = true;
+
+	if (m_write_thread != nullptr) {
+		if (m_write_thread->joinable()) {
+			m_write_thread->join();
+		}
+		delete m_write_thread;
+	}
+	m_write_thread = nullptr;
+}
+
+
+void AsyncLogSink::log(const spdlog::details::log_msg &msg)
+{
+	spdlog::details::log_msg_buffer buf(msg);
+	while (!m_queue.try_put(std::move(buf))) {
+		if (LogOverflowPolicy::Drop == m_policy || m_stopping) {
+			m_dropped_count++;
+			return;
+		}
+		std::this_thread::sleep_for(std::chrono::microseconds(BLOCK_RETRY_INTERVAL_US));
+	}
+}
+
+
+void AsyncLogSink::flush()
+{
+	m_flush_requested = true;
+}
+
+
+void AsyncLogSink::set_pattern(const std::string &pattern)
+{
+	m_target->set_pattern(pattern);
+}
+
+
+void AsyncLogSink::set_formatter(std::unique_ptr<spdlog::formatter> sink_formatter)
+{
+	m_target->set_formatter(std::move(sink_formatter));
+}
+
+
+uint64_t AsyncLogSink::dropped_count()
+{
+	return m_dropped_count;
+}
+
+
+void AsyncLogSink::report_dropped(uint64_t &reported)
+{
+	uint64_t dropped = m_dropped_count;
+	if (dropped == reported) {
+		return;
+	}
+
+	std::string text = fmt::format("log queue full, dropped {} messages ({} in total)\n", dropped - reported, dropped);
+	spdlog::details::log_msg msg(spdlog::source_loc{}, "", spdlog::level::warn, text);
+	m_target->log(msg);
+	reported = dropped;
+}
+
+
+void AsyncLogSink::write_loop(void *ptr)
+{
+	if (nullptr == ptr) {
+		return;
+	}
+
+	AsyncLogSink *thiz = (AsyncLogSink *)ptr;
+
+	uint64_t reported = 0;
+	auto last_report_time = std::chrono::steady_clock::now();
+	spdlog::details::log_msg_buffer buf;
+	while (true) {
+		bool written = false;
+		while (thiz->m_queue.try_get(buf)) {
+			thiz->m_target->log(buf);
+			written = true;
+		}
+
+		auto now = std::chrono::steady_clock::now();
+		if (std::chrono::duration_cast<std::chrono::milliseconds>(now - last_report_time).count() >= DROPPED_REPORT_INTERVAL_MS) {
+			thiz->report_dropped(reported);
+			last_report_time = now;
+		}
+
+		// flush once the queue was drained instead of once per message
+		if (thiz->m_flush_requested.exchange(false)) {
+			thiz->m_target->flush();
+		}
+
+		if (!written) {
+			if (thiz->m_stopping) {
+				break;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(WRITE_IDLE_INTERVAL_MS));
+		}
+	}
+
+	thiz->report_dropped(reported);
+	thiz->m_target->flush();
+}
+
+
+
+LogRateLimiter::LogRateLimiter(uint32_t lines_per_second)
+	: m_rate(lines_per_second)
+	, m_tokens(lines_per_second)
+	, m_suppressed(0)
+	, m_last_refill_time(std::chrono::steady_clock::now())
+{
+}
+
+
+void LogRateLimiter::set_rate(uint32_t lines_per_second)
+{
+	m_rate = lines_per_second;
+	m_tokens = lines_per_second;
+	m_suppressed = 0;
+	m_last_refill_time = std::chrono::steady_clock::now();
+}
+
+
+bool LogRateLimiter::acquire(uint32_t &suppressed)
+{
+	suppressed = 0;
+	if (0 == m_rate) {
+		return true;
+	}
+
+	auto now = std::chrono::steady_clock::now();
+	double seconds = std::chrono::duration<double>(now - m_last_refill_time).count();
+	m_last_refill_time = now;
+	m_tokens = std::min((double)m_rate, m_tokens + seconds * m_rate);
+
+	if (m_tokens < 1.0) {
+		m_suppressed++;
+		return false;
+	}
+
+	m_tokens -= 1.0;
+	suppressed = m_suppressed;
+	m_suppressed = 0;
+	return true;
+}
+
@@ -0,0 +1,108 @@
+#pragma once
+
+// c
+#include <stdint.h>
+
+// c++
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+
+// spdlog
+#include <spdlog/details/log_msg_buffer.h>
+#include <spdlog/sinks/sink.h>
+
+// project
+#include "mpmc.hpp"
+
+
+#ifndef DEFAULT_LOG_QUEUE_SIZE
+#define DEFAULT_LOG_QUEUE_SIZE 8192
+#endif // !DEFAULT_LOG_QUEUE_SIZE
+
+
+
+// what to do when the log queue is full
+enum class LogOverflowPolicy : uint8_t {
+	// wait until the writer thread frees a slot
+	Block = 0,
+	// discard the message and count it
+	Drop = 1,
+};
+
+
+// spdlog sink that hands messages to a background writer thread through a bounded lock-free queue
+class AsyncLogSink : public spdlog::sinks::sink {
+public:
+	AsyncLogSink(
+		std::shared_ptr<spdlog::sinks::sink> target,
+		uint32_t queue_size = DEFAULT_LOG_QUEUE_SIZE,
+		LogOverflowPolicy policy = LogOverflowPolicy::Drop
+	);
+	virtual ~AsyncLogSink();
+
+	// copy message into the queue, never touch the target sink
+	void log(const spdlog::details::log_msg &msg) override;
+
+	// ask the writer thread to flush, do not wait for it
+	void flush() override;
+
+	// forward to target sink
+	void set_pattern(const std::string &pattern) override;
+	void set_formatter(std::unique_ptr<spdlog::formatter> sink_formatter) override;
+
+	// number of messages discarded because the queue was full
+	uint64_t dropped_count();
+
+
+protected:
+	// drain queue into target sink
+	static void write_loop(void *ptr);
+
+	// write a line about dropped messages
+	void report_dropped(uint64_t &reported);
+
+
+private:
+	// flag to break infinite loop
+	std::atomic<bool> m_stopping;
+	// flag to flush target sink
+	std::atomic<bool> m_flush_requested;
+	// overflow behavior
+	LogOverflowPolicy m_policy;
+	// messages discarded by Drop policy
+	std::atomic<uint64_t> m_dropped_count;
+	// the real sink, only used by writer thread
+	std::shared_ptr<spdlog::sinks::sink> m_target;
+	// pending messages
+	lock_free_mpmc<spdlog::details::log_msg_buffer> m_queue;
+	// writer thread
+	std::thread *m_write_thread;
+};
+
+
+// token bucket limiting how many lines one player may log per second
+class LogRateLimiter {
+public:
+	LogRateLimiter(uint32_t lines_per_second = 0);
+
+	// 0 means unlimited
+	void set_rate(uint32_t lines_per_second);
+
+	// return true if the line may be logged, suppressed holds lines dropped since the last allowed one
+	bool acquire(uint32_t &suppressed);
+
+
+private:
+	// lines per second
+	uint32_t m_rate;
+	// available lines
+	double m_tokens;
+	// lines dropped since the last allowed one
+	uint32_t m_suppressed;
+	// last refill time
+	std::chrono::steady_clock::time_point m_last_refill_time;
+};
+
@@ -0,0 +1,241 @@
+// self
+#include "bench.hpp"
+
+// c++
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <map>
+#include <memory>
+#include <thread>
+
+// fmt
+#include <fmt/format.h>
+
+// spdlog
+#include <spdlog/spdlog.h>
+
+// project
+#include "buffer_pool.hpp"
+#include "cpu_usage.hpp"
+#include "mpv_manager.hpp"
+#include "mpv_wrapper.hpp"
+#include "network_ingest.hpp"
+#include "probe_cache.hpp"
+
+
+#define BENCH_SAMPLE_INTERVAL_MS 1000
+
+
+
+int run_bench(
+	int ways, int seconds, std::string video_url,
+	std::string profile, std::string vo, std::string hwdec, std::string log_level,
+	int decoder_threads_budget, uint64_t memory_budget, int channel_changes, bool share_sources, bool network_ingest,
+	int shed_level
+)
+{
+	if (ways <= 0 || seconds <= 0) {
+		SPDLOG_ERROR("invalid bench ways ({}) or seconds ({})\n", ways, seconds);
+		return -1;
+	}
+	if (shed_level < 0 || shed_level >= (int)ShedLevel::Paused) {
+		SPDLOG_ERROR("invalid bench shed level ({})\n", shed_level);
+		return -1;
+	}
+
+	// no display, decode and drop frames
+	if (vo.empty()) {
+		vo = "null";
+	}
+
+	MpvManager manager;
+	// keep feeding for the whole duration
+	manager.set_loop_file(true);
+	manager.set_decoder_thread_budget(decoder_threads_budget);
+	// measure capacity, do not hide overload
+	manager.set_load_shedding(false);
+	manager.set_memory_budget(memory_budget);
+	manager.set_source_sharing(share_sources);
+	manager.set_network_ingest(network_ingest);
+
+	std::map<int, int64_t> index_to_wid;
+	for (int index = 0; index < ways; index++) {
+		index_to_wid.insert(std::make_pair(index, (int64_t)0));
+	}
+
+	auto time_point_begin = std::chrono::steady_clock::now();
+	double cpu_seconds_begin = process_cpu_seconds();
+
+	if (!manager.start_players(index_to_wid, ways, video_url, profile, vo, hwdec, "", "", log_level)) {
+		SPDLOG_ERROR("bench start_players error\n");
+		return -2;
+	}
+
+	// estimated-vf-fps is an instantaneous value, so average the samples
+	std::map<int, double> fps_sum;
+	std::map<int, double> fps_min;
+	int samples = 0;
+	// first half at full decode, second half at shed_level, each with its own fps samples, cpu and drops
+	int phase = 0;
+	double phase_fps_sum[2] = { 0.0, 0.0 };
+	int phase_samples[2] = { 0, 0 };
+	double phase_seconds[2] = { 0.0, 0.0 };
+	double phase_cpu_seconds[2] = { 0.0, 0.0 };
+	int64_t phase_drops[2] = { 0, 0 };
+	auto phase_time_point = time_point_begin;
+	double phase_cpu_begin = cpu_seconds_begin;
+	int64_t phase_drops_begin = 0;
+	for (int ms = 0; ms < seconds * 1000; ms += BENCH_SAMPLE_INTERVAL_MS) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(BENCH_SAMPLE_INTERVAL_MS));
+
+		std::map<int, PlayerStatistics> stats;
+		manager.get_players_statistics(stats);
+		int64_t drops = 0;
+		for (auto iter = stats.begin(); iter != stats.end(); iter++) {
+			fps_sum[iter->first] += iter->second.fps;
+			phase_fps_sum[phase] += iter->second.fps;
+			drops += iter->second.frame_drops + iter->second.decoder_frame_drops;
+			auto min_iter = fps_min.find(iter->first);
+			if (min_iter == fps_min.end()) {
+				fps_min.insert(std::make_pair(iter->first, iter->second.fps));
+			}
+			else {
+				min_iter->second = std::min(min_iter->second, iter->second.fps);
+			}
+		}
+		samples++;
+		phase_samples[phase]++;
+
+		if (shed_level > 0 && 0 == phase && ms + BENCH_SAMPLE_INTERVAL_MS >= seconds * 500) {
+			auto now = std::chrono::steady_clock::now();
+			double cpu_now = process_cpu_seconds();
+			phase_seconds[0] = std::chrono::duration<double>(now - phase_time_point).count();
+			phase_cpu_seconds[0] = cpu_now - phase_cpu_begin;
+			phase_drops[0] = drops - phase_drops_begin;
+			phase_time_point = now;
+			phase_cpu_begin = cpu_now;
+			phase_drops_begin = drops;
+			manager.set_players_shed_level((ShedLevel)shed_level);
+			phase = 1;
+		}
+		else if (1 == phase) {
+			phase_seconds[1] = std::chrono::duration<double>(std::chrono::steady_clock::now() - phase_time_point).count();
+			phase_cpu_seconds[1] = process_cpu_seconds() - phase_cpu_begin;
+			phase_drops[1] = drops - phase_drops_begin;
+		}
+	}
+
+	std::map<int, PlayerStatistics> stats;
+	manager.get_players_statistics(stats);
+	std::map<int, PlaybackQuality> quality;
+	manager.get_players_quality(quality);
+	MemoryUsage memory;
+	manager.get_memory_usage(memory);
+	IngestStatistics ingest_stats;
+	manager.get_ingest_statistics(ingest_stats);
+
+	double elapsed_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - time_point_begin).count();
+	double cpu_seconds = process_cpu_seconds() - cpu_seconds_begin;
+
+	// the standby joins the running feed mid-stream, as a tune-in to a live channel would
+	for (int i = 0; i < channel_changes; i++) {
+		// outlives a standby that answers after the timeout
+		auto ready = std::make_shared<std::promise<void>>();
+		std::future<void> ready_future = ready->get_future();
+		if (!manager.change_channel(0, 0, video_url, [ready](int index) { ready->set_value(); })) {
+			SPDLOG_ERROR("bench change_channel error\n");
+			break;
+		}
+		ready_future.wait_for(std::chrono::milliseconds(DEFAULT_CHANNEL_CHANGE_TIMEOUT_MS));
+		manager.swap_channel(0);
+	}
+	ChannelChangeStatistics change_stats;
+	manager.get_channel_change_statistics(change_stats);
+
+	manager.stop_players();
+
+	// mpv does not tell which of its threads belong to which player, so split process cpu by decoded frames
+	double total_fps = 0.0;
+	for (auto iter = fps_sum.begin(); iter != fps_sum.end(); iter++) {
+		total_fps += iter->second / samples;
+	}
+
+	std::string report = fmt::format(
+		"\nqt-mpv bench: {} ways, {:.1f} s, vo={}, hwdec={}, {}\n"
+		"{:>5} {:>8} {:>8} {:>8} {:>8} {:>8} {:>9} {:>9} {:>8} {:>10} {:>10} {:>10}\n",
+		ways, elapsed_seconds, vo, hwdec, video_url,
+		"tile", "fps", "min_fps", "drops", "dec_drop", "delayed", "avsync_ms", "disp_fps", "cpu%", "in_kB/s", "w_stalls", "r_stalls"
+	);
+	for (auto iter = stats.begin(); iter != stats.end(); iter++) {
+		double fps = samples > 0 ? fps_sum[iter->first] / samples : 0.0;
+		double cpu_percent = total_fps > 0.0 ? cpu_seconds * 100.0 / elapsed_seconds * fps / total_fps : 0.0;
+		const PlaybackQuality &tile_quality = quality[iter->first];
+		report += fmt::format(
+			"{:>5} {:>8.2f} {:>8.2f} {:>8} {:>8} {:>8} {:>9.1f} {:>9.2f} {:>8.1f} {:>10.1f} {:>10} {:>10}\n",
+			iter->first, fps, fps_min[iter->first], iter->second.frame_drops, iter->second.decoder_frame_drops,
+			tile_quality.vo_delayed_frames, tile_quality.avsync_mean_abs * 1000.0, tile_quality.display_fps_mean,
+			cpu_percent, iter->second.input_bytes / 1024.0 / elapsed_seconds, iter->second.write_stalls, iter->second.read_stalls
+		);
+	}
+	report += fmt::format(
+		"players: {} decoding for {} tiles, source sharing {}\n",
+		stats.size(), ways, share_sources ? "on" : "off"
+	);
+	report += fmt::format(
+		"total: {:.2f} fps, process cpu {:.1f}% of {} cores ({:.1f}% per core)\n",
+		total_fps, cpu_seconds * 100.0 / elapsed_seconds, cpu_core_count(), cpu_seconds * 100.0 / elapsed_seconds / cpu_core_count()
+	);
+
+	report += fmt::format(
+		"memory: budget {:.1f} MB, buffers {:.1f} MB, demuxer limits {:.1f} MB, demuxer caches {:.1f} MB\n",
+		memory.budget / 1024.0 / 1024.0, memory.buffer_bytes / 1024.0 / 1024.0,
+		memory.demuxer_limit_bytes / 1024.0 / 1024.0, memory.demuxer_cache_bytes / 1024.0 / 1024.0
+	);
+
+	BufferPoolStatistics pool_stats;
+	BufferPool::instance().get_statistics(pool_stats);
+	report += fmt::format(
+		"buffer pool: {:.1f}% hit rate ({} of {}), peak {} buffers, {:.1f} MB\n",
+		pool_stats.acquires > 0 ? pool_stats.hits * 100.0 / pool_stats.acquires : 0.0, pool_stats.hits, pool_stats.acquires,
+		pool_stats.peak_in_use, pool_stats.peak_in_use_bytes / 1024.0 / 1024.0
+	);
+
+	// all ways start at once, before the first open is done, so only channel changes open with a cached probe
+	ProbeCacheStatistics probe_stats;
+	ProbeCache::instance().get_statistics(probe_stats);
+	report += fmt::format(
+		"probe cache {}: first frame after full probe {} opens, mean {} ms, after cached probe {} opens, mean {} ms\n",
+		ProbeCache::instance().is_enabled() ? "on" : "off",
+		probe_stats.cold_opens, probe_stats.cold_opens > 0 ? probe_stats.cold_first_frame_ms / (int64_t)probe_stats.cold_opens : 0,
+		probe_stats.warm_opens, probe_stats.warm_opens > 0 ? probe_stats.warm_first_frame_ms / (int64_t)probe_stats.warm_opens : 0
+	);
+
+	if (ingest_stats.sources > 0) {
+		report += fmt::format(
+			"network ingest: {} sources, {} connects for {} tiles, {:.1f} kB/s upstream, {:.1f} MB dropped\n",
+			ingest_stats.sources, ingest_stats.connects, ways, ingest_stats.received_bytes / 1024.0 / elapsed_seconds, ingest_stats.dropped_bytes / 1024.0 / 1024.0
+		);
+	}
+
+	if (phase_samples[1] > 0) {
+		report += fmt::format(
+			"shed level {} for the second half: {:.2f} -> {:.2f} fps, {} -> {} drops, process cpu {:.1f}% -> {:.1f}%\n",
+			shed_level, phase_fps_sum[0] / std::max(phase_samples[0], 1), phase_fps_sum[1] / phase_samples[1], phase_drops[0], phase_drops[1],
+			phase_seconds[0] > 0.0 ? phase_cpu_seconds[0] * 100.0 / phase_seconds[0] : 0.0,
+			phase_seconds[1] > 0.0 ? phase_cpu_seconds[1] * 100.0 / phase_seconds[1] : 0.0
+		);
+	}
+
+	if (change_stats.changes > 0) {
+		report += fmt::format(
+			"channel change: {} changes, {} without a frame, switch to first frame min {} ms, mean {} ms, max {} ms\n",
+			change_stats.changes, change_stats.timeouts, change_stats.min_ms, change_stats.total_ms / (int64_t)change_stats.changes, change_stats.max_ms
+		);
+	}
+
+	fmt::print("{}", report);
+	SPDLOG_INFO("{}", report);
+
+	return 0;
+}
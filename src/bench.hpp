@@ -0,0 +1,21 @@
+#pragma once
+
+// c
+#include <stdint.h>
+
+// c++
+#include <string>
+
+
+
+// run players without window for a fixed duration, then print decode capacity report
+// channel_changes switches tile 0 to video_url again that many times afterwards and reports switch to first frame times
+// share_sources decodes video_url once for all ways
+// shed_level above 0 sheds every player to it for the second half, the report compares decode rate and cpu of both halves
+// network_ingest opens an http or tcp:// video_url once for all ways, a loopback server makes a repeatable source
+int run_bench(
+	int ways, int seconds, std::string video_url,
+	std::string profile, std::string vo, std::string hwdec, std::string log_level,
+	int decoder_threads_budget, uint64_t memory_budget, int channel_changes = 0, bool share_sources = false, bool network_ingest = false,
+	int shed_level = 0
+);
@@ -0,0 +1,129 @@
+// self
+#include "buffer_pool.hpp"
+
+// spdlog
+#include <spdlog/spdlog.h>
+
+// project
+#include "spsc.hpp"
+
+
+
+BufferPool &BufferPool::instance()
+{
+	static BufferPool pool;
+	return pool;
+}
+
+
+BufferPool::BufferPool()
+	: m_max_pooled_bytes(DEFAULT_BUFFER_POOL_BYTES)
+	, m_stats()
+{
+}
+
+
+std::vector<uint8_t> BufferPool::acquire(uint32_t size)
+{
+	if (0 == size) {
+		return std::vector<uint8_t>();
+	}
+	size = roundup_pow_of_two(size);
+
+	std::vector<uint8_t> buffer;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stats.acquires++;
+		m_stats.in_use++;
+		m_stats.in_use_bytes += size;
+		m_stats.peak_in_use = std::max(m_stats.peak_in_use, m_stats.in_use);
+		m_stats.peak_in_use_bytes = std::max(m_stats.peak_in_use_bytes, m_stats.in_use_bytes);
+
+		auto iter = m_size_to_buffers.find(size);
+		if (iter != m_size_to_buffers.end() && !iter->second.empty()) {
+			buffer.swap(iter->second.back());
+			iter->second.pop_back();
+			m_stats.hits++;
+			m_stats.pooled_bytes -= size;
+			return buffer;
+		}
+	}
+
+	// allocate outside the lock, touching every page takes a while
+	return allocate(size);
+}
+
+
+void BufferPool::release(std::vector<uint8_t> &&buffer)
+{
+	uint32_t size = (uint32_t)buffer.size();
+	if (0 == size) {
+		return;
+	}
+
+	std::vector<uint8_t> freed;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_stats.in_use > 0) {
+			m_stats.in_use--;
+			m_stats.in_use_bytes -= std::min(m_stats.in_use_bytes, (uint64_t)size);
+		}
+
+		if (m_stats.pooled_bytes + size > m_max_pooled_bytes) {
+			// free outside the lock
+			freed.swap(buffer);
+		}
+		else {
+			m_size_to_buffers[size].push_back(std::move(buffer));
+			m_stats.pooled_bytes += size;
+		}
+	}
+}
+
+
+void BufferPool::reserve(uint32_t count, uint32_t size)
+{
+	if (0 == size) {
+		return;
+	}
+	size = roundup_pow_of_two(size);
+
+	uint32_t pooled = 0;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		pooled = (uint32_t)m_size_to_buffers[size].size();
+	}
+
+	for (uint32_t i = pooled; i < count; i++) {
+		std::vector<uint8_t> buffer = allocate(size);
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_stats.pooled_bytes + size > m_max_pooled_bytes) {
+			break;
+		}
+		m_size_to_buffers[size].push_back(std::move(buffer));
+		m_stats.pooled_bytes += size;
+	}
+}
+
+
+void BufferPool::set_max_pooled_bytes(uint64_t bytes)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_max_pooled_bytes = bytes;
+}
+
+
+void BufferPool::get_statistics(BufferPoolStatistics &stats)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	stats = m_stats;
+}
+
+
+std::vector<uint8_t> BufferPool::allocate(uint32_t size)
+{
+	SPDLOG_DEBUG("[buffer pool] allocate {} bytes\n", size);
+	return std::vector<uint8_t>(size, 0);
+}
+
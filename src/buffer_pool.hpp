@@ -0,0 +1,78 @@
+#pragma once
+
+// c
+#include <stdint.h>
+
+// c++
+#include <map>
+#include <mutex>
+#include <vector>
+
+
+#ifndef DEFAULT_BUFFER_POOL_BYTES
+#define DEFAULT_BUFFER_POOL_BYTES (256 * 1024 * 1024)
+#endif // !DEFAULT_BUFFER_POOL_BYTES
+
+
+
+// counters of the stream buffer pool
+struct BufferPoolStatistics {
+	// buffers asked for
+	uint64_t acquires;
+	// buffers handed out from the pool instead of allocated
+	uint64_t hits;
+	// buffers checked out now
+	uint32_t in_use;
+	// most buffers checked out at once
+	uint32_t peak_in_use;
+	// bytes checked out now
+	uint64_t in_use_bytes;
+	// most bytes checked out at once
+	uint64_t peak_in_use_bytes;
+	// bytes kept for reuse
+	uint64_t pooled_bytes;
+};
+
+
+// process-wide pool of pre-faulted stream buffers, players check them out on start and return them on delete
+class BufferPool {
+public:
+	static BufferPool &instance();
+
+	// a buffer of size rounded up to a power of two, all pages already touched
+	std::vector<uint8_t> acquire(uint32_t size);
+
+	// return a buffer, freed if the pool is full
+	void release(std::vector<uint8_t> &&buffer);
+
+	// allocate and touch buffers ahead of a burst of starts
+	void reserve(uint32_t count, uint32_t size);
+
+	// bytes kept for reuse at most
+	void set_max_pooled_bytes(uint64_t bytes);
+
+	// sample counters
+	void get_statistics(BufferPoolStatistics &stats);
+
+
+protected:
+	BufferPool();
+
+	BufferPool(const BufferPool &) = delete;
+	BufferPool &operator=(const BufferPool &) = delete;
+
+	// zero filled, which faults every page in
+	static std::vector<uint8_t> allocate(uint32_t size);
+
+
+private:
+	// free buffers by size
+	std::map<uint32_t, std::vector<std::vector<uint8_t>>> m_size_to_buffers;
+	// bytes kept for reuse at most
+	uint64_t m_max_pooled_bytes;
+	// counters
+	BufferPoolStatistics m_stats;
+	// guard free buffers and counters
+	std::mutex m_mutex;
+};
+
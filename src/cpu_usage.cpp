@@ -0,0 +1,174 @@
+// self
+#include "cpu_usage.hpp"
+
+// c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// c++
+#include <fstream>
+#include <thread>
+
+// windows
+#ifdef _WIN32
+#ifndef VC_EXTRALEAN
+#define VC_EXTRALEAN
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <Windows.h>
+#include <Psapi.h>
+#include <TlHelp32.h>
+#endif // _WIN32
+
+// posix
+#ifndef _WIN32
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif // !_WIN32
+
+// linux
+#ifdef __linux__
+#include <dirent.h>
+#endif // __linux__
+
+
+
+#ifdef _WIN32
+static double filetime_to_seconds(const FILETIME &t)
+{
+	// 100 nanoseconds per tick
+	return (((uint64_t)t.dwHighDateTime << 32) | t.dwLowDateTime) / 1e7;
+}
+#endif // _WIN32
+
+
+double process_cpu_seconds()
+{
+#ifdef _WIN32
+	FILETIME creation_time, exit_time, kernel_time, user_time;
+	if (!GetProcessTimes(GetCurrentProcess(), &creation_time, &exit_time, &kernel_time, &user_time)) {
+		return 0.0;
+	}
+	return filetime_to_seconds(kernel_time) + filetime_to_seconds(user_time);
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) {
+		return 0.0;
+	}
+	return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+#endif // _WIN32
+}
+
+
+bool thread_cpu_seconds(std::map<uint64_t, ThreadCpuUsage> &threads)
+{
+	threads.clear();
+
+#ifdef _WIN32
+	HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+	if (INVALID_HANDLE_VALUE == snapshot) {
+		return false;
+	}
+
+	DWORD pid = GetCurrentProcessId();
+	THREADENTRY32 entry;
+	entry.dwSize = sizeof(entry);
+	for (BOOL ok = Thread32First(snapshot, &entry); ok; ok = Thread32Next(snapshot, &entry)) {
+		if (entry.th32OwnerProcessID != pid) {
+			continue;
+		}
+
+		HANDLE thread = OpenThread(THREAD_QUERY_LIMITED_INFORMATION, FALSE, entry.th32ThreadID);
+		if (nullptr == thread) {
+			continue;
+		}
+
+		FILETIME creation_time, exit_time, kernel_time, user_time;
+		if (GetThreadTimes(thread, &creation_time, &exit_time, &kernel_time, &user_time)) {
+			ThreadCpuUsage usage;
+			usage.seconds = filetime_to_seconds(kernel_time) + filetime_to_seconds(user_time);
+			threads.insert(std::make_pair((uint64_t)entry.th32ThreadID, usage));
+		}
+		CloseHandle(thread);
+	}
+
+	CloseHandle(snapshot);
+	return true;
+#elif defined(__linux__)
+	DIR *dir = opendir("/proc/self/task");
+	if (nullptr == dir) {
+		return false;
+	}
+
+	double ticks_per_second = (double)sysconf(_SC_CLK_TCK);
+	struct dirent *entry = nullptr;
+	while ((entry = readdir(dir)) != nullptr) {
+		if ('.' == entry->d_name[0]) {
+			continue;
+		}
+
+		std::string task_dir = std::string("/proc/self/task/") + entry->d_name;
+
+		// utime and stime are the 14th and 15th fields, count from the ')' closing the name
+		std::ifstream stat_file(task_dir + "/stat");
+		std::string stat;
+		std::getline(stat_file, stat);
+		size_t name_end = stat.rfind(')');
+		if (std::string::npos == name_end) {
+			continue;
+		}
+		unsigned long long utime = 0;
+		unsigned long long stime = 0;
+		if (sscanf(stat.c_str() + name_end + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime, &stime) != 2) {
+			continue;
+		}
+
+		ThreadCpuUsage usage;
+		usage.seconds = (utime + stime) / ticks_per_second;
+		std::ifstream comm_file(task_dir + "/comm");
+		std::getline(comm_file, usage.name);
+		threads.insert(std::make_pair((uint64_t)strtoull(entry->d_name, nullptr, 10), usage));
+	}
+
+	closedir(dir);
+	return true;
+#else
+	return false;
+#endif // _WIN32
+}
+
+
+uint32_t cpu_core_count()
+{
+	uint32_t n = std::thread::hardware_concurrency();
+	return n > 0 ? n : 1;
+}
+
+
+uint64_t process_rss_bytes()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+		return 0;
+	}
+	return counters.WorkingSetSize;
+#elif defined(__linux__)
+	// resident pages are the second field
+	unsigned long long size = 0;
+	unsigned long long resident = 0;
+	FILE *file = fopen("/proc/self/statm", "r");
+	if (nullptr == file) {
+		return 0;
+	}
+	int n = fscanf(file, "%llu %llu", &size, &resident);
+	fclose(file);
+	return 2 == n ? resident * (uint64_t)sysconf(_SC_PAGESIZE) : 0;
+#else
+	return 0;
+#endif // _WIN32
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+// c
+#include <stdint.h>
+
+// c++
+#include <map>
+#include <string>
+
+
+
+// cpu time of one thread
+struct ThreadCpuUsage {
+	// thread name, empty if unknown
+	std::string name;
+	// user + system cpu time, in seconds
+	double seconds;
+};
+
+
+
+// user + system cpu time consumed by this process, in seconds
+double process_cpu_seconds();
+
+// cpu time of every thread of this process keyed by native thread id, false if unsupported
+bool thread_cpu_seconds(std::map<uint64_t, ThreadCpuUsage> &threads);
+
+// number of logical cores, at least 1
+uint32_t cpu_core_count();
+
+// resident memory of this process in bytes, 0 if unsupported
+uint64_t process_rss_bytes();
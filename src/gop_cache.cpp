@@ -0,0 +1,82 @@
+// self
+#include "gop_cache.hpp"
+
+
+
+GopCache::GopCache(uint32_t max_size)
+	: m_max_size(max_size)
+{
+	reset();
+}
+
+
+void GopCache::reset()
+{
+	m_scanner.reset();
+	m_buffer.clear();
+	m_base_offset = 0;
+	m_stream_offset = 0;
+	m_has_keyframe = false;
+	m_keyframe_offset = 0;
+	m_has_gop = false;
+}
+
+
+void GopCache::append(const uint8_t *buf, uint32_t length)
+{
+	if (nullptr == buf || 0 == length) {
+		return;
+	}
+
+	m_scanner.feed(buf, length, m_stream_offset);
+	m_buffer.insert(m_buffer.end(), buf, buf + length);
+	m_stream_offset += length;
+
+	// a new gop starts, the previous one is of no use anymore
+	uint32_t keyframe_offset = 0;
+	if (m_scanner.get_last_keyframe(keyframe_offset) && (!m_has_keyframe || keyframe_offset != m_keyframe_offset)) {
+		m_has_keyframe = true;
+		m_keyframe_offset = keyframe_offset;
+
+		// offsets wrap after 4 GB, their distance does not
+		uint32_t drop = keyframe_offset - m_base_offset;
+		if (drop <= m_buffer.size()) {
+			m_buffer.erase(m_buffer.begin(), m_buffer.begin() + drop);
+			m_base_offset = keyframe_offset;
+			m_has_gop = true;
+		}
+		else {
+			m_has_gop = false;
+		}
+	}
+
+	// a gop larger than the cache is dropped until the next key frame
+	if (m_has_gop && m_buffer.size() > m_max_size) {
+		m_has_gop = false;
+	}
+
+	// keep the packet whose header may still turn out to start a key frame
+	if (!m_has_gop && m_buffer.size() > TS_PACKET_SIZE) {
+		uint32_t drop = (uint32_t)m_buffer.size() - TS_PACKET_SIZE;
+		m_buffer.erase(m_buffer.begin(), m_buffer.begin() + drop);
+		m_base_offset += drop;
+	}
+}
+
+
+bool GopCache::has_gop()
+{
+	return m_has_gop;
+}
+
+
+const uint8_t *GopCache::data()
+{
+	return m_buffer.data();
+}
+
+
+uint32_t GopCache::size()
+{
+	return (uint32_t)m_buffer.size();
+}
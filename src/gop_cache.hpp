@@ -0,0 +1,52 @@
+#pragma once
+
+// c
+#include <stdint.h>
+
+// c++
+#include <vector>
+
+// project
+#include "ts_scanner.hpp"
+
+
+#ifndef DEFAULT_GOP_CACHE_SIZE
+#define DEFAULT_GOP_CACHE_SIZE (2 * 1024 * 1024)
+#endif // !DEFAULT_GOP_CACHE_SIZE
+
+
+
+// last group of pictures of an mpeg-ts stream, from its key frame packet up to the newest byte
+// a player that joins the stream is seeded with it, so it decodes at once instead of waiting for the next key frame
+class GopCache {
+public:
+	// a gop larger than max_size is not kept, the cache waits for the next key frame
+	GopCache(uint32_t max_size = DEFAULT_GOP_CACHE_SIZE);
+
+	// forget everything
+	void reset();
+
+	// bytes that follow the previous ones
+	void append(const uint8_t *buf, uint32_t length);
+
+	// the cache starts at a key frame
+	bool has_gop();
+	// bytes from the last key frame on, only valid with has_gop and until the next append
+	const uint8_t *data();
+	uint32_t size();
+
+
+private:
+	uint32_t m_max_size;
+	TsKeyframeScanner m_scanner;
+	// bytes from stream position m_base_offset on
+	std::vector<uint8_t> m_buffer;
+	uint32_t m_base_offset;
+	// stream position of the next byte
+	uint32_t m_stream_offset;
+	// scanner found a key frame, and where
+	bool m_has_keyframe;
+	uint32_t m_keyframe_offset;
+	// m_buffer starts at m_keyframe_offset
+	bool m_has_gop;
+};
@@ -1,9 +1,18 @@
 // project
+#include "async_log_sink.hpp"
+#include "bench.hpp"
+#include "gop_cache.hpp"
+#include "mpv_manager.hpp"
 #include "mpv_wrapper.hpp"
+#include "probe_cache.hpp"
+#include "stats_segment.hpp"
+#include "tile_process.hpp"
+#include "trace.hpp"
 #include "window_wrapper.hpp"
 
 // fmt
 #include <fmt/format.h>
+#include <fmt/ranges.h>
 
 // spdlog
 #include <spdlog/spdlog.h>
@@ -25,6 +34,10 @@ public:
     CommandArguments()
         : log_path("qt-mpv.log")
         , log_level(SPDLOG_LEVEL_INFO)
+        , log_async(false)
+        , log_queue_size(DEFAULT_LOG_QUEUE_SIZE)
+        , log_overflow("drop")
+        , log_rate_limit(0)
         , ways(1)
         , gpu_ways(-1)
         , profile("low-latency")
@@ -32,11 +45,34 @@ public:
         , hwdec("auto")
         , gpu_api("")
         , gpu_context("")
-        , mpv_log_level("v")
+        , mpv_log_level("warn")
         , window_left_pos(0)
         , window_top_pos(0)
         , window_width(800)
         , window_height(480)
+        , decoder_threads_budget(0)
+        , quality_governor(true)
+        , audio_focus(AUDIO_FOCUS_ALL)
+        , load_shedding(true)
+        , shed_cpu_threshold(DEFAULT_SHED_CPU_THRESHOLD)
+        , bench(false)
+        , bench_seconds(30)
+        , bench_channel_changes(0)
+        , bench_shed_level(0)
+        , sources(0)
+        , prefetch_tiles(2)
+        , render_mode("window")
+        , memory_budget(0)
+        , gop_cache_size(DEFAULT_GOP_CACHE_SIZE)
+        , probe_cache(true)
+        , share_sources(false)
+        , network_ingest(false)
+        , trace(false)
+        , trace_path(DEFAULT_TRACE_PATH)
+        , stats_key("")
+        , process_mode(false)
+        , worker_wid(0)
+        , worker_buffer_size(DEFUALT_BUFFER_SIZE)
     {
     }
 
@@ -44,19 +80,48 @@ public:
     {
         app.add_option("--log_path", log_path, fmt::format("log path (default {})", log_path));
         app.add_option("--log_level", log_level, "log level (default spdlog::level::info)");
+        app.add_option("--log_async", log_async, "write log from a background thread (default false)");
+        app.add_option("--log_queue_size", log_queue_size, fmt::format("async log queue size (default {})", log_queue_size));
+        app.add_option("--log_overflow", log_overflow, fmt::format("async log queue overflow policy, block or drop (default {})", log_overflow));
+        app.add_option("--log_rate_limit", log_rate_limit, "max mpv log lines per player per second (default 0, unlimited)");
         app.add_option("--ways", ways, fmt::format("ways (default {})", ways));
         app.add_option("--gpu_ways", gpu_ways, "ways use gpu decoding, left ways use cpu decoding(default all)");
         app.add_option("--video_url", video_url, "video file path or stream url");
+        app.add_option("--video_urls", video_urls, "video file paths or stream urls of the wall, source i plays url i modulo count (default video_url)");
+        app.add_option("--sources", sources, "sources of the wall, paged by ways with page up and page down (default max of ways and video_urls count)");
+        app.add_option("--prefetch_tiles", prefetch_tiles, fmt::format("sources on each side of the page decoded hidden, so turning pages shows video at once (default {})", prefetch_tiles));
         app.add_option("--profile", profile, fmt::format("mpv profile (default {})", profile));
         app.add_option("--vo", vo, "mpv vo");
+        app.add_option("--render_mode", render_mode, fmt::format("window: a native window per way, sw: software render all ways into one widget, needs no gpu (default {})", render_mode));
         app.add_option("--hwdec", hwdec, fmt::format("mpv hwdec (default {})", hwdec));
         app.add_option("--gpu_api", gpu_api, "mpv gpu-api");
         app.add_option("--gpu_context", gpu_context, "mpv gpu-context");
-        app.add_option("--mpv_log_level", mpv_log_level, "mpv log level (default verbose)");
+        app.add_option("--mpv_log_level", mpv_log_level, fmt::format("mpv log level (default {})", mpv_log_level));
         app.add_option("--window_left_pos", window_left_pos, fmt::format("window left position (default {})", window_left_pos));
         app.add_option("--window_top_pos", window_top_pos, fmt::format("window left position (default {})", window_top_pos));
         app.add_option("--window_width", window_width, fmt::format("window width (default {})", window_width));
         app.add_option("--window_height", window_height, fmt::format("window height (default {})", window_height));
+        app.add_option("--decoder_threads_budget", decoder_threads_budget, "cores shared by decoder threads of all ways, 0 means all cores, -1 means mpv default (default 0)");
+        app.add_option("--quality_governor", quality_governor, "cheaper decoding for tiles smaller than the video (default true)");
+        app.add_option("--audio_focus", audio_focus, fmt::format("source that decodes audio alone, {} means all, {} means none, keys 1 to 9 move it to a tile of the page and 0 mutes all (default {})", AUDIO_FOCUS_ALL, AUDIO_FOCUS_NONE, audio_focus));
+        app.add_option("--load_shedding", load_shedding, "degrade the least important ways when cpu is saturated (default true)");
+        app.add_option("--shed_cpu_threshold", shed_cpu_threshold, fmt::format("process cpu as fraction of all cores that counts as saturated (default {})", shed_cpu_threshold));
+        app.add_option("--memory_budget", memory_budget, "MB shared by stream buffers and demuxer caches of all ways, split by tile size and bitrate (default 0, unlimited)");
+        app.add_option("--gop_cache_size", gop_cache_size, fmt::format("bytes of the last gop kept per local ts file, a tile joining the file starts with it instead of waiting for a key frame, 0 turns it off (default {})", gop_cache_size));
+        app.add_option("--probe_cache", probe_cache, "open a source played before with its known format and a tight probe, false probes every open in full (default true)");
+        app.add_option("--share_sources", share_sources, "tiles of the same url share one decoding player, sw render mode and bench only (default false)");
+        app.add_option("--network_ingest", network_ingest, "open each http or tcp:// url once and feed all its tiles from that connection, instead of a connection per tile (default false)");
+        app.add_option("--trace", trace, "record a timeline from start, F9 toggles it at runtime (default false)");
+        app.add_option("--trace_path", trace_path, fmt::format("chrome trace-event json written when recording stops or on exit, open in perfetto (default {})", trace_path));
+        app.add_option("--stats_key", stats_key, fmt::format("shared memory key of live counters read by qt-mpv-top, {} is the key it reads by default, empty keeps it off (default empty)", DEFAULT_STATS_KEY));
+        app.add_option("--process_mode", process_mode, "host each way in a worker process, a crashed or hung player only takes its tile down (default false)");
+        app.add_option("--worker_key", worker_key, "internal, set by the wall when it launches a worker: shared memory of the tile");
+        app.add_option("--worker_wid", worker_wid, "internal, container window of the worker");
+        app.add_option("--worker_buffer_size", worker_buffer_size, "internal, stream buffer size of the worker");
+        app.add_option("--bench", bench, "run ways players without window, then print a report (default false)");
+        app.add_option("--bench_seconds", bench_seconds, fmt::format("bench duration (default {})", bench_seconds));
+        app.add_option("--bench_channel_changes", bench_channel_changes, "after the bench, switch tile 0 that many times and report switch to first frame times (default 0)");
+        app.add_option("--bench_shed_level", bench_shed_level, "shed all players to this level for the second half of the bench and compare both halves, 1 low frame rate, 2 key frames only (default 0)");
     }
 
     void print()
@@ -65,11 +130,19 @@ public:
             "\nqt-mpv\n"
             "    --log_path={}\n"
             "    --log_level={}\n"
+            "    --log_async={}\n"
+            "    --log_queue_size={}\n"
+            "    --log_overflow={}\n"
+            "    --log_rate_limit={}\n"
             "    --ways={}\n"
             "    --gpu_ways={}\n"
             "    --video_url={}\n"
+            "    --video_urls={}\n"
+            "    --sources={}\n"
+            "    --prefetch_tiles={}\n"
             "    --profile={}\n"
             "    --vo={}\n"
+            "    --render_mode={}\n"
             "    --hwdec={}\n"
             "    --gpu_api={}\n"
             "    --gpu_context={}\n"
@@ -77,19 +150,50 @@ public:
             "    --window_left_pos={}\n"
             "    --window_top_pos={}\n"
             "    --window_width={}\n"
-            "    --window_height={}\n",
-            log_path, log_level, ways, gpu_ways, video_url, profile, vo, hwdec, gpu_api,
-            gpu_context, mpv_log_level, window_left_pos, window_top_pos, window_width, window_height
+            "    --window_height={}\n"
+            "    --decoder_threads_budget={}\n"
+            "    --quality_governor={}\n"
+            "    --audio_focus={}\n"
+            "    --load_shedding={}\n"
+            "    --shed_cpu_threshold={}\n"
+            "    --memory_budget={}\n"
+            "    --gop_cache_size={}\n"
+            "    --probe_cache={}\n"
+            "    --share_sources={}\n"
+            "    --network_ingest={}\n"
+            "    --trace={}\n"
+            "    --trace_path={}\n"
+            "    --stats_key={}\n"
+            "    --process_mode={}\n"
+            "    --worker_key={}\n"
+            "    --worker_wid={}\n"
+            "    --worker_buffer_size={}\n"
+            "    --bench={}\n"
+            "    --bench_seconds={}\n"
+            "    --bench_channel_changes={}\n"
+            "    --bench_shed_level={}\n",
+            log_path, log_level, log_async, log_queue_size, log_overflow, log_rate_limit, ways, gpu_ways, video_url, fmt::join(video_urls, ","), sources, prefetch_tiles, profile, vo, render_mode, hwdec, gpu_api,
+            gpu_context, mpv_log_level, window_left_pos, window_top_pos, window_width, window_height,
+            decoder_threads_budget, quality_governor, audio_focus, load_shedding, shed_cpu_threshold, memory_budget, gop_cache_size, probe_cache, share_sources, network_ingest, trace, trace_path, stats_key,
+            process_mode, worker_key, worker_wid, worker_buffer_size, bench, bench_seconds, bench_channel_changes, bench_shed_level
         );
     }
 
     std::string log_path;
     int log_level;
+    bool log_async;
+    uint32_t log_queue_size;
+    std::string log_overflow;
+    uint32_t log_rate_limit;
     int ways;
     int gpu_ways;
     std::string video_url;
+    std::vector<std::string> video_urls;
+    int sources;
+    int prefetch_tiles;
     std::string profile;
     std::string vo;
+    std::string render_mode;
     std::string hwdec;
     std::string gpu_api;
     std::string gpu_context;
@@ -98,6 +202,27 @@ public:
     int window_top_pos;
     int window_width;
     int window_height;
+    int decoder_threads_budget;
+    bool quality_governor;
+    int audio_focus;
+    bool load_shedding;
+    double shed_cpu_threshold;
+    uint32_t memory_budget;
+    uint32_t gop_cache_size;
+    bool probe_cache;
+    bool share_sources;
+    bool network_ingest;
+    bool trace;
+    std::string trace_path;
+    std::string stats_key;
+    bool process_mode;
+    std::string worker_key;
+    int64_t worker_wid;
+    uint32_t worker_buffer_size;
+    bool bench;
+    int bench_seconds;
+    int bench_channel_changes;
+    int bench_shed_level;
 };
 
 
@@ -112,31 +237,97 @@ int main(int argc, char** argv) {
     }
 
     // init log
-    auto file_logger = spdlog::rotating_logger_mt("qt-mpv", args.log_path, 10 * 1024 * 1024, 3);
+    std::shared_ptr<spdlog::logger> file_logger;
+    if (args.log_async) {
+        // only the writer thread touches the file, so the file sink needs no lock
+        auto file_sink = std::make_shared<spdlog::sinks::rotating_file_sink_st>(args.log_path, 10 * 1024 * 1024, 3);
+        auto async_sink = std::make_shared<AsyncLogSink>(file_sink, args.log_queue_size, args.log_overflow == "block" ? LogOverflowPolicy::Block : LogOverflowPolicy::Drop);
+        file_logger = std::make_shared<spdlog::logger>("qt-mpv", async_sink);
+        spdlog::register_logger(file_logger);
+    }
+    else {
+        file_logger = spdlog::rotating_logger_mt("qt-mpv", args.log_path, 10 * 1024 * 1024, 3);
+    }
     auto no_eof_formatter = std::make_unique<spdlog::pattern_formatter>("[%Y-%m-%d %H:%M:%S.%e] [%l] [%s L%# P%P T%t] %v", spdlog::pattern_time_type::local, std::string(""));  // disable eol
     file_logger->set_formatter(std::move(no_eof_formatter));
     spdlog::set_default_logger(file_logger);
     spdlog::set_level((spdlog::level::level_enum)args.log_level);
     spdlog::flush_on((spdlog::level::level_enum)args.log_level);
+    MpvWrapper::set_log_rate_limit(args.log_rate_limit);
+    ProbeCache::instance().set_enabled(args.probe_cache);
 
     args.print();
-    if (args.video_url.empty()) {
+    if (args.video_url.empty() && args.video_urls.empty()) {
         SPDLOG_ERROR("empty video_url not allowed\n");
         return -1;
     }
+    if (args.video_url.empty()) {
+        args.video_url = args.video_urls.front();
+    }
+
+    Tracer::set_output_path(args.trace_path);
+    if (args.trace) {
+        Tracer::set_enabled(true);
+    }
+
+    // one tile of a wall in process mode
+    if (!args.worker_key.empty()) {
+        int code = run_tile_worker(args.worker_key, args.worker_wid, args.video_url, args.profile, args.vo, args.hwdec, args.gpu_api, args.gpu_context, args.mpv_log_level, args.worker_buffer_size);
+        spdlog::shutdown();
+        return code;
+    }
+
+    if (args.bench) {
+        int code = run_bench(args.ways, args.bench_seconds, args.video_url, args.profile, args.vo, args.hwdec, args.mpv_log_level, args.decoder_threads_budget, (uint64_t)args.memory_budget * 1024 * 1024, args.bench_channel_changes, args.share_sources, args.network_ingest, args.bench_shed_level);
+        if (Tracer::is_enabled()) {
+            Tracer::dump();
+        }
+        spdlog::shutdown();
+        return code;
+    }
 
     QApplication qt_app(argc, argv);
     qt_app.setApplicationName("qt-mpv");
 
-    WindowWrapper w;
-    w.setWindowTitle(QString("qt-mpv %1").arg(QString::fromStdString(args.video_url)));
-    w.setGeometry(args.window_left_pos, args.window_top_pos, args.window_width, args.window_height);
-    w.show();
+    // the window and its players go before the log, their teardown still logs
+    int code = 0;
+    {
+        WindowWrapper w(args.render_mode == "sw" ? RenderMode::Software : RenderMode::Window);
+        w.setWindowTitle(QString("qt-mpv %1").arg(QString::fromStdString(args.video_url)));
+        w.setGeometry(args.window_left_pos, args.window_top_pos, args.window_width, args.window_height);
+        w.show();
+
+        w.get_mpv_manager()->set_decoder_thread_budget(args.decoder_threads_budget);
+        w.get_mpv_manager()->set_quality_governor(args.quality_governor);
+        w.get_mpv_manager()->set_audio_focus(args.audio_focus);
+        w.get_mpv_manager()->set_load_shedding(args.load_shedding, args.shed_cpu_threshold);
+        w.get_mpv_manager()->set_memory_budget((uint64_t)args.memory_budget * 1024 * 1024);
+        w.get_mpv_manager()->set_gop_cache_size(args.gop_cache_size);
+        w.get_mpv_manager()->set_source_sharing(args.share_sources);
+        w.get_mpv_manager()->set_network_ingest(args.network_ingest);
+        w.get_mpv_manager()->set_stats_key(args.stats_key);
+        w.get_mpv_manager()->set_process_mode(args.process_mode, QCoreApplication::applicationFilePath().toStdString());
+        // more sources than ways turn the wall into pages
+        std::vector<std::string> sources;
+        int source_count = args.sources > 0 ? args.sources : std::max(args.ways, (int)args.video_urls.size());
+        for (int i = 0; i < source_count; i++) {
+            sources.push_back(args.video_urls.empty() ? args.video_url : args.video_urls[i % args.video_urls.size()]);
+        }
 
-    if (!w.create_players(args.ways, args.gpu_ways, args.video_url, args.profile, args.vo, args.hwdec, args.gpu_api, args.gpu_context, args.mpv_log_level)) {
-        SPDLOG_ERROR("create_players error\n");
-        return -2;
+        if (!w.create_players(args.ways, args.gpu_ways, sources, args.prefetch_tiles, args.profile, args.vo, args.hwdec, args.gpu_api, args.gpu_context, args.mpv_log_level)) {
+            SPDLOG_ERROR("create_players error\n");
+            return -2;
+        }
+
+        code = qt_app.exec();
+    }
+
+    if (Tracer::is_enabled()) {
+        Tracer::dump();
     }
 
-    return qt_app.exec();
+    // drain async log queue
+    spdlog::shutdown();
+
+    return code;
 }
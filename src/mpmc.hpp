@@ -0,0 +1,136 @@
+#pragma once
+
+// c
+#include <stdint.h>
+
+// c++
+#include <atomic>
+#include <utility>
+
+// project
+#include "spsc.hpp"
+
+
+
+// lock free, bounded multi-producer multi-consumer queue
+// refer: https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+template<typename T>
+class lock_free_mpmc
+{
+public:
+	lock_free_mpmc(uint32_t capacity)
+		: m_cells(nullptr)
+		, m_mask(0)
+		, m_enqueue_offset(0)
+		, m_dequeue_offset(0)
+	{
+		if (capacity < 2) {
+			capacity = 2;
+		}
+		if (capacity & (capacity - 1)) {
+			capacity = roundup_pow_of_two(capacity);
+		}
+
+		m_cells = new cell[capacity];
+		m_mask = capacity - 1;
+		for (uint32_t i = 0; i < capacity; i++) {
+			STORE_ATOMIC_RELAXED(m_cells[i].sequence, (uint64_t)i);
+		}
+	}
+
+	~lock_free_mpmc()
+	{
+		delete[] m_cells;
+		m_cells = nullptr;
+	}
+
+	lock_free_mpmc(const lock_free_mpmc &) = delete;
+	lock_free_mpmc &operator=(const lock_free_mpmc &) = delete;
+
+	uint32_t capacity()
+	{
+		return m_mask + 1;
+	}
+
+	// returns false instead of waiting when the queue is full
+	bool try_put(T &&item)
+	{
+		cell *c = nullptr;
+		uint64_t offset = LOAD_ATOMIC_RELAXED(m_enqueue_offset);
+		while (true) {
+			c = &m_cells[offset & m_mask];
+			uint64_t sequence = c->sequence.load(std::memory_order_acquire);
+			int64_t diff = (int64_t)sequence - (int64_t)offset;
+			if (0 == diff) {
+				// the cell is free, try to claim it
+				if (m_enqueue_offset.compare_exchange_weak(offset, offset + 1, std::memory_order_relaxed)) {
+					break;
+				}
+			}
+			else if (diff < 0) {
+				// the consumer has not released this cell yet
+				return false;
+			}
+			else {
+				// another producer claimed the cell
+				offset = LOAD_ATOMIC_RELAXED(m_enqueue_offset);
+			}
+		}
+
+		c->data = std::move(item);
+
+		// publish the cell to consumers
+		c->sequence.store(offset + 1, std::memory_order_release);
+
+		return true;
+	}
+
+	// returns false instead of waiting when the queue is empty
+	bool try_get(T &item)
+	{
+		cell *c = nullptr;
+		uint64_t offset = LOAD_ATOMIC_RELAXED(m_dequeue_offset);
+		while (true) {
+			c = &m_cells[offset & m_mask];
+			uint64_t sequence = c->sequence.load(std::memory_order_acquire);
+			int64_t diff = (int64_t)sequence - (int64_t)(offset + 1);
+			if (0 == diff) {
+				// the cell is published, try to claim it
+				if (m_dequeue_offset.compare_exchange_weak(offset, offset + 1, std::memory_order_relaxed)) {
+					break;
+				}
+			}
+			else if (diff < 0) {
+				// no producer has published this cell yet
+				return false;
+			}
+			else {
+				// another consumer claimed the cell
+				offset = LOAD_ATOMIC_RELAXED(m_dequeue_offset);
+			}
+		}
+
+		item = std::move(c->data);
+
+		// hand the cell back to producers one lap later
+		c->sequence.store(offset + m_mask + 1, std::memory_order_release);
+
+		return true;
+	}
+
+
+private:
+	struct cell {
+		std::atomic<uint64_t> sequence;
+		T data;
+	};
+
+	cell *m_cells;  // the cells holding the data
+	uint32_t m_mask;  // capacity - 1
+	char m_padding_0[64];  // keep producers and consumers on different cache lines
+	std::atomic<uint64_t> m_enqueue_offset;  // next cell to put
+	char m_padding_1[64];
+	std::atomic<uint64_t> m_dequeue_offset;  // next cell to get
+	char m_padding_2[64];
+};
+
@@ -1,149 +1,2101 @@
 // self
 #include "mpv_manager.hpp"
 
+// fmt
+#include <fmt/format.h>
+
 // spdlog
 #include <spdlog/spdlog.h>
 
+// c++
+#include <algorithm>
+#include <condition_variable>
+#include <math.h>
+
 // qt
+#include <QtCore/QCoreApplication>
 #include <QtCore/QFile>
 #include <QtCore/QString>
 #include <QtWidgets/QWidget>
 
 // project
+#include "buffer_pool.hpp"
+#include "cpu_usage.hpp"
+#include "gop_cache.hpp"
 #include "mpv_wrapper.hpp"
+#include "network_ingest.hpp"
+#include "probe_cache.hpp"
+#include "snapshot.hpp"
+#include "stats_segment.hpp"
+#include "tile_process.hpp"
+#include "trace.hpp"
+#include "worker_pool.hpp"
 
 
 #define READ_INTERVAL_MS 40
+#define MAX_DECODER_THREADS 16
+#define GOVERNOR_INTERVAL_MS 1000
+#define GOVERNOR_SLEEP_MS 50
+#define SHED_HEADROOM 0.15
+#define SHED_RESTORE_SAMPLES 3
+#define SHED_HOT_THREADS 3
 #define READ_BUFFER_SIZE 32768
+// a live source is drained each round, a camera may send far more than a file read
+#define INGEST_READ_SIZE (512 * 1024)
+#define MEMORY_REBALANCE_INTERVALS 10
+#define STATS_PUBLISH_INTERVAL_MS 1000
+#define SUPERVISE_INTERVAL_MS 500
+#define MEMORY_DEFAULT_BITRATE (512 * 1024)
+#define MEMORY_HIDDEN_PRIORITY 0.25
+#define MEMORY_MIN_BUFFER_SIZE (256 * 1024)
+#define MEMORY_MIN_DEMUXER_BYTES (1024 * 1024)
+#define MEMORY_MIN_DEMUXER_BACK_BYTES (256 * 1024)
 #define STEADY_CLOCK_NOW() std::chrono::steady_clock::now()
 #define STEADY_CLOCK_DURATION(begin) std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin).count()
 
 
 
+// who owns a mosaic cell, the event thread that wins pending -> writing or the caller at deadline
+enum MosaicCellState : int {
+	MOSAIC_CELL_PENDING = 0,
+	MOSAIC_CELL_WRITING,
+	MOSAIC_CELL_DONE,
+	MOSAIC_CELL_FAILED,
+	MOSAIC_CELL_ABANDONED,
+};
+
+
+// a player or a worker the feeder writes to, with the session id it had when taken
+struct FeedTarget {
+	MpvWrapper *mpv;
+	TileProcess *process;
+	uint32_t id;
+};
+
+
+// one snapshot_mosaic call, outlives it when replies come late
+struct MosaicRound {
+	MosaicRound(int cells)
+		: states(new std::atomic<int>[cells])
+		, pending(0)
+		, pixels(nullptr)
+		, stride(0)
+	{
+		for (int i = 0; i < cells; i++) {
+			states[i] = MOSAIC_CELL_PENDING;
+		}
+	}
+
+	std::unique_ptr<std::atomic<int>[]> states;
+	std::mutex mutex;
+	std::condition_variable cond;
+	int pending;
+	// only written by the owner of a cell
+	uint8_t *pixels;
+	int stride;
+};
+
+
 MpvManager::MpvManager(uint32_t buffer_size)
 	: m_stopping(false)
+	, m_loop_file(false)
+	, m_gop_cache_size(DEFAULT_GOP_CACHE_SIZE)
+	, m_source_sharing(false)
+	, m_network_ingest(false)
+	, m_decoder_thread_budget(0)
+	, m_quality_governor(true)
+	, m_audio_focus(AUDIO_FOCUS_ALL)
+	, m_load_shedding(true)
+	, m_shed_cpu_threshold(DEFAULT_SHED_CPU_THRESHOLD)
+	, m_governor_thread(nullptr)
+	, m_memory_budget(DEFAULT_MEMORY_BUDGET)
 	, m_buffer_size(buffer_size)
 	, m_read_file_thread(nullptr)
+	, m_gpu_ways(0)
+	, m_render_mode(RenderMode::Window)
+	, m_renders_in_flight(0)
+	, m_channel_change_stats()
+	, m_process_mode(false)
+	, m_supervisor_thread(nullptr)
+	, m_worker_pool(nullptr)
+	, m_stats_segment(nullptr)
+	, m_stats_thread(nullptr)
 {
+	m_worker_pool = new WorkerPool();
 }
 
 
 MpvManager::~MpvManager()
 {
-	if (m_read_file_thread != nullptr) {
-		if (m_read_file_thread->joinable()) {
-			m_read_file_thread->join();
-		}
-		delete m_read_file_thread;
-	}
-	m_read_file_thread = nullptr;
-
 	stop_players();
+
+	// runs what stopped players left in the queue
+	delete m_worker_pool;
+	m_worker_pool = nullptr;
+
+	delete m_stats_segment;
+	m_stats_segment = nullptr;
 }
 
 
 
-bool create_mpv_player(
-	uint32_t buffer_size, int index, int64_t wid, std::map<int, MpvWrapper *> &index_to_mpv,
-	std::string video_url, std::string profile, std::string vo,
-	std::string hwdec, std::string gpu_api, std::string gpu_context, std::string log_level
+bool MpvManager::start_players(
+	std::map<int, QWidget *> &containers, int gpu_ways, std::string video_url,
+	std::string profile, std::string vo, std::string hwdec,
+	std::string gpu_api, std::string gpu_context, std::string log_level
 )
 {
-	MpvWrapper *mpv = new MpvWrapper(buffer_size);
-	if (nullptr == mpv) {
+	if (containers.empty()) {
 		return false;
 	}
 
-	index_to_mpv.insert(std::make_pair(index, mpv));
+	set_player_options(gpu_ways, profile, vo, hwdec, gpu_api, gpu_context, log_level);
+
+	// all areas first, so the thread budget of the first players already sees the others
+	for (auto iter = containers.begin(); iter != containers.end(); iter++) {
+		m_index_to_area[iter->first] = (int64_t)iter->second->width() * iter->second->height();
+	}
+	reserve_buffers((uint32_t)containers.size());
+
+	for (auto iter = containers.begin(); iter != containers.end(); iter++) {
+		if (!attach_player(iter->first, (int64_t)iter->second->winId(), video_url, (int64_t)iter->second->width() * iter->second->height())) {
+			stop_players();
+			return false;
+		}
+		set_tile_size(iter->first, iter->second->width(), iter->second->height());
+	}
 
-	return mpv->start(wid, video_url, profile, vo, hwdec, gpu_api, gpu_context, log_level);
+	return true;
 }
 
 
 bool MpvManager::start_players(
-	std::map<int, QWidget *> &containers, int gpu_ways, std::string video_url,
+	std::map<int, int64_t> &index_to_wid, int gpu_ways, std::string video_url,
 	std::string profile, std::string vo, std::string hwdec,
 	std::string gpu_api, std::string gpu_context, std::string log_level
 )
 {
-	if (containers.empty()) {
+	if (index_to_wid.empty()) {
 		return false;
 	}
 
-	for (auto iter = containers.begin(); iter != containers.end(); iter++) {
-		int index = iter->first;
-		if (!create_mpv_player(m_buffer_size, index, (int64_t)iter->second->winId(), m_index_to_mpv_wrapper, video_url, profile, vo, index < gpu_ways ? hwdec : "", gpu_api, gpu_context, log_level)) {
+	set_player_options(gpu_ways, profile, vo, hwdec, gpu_api, gpu_context, log_level);
+
+	for (auto iter = index_to_wid.begin(); iter != index_to_wid.end(); iter++) {
+		m_index_to_area[iter->first] = 0;
+	}
+	reserve_buffers((uint32_t)index_to_wid.size());
+
+	for (auto iter = index_to_wid.begin(); iter != index_to_wid.end(); iter++) {
+		if (!attach_player(iter->first, iter->second, video_url)) {
 			stop_players();
 			return false;
 		}
 	}
 
+	return true;
+}
+
+
+void MpvManager::stop_players()
+{
+	m_stopping = true;
+
+	std::map<int, MpvWrapper *> index_to_mpv_wrapper;
+	{
+		std::lock_guard<std::mutex> lock(m_players_mutex);
+		for (auto iter = m_index_to_mpv_wrapper.begin(); iter != m_index_to_mpv_wrapper.end(); iter++) {
+			if (iter->second != nullptr) {
+				iter->second->stopping();
+			}
+		}
+		for (auto iter = m_index_to_tile_process.begin(); iter != m_index_to_tile_process.end(); iter++) {
+			iter->second->stopping();
+		}
+		for (auto iter = m_index_to_standby.begin(); iter != m_index_to_standby.end(); iter++) {
+			iter->second->stopping();
+		}
+	}
+
+	// the read thread writes to players, let it leave before deleting them, unless it is the caller
+	if (m_read_file_thread != nullptr) {
+		if (m_read_file_thread->get_id() == std::this_thread::get_id()) {
+			m_read_file_thread->detach();
+		}
+		else if (m_read_file_thread->joinable()) {
+			m_read_file_thread->join();
+		}
+		delete m_read_file_thread;
+		m_read_file_thread = nullptr;
+	}
+
+	if (m_governor_thread != nullptr) {
+		if (m_governor_thread->joinable()) {
+			m_governor_thread->join();
+		}
+		delete m_governor_thread;
+		m_governor_thread = nullptr;
+	}
+
+	if (m_stats_thread != nullptr) {
+		if (m_stats_thread->joinable()) {
+			m_stats_thread->join();
+		}
+		delete m_stats_thread;
+		m_stats_thread = nullptr;
+	}
+
+	if (m_supervisor_thread != nullptr) {
+		if (m_supervisor_thread->joinable()) {
+			m_supervisor_thread->join();
+		}
+		delete m_supervisor_thread;
+		m_supervisor_thread = nullptr;
+	}
+
+	std::map<int, TileProcess *> index_to_tile_process;
+	std::map<int, MpvWrapper *> index_to_standby;
+	std::vector<MpvWrapper *> idle_mpv_wrappers;
+	std::vector<TileProcess *> idle_tile_processes;
+	{
+		std::lock_guard<std::mutex> lock(m_players_mutex);
+		index_to_mpv_wrapper.swap(m_index_to_mpv_wrapper);
+		index_to_tile_process.swap(m_index_to_tile_process);
+		index_to_standby.swap(m_index_to_standby);
+		idle_mpv_wrappers.swap(m_idle_mpv_wrappers);
+		idle_tile_processes.swap(m_idle_tile_processes);
+		m_index_to_standby_url.clear();
+		m_index_to_standby_file_path.clear();
+		m_index_to_url.clear();
+		m_index_to_shared_index.clear();
+		m_index_to_view.clear();
+		m_standby_hwdec_indexes.clear();
+		m_index_to_change_time.clear();
+		m_index_to_file_path.clear();
+		m_hwdec_indexes.clear();
+		m_index_to_area.clear();
+		m_index_to_bitrate.clear();
+	}
+
+	// a render that found its player before the maps were emptied still uses it
+	{
+		std::unique_lock<std::mutex> lock(m_players_mutex);
+		m_renders_done.wait(lock, [this]() { return 0 == m_renders_in_flight; });
+	}
+
+	for (auto iter = index_to_mpv_wrapper.begin(); iter != index_to_mpv_wrapper.end(); iter++) {
+		if (iter->second != nullptr) {
+			delete iter->second;
+			iter->second = nullptr;
+		}
+	}
+
+	for (auto iter = index_to_standby.begin(); iter != index_to_standby.end(); iter++) {
+		delete iter->second;
+	}
+
+	for (auto mpv : idle_mpv_wrappers) {
+		delete mpv;
+	}
+
+	// workers were told to stop above, most have exited by now
+	for (auto iter = index_to_tile_process.begin(); iter != index_to_tile_process.end(); iter++) {
+		delete iter->second;
+	}
+	for (auto process : idle_tile_processes) {
+		delete process;
+	}
+
+	BufferPoolStatistics pool_stats;
+	BufferPool::instance().get_statistics(pool_stats);
+	SPDLOG_INFO(
+		"[mpv manager] buffer pool: {} of {} acquires hit, peak {} buffers ({} bytes), {} bytes pooled\n",
+		pool_stats.hits, pool_stats.acquires, pool_stats.peak_in_use, pool_stats.peak_in_use_bytes, pool_stats.pooled_bytes
+	);
+
+	ProbeCacheStatistics probe_stats;
+	ProbeCache::instance().get_statistics(probe_stats);
+	SPDLOG_INFO(
+		"[mpv manager] first frame after full probe: {} opens, mean {} ms, after cached probe: {} opens, mean {} ms, {} cached probes dropped\n",
+		probe_stats.cold_opens, probe_stats.cold_opens > 0 ? probe_stats.cold_first_frame_ms / (int64_t)probe_stats.cold_opens : 0,
+		probe_stats.warm_opens, probe_stats.warm_opens > 0 ? probe_stats.warm_first_frame_ms / (int64_t)probe_stats.warm_opens : 0,
+		probe_stats.invalidations
+	);
+
+	ChannelChangeStatistics change_stats;
+	get_channel_change_statistics(change_stats);
+	if (change_stats.changes > 0) {
+		SPDLOG_INFO(
+			"[mpv manager] channel changes: {}, {} without a frame, min {} ms, mean {} ms, max {} ms\n",
+			change_stats.changes, change_stats.timeouts, change_stats.min_ms, change_stats.total_ms / (int64_t)change_stats.changes, change_stats.max_ms
+		);
+	}
+}
+
+
+void MpvManager::set_player_options(
+	int gpu_ways, std::string profile, std::string vo, std::string hwdec,
+	std::string gpu_api, std::string gpu_context, std::string log_level
+)
+{
+	m_gpu_ways = gpu_ways;
+	m_profile = profile;
+	m_vo = vo;
+	m_hwdec = hwdec;
+	m_gpu_api = gpu_api;
+	m_gpu_context = gpu_context;
+	m_log_level = log_level;
+}
+
+
+void MpvManager::reserve_buffers(uint32_t count)
+{
+	// fault in all rings up front instead of one per player start
+	BufferPool::instance().reserve(count, m_buffer_size);
+}
+
+
+bool MpvManager::attach_player(int index, int64_t wid, std::string video_url, int64_t area, bool shown)
+{
+	if (m_process_mode) {
+		return attach_tile_process(index, wid, video_url, area, shown);
+	}
+
+	detach_player(index);
+
+	// a tile of a source that is decoded already renders the frames of that player
+	if (m_source_sharing && (RenderMode::Software == m_render_mode || 0 == wid)) {
+		std::lock_guard<std::mutex> lock(m_players_mutex);
+		for (auto iter = m_index_to_url.begin(); iter != m_index_to_url.end(); iter++) {
+			if (iter->second == video_url && m_index_to_mpv_wrapper.count(iter->first) > 0) {
+				m_index_to_shared_index[index] = iter->first;
+				m_index_to_view[index] = TileView{ true, 0, 0, 0 };
+				apply_views(iter->first);
+				SPDLOG_INFO("[mpv manager] tile {} shares the player of tile {}, {}\n", index, iter->first, video_url);
+				return true;
+			}
+		}
+	}
+
+	MpvWrapper *mpv = acquire_player();
+	if (nullptr == mpv) {
+		return false;
+	}
+
+	bool use_hwdec = false;
+	std::map<int, int> index_to_threads;
+	std::map<int, PlayerMemoryLimits> index_to_limits;
+	{
+		std::lock_guard<std::mutex> lock(m_players_mutex);
+		m_index_to_area[index] = area;
+		index_to_threads = budget_decoder_threads();
+		index_to_limits = budget_memory();
+		use_hwdec = (int)m_hwdec_indexes.size() < m_gpu_ways;
+	}
+
+	// a gpu decoder keeps mpv's thread count
+	auto threads_iter = index_to_threads.find(index);
+	mpv->set_decoder_threads(!use_hwdec && threads_iter != index_to_threads.end() ? threads_iter->second : 0);
+	auto limits_iter = index_to_limits.find(index);
+	mpv->set_memory_limits(limits_iter != index_to_limits.end() ? limits_iter->second : PlayerMemoryLimits{ m_buffer_size, 0, 0 });
+	mpv->set_quality_governor(m_quality_governor);
+	mpv->set_audio_enabled(has_audio_focus(index));
+	mpv->set_first_frame_callback(nullptr);
+	mpv->set_render_mode(m_render_mode);
+	mpv->set_render_update_callback(m_render_update_callback);
+	mpv->set_fed_input(is_fed_source(video_url));
+
+	if (!mpv->start(wid, video_url, m_profile, m_vo, use_hwdec ? m_hwdec : "", m_gpu_api, m_gpu_context, m_log_level)) {
+		SPDLOG_ERROR("[mpv manager] start player of source {} error, {}\n", index, video_url);
+		std::lock_guard<std::mutex> lock(m_players_mutex);
+		m_index_to_area.erase(index);
+		m_idle_mpv_wrappers.push_back(mpv);
+		return false;
+	}
+
+	// prefetched sources decode into a container that is not on screen yet
+	if (!shown) {
+		mpv->set_container_window_visible(false);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_players_mutex);
+		m_index_to_mpv_wrapper[index] = mpv;
+		m_index_to_url[index] = video_url;
+		m_index_to_view[index] = TileView{ true, 0, 0, 0 };
+		if (use_hwdec) {
+			m_hwdec_indexes.insert(index);
+		}
+		// the others give up their share to the new tile
+		rebalance_memory();
+		rebalance_decoder_threads();
+		if (is_fed_source(video_url)) {
+			m_index_to_file_path[index] = video_url;
+		}
+	}
+
 	m_stopping = false;
 
-	QString path = QString::fromStdString(video_url);
-	if (QFile(path).exists()) {
-		m_read_file_thread = new std::thread(
-			[path, this]() {
-				QFile stream(path);
-				if (stream.open(QIODevice::ReadOnly)) {
-					std::chrono::steady_clock::time_point time_point_begin;
-					bool finished = false;
-					while (!m_stopping) {
-						time_point_begin = STEADY_CLOCK_NOW();
-
-						QByteArray buf = stream.read(READ_BUFFER_SIZE);
-						if (buf.isEmpty()) {
-							break;
-						}
+	if (m_load_shedding && nullptr == m_governor_thread) {
+		m_governor_thread = new std::thread(govern_load, this);
+	}
 
-						for (auto iter = m_index_to_mpv_wrapper.begin(); !m_stopping && iter != m_index_to_mpv_wrapper.end(); iter++) {
-							if (!iter->second->write((const uint8_t *)buf.constData(), (uint32_t)buf.size())) {
-								finished = true;
-								break;
-							}
-							if (m_stopping) {
-								finished = true;
-								break;
-							}
-						}
-						if (finished) {
-							break;
-						}
+	if (m_stats_segment != nullptr && nullptr == m_stats_thread) {
+		m_stats_thread = new std::thread(publish_stats, this);
+	}
 
-						auto duration = STEADY_CLOCK_DURATION(time_point_begin);
-						if (READ_INTERVAL_MS > duration) {
-							std::this_thread::sleep_for(std::chrono::milliseconds(READ_INTERVAL_MS - duration));
-						}
+	if (nullptr == m_read_file_thread) {
+		m_read_file_thread = new std::thread(feed_files, this);
+	}
+
+	return true;
+}
+
+
+MpvWrapper *MpvManager::acquire_player()
+{
+	MpvWrapper *mpv = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(m_players_mutex);
+		if (!m_idle_mpv_wrappers.empty()) {
+			mpv = m_idle_mpv_wrappers.back();
+			m_idle_mpv_wrappers.pop_back();
+		}
+	}
+	if (mpv != nullptr) {
+		// the previous source's state must not leak into this one
+		mpv->set_shed_level(ShedLevel::Off);
+		mpv->set_visible(true);
+	}
+	else {
+		mpv = new MpvWrapper(m_buffer_size);
+	}
+	return mpv;
+}
+
+
+void MpvManager::release_player(MpvWrapper *mpv)
+{
+	std::lock_guard<std::mutex> lock(m_players_mutex);
+	m_idle_mpv_wrappers.push_back(mpv);
+}
+
+
+bool MpvManager::attach_tile_process(int index, int64_t wid, std::string video_url, int64_t area, bool shown)
+{
+	detach_player(index);
+
+	TileProcess *process = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(m_players_mutex);
+		if (!m_idle_tile_processes.empty()) {
+			process = m_idle_tile_processes.back();
+			m_idle_tile_processes.pop_back();
+		}
+	}
+	if (nullptr == process) {
+		process = new TileProcess();
+	}
+
+	bool use_hwdec = false;
+	std::map<int, int> index_to_threads;
+	{
+		std::lock_guard<std::mutex> lock(m_players_mutex);
+		m_index_to_area[index] = area;
+		index_to_threads = budget_decoder_threads();
+		use_hwdec = (int)m_hwdec_indexes.size() < m_gpu_ways;
+	}
+
+	// the player of the worker gets the same ring, the shared one only bridges feeder rounds
+	TileProcessOptions options;
+	options.program = m_worker_program;
+	options.profile = m_profile;
+	options.vo = m_vo;
+	options.hwdec = use_hwdec ? m_hwdec : "";
+	options.gpu_api = m_gpu_api;
+	options.gpu_context = m_gpu_context;
+	options.log_level = m_log_level;
+	options.log_path = fmt::format("qt-mpv-tile-{}.log", index);
+	options.buffer_size = m_buffer_size;
+	options.ring_size = DEFAULT_WORKER_RING_SIZE;
+	auto threads_iter = index_to_threads.find(index);
+	options.decoder_threads = threads_iter != index_to_threads.end() ? threads_iter->second : 0;
+	options.quality_governor = m_quality_governor;
+	options.audio_enabled = has_audio_focus(index);
+	options.fed_input = is_fed_source(video_url);
+
+	if (!process->start(index, wid, video_url, shown, options)) {
+		SPDLOG_ERROR("[mpv manager] start worker of source {} error, {}\n", index, video_url);
+		std::lock_guard<std::mutex> lock(m_players_mutex);
+		m_index_to_area.erase(index);
+		m_idle_tile_processes.push_back(process);
+		return false;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_players_mutex);
+		m_index_to_tile_process[index] = process;
+		if (use_hwdec) {
+			m_hwdec_indexes.insert(index);
+		}
+		if (is_fed_source(video_url)) {
+			m_index_to_file_path[index] = video_url;
+		}
+	}
+
+	m_stopping = false;
+
+	// no governor, it measures the cpu of this process only and workers burn theirs elsewhere
+	if (nullptr == m_supervisor_thread) {
+		m_supervisor_thread = new std::thread(supervise_workers, this);
+	}
+
+	if (m_stats_segment != nullptr && nullptr == m_stats_thread) {
+		m_stats_thread = new std::thread(publish_stats, this);
+	}
+
+	if (nullptr == m_read_file_thread) {
+		m_read_file_thread = new std::thread(feed_files, this);
+	}
+
+	return true;
+}
+
+
+void MpvManager::detach_player(int index)
+{
+	cancel_channel_change(index);
+
+	MpvWrapper *mpv = nullptr;
+	TileProcess *process = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(m_players_mutex);
+
+		// a tile sharing a player only lets go of it
+		auto shared_iter = m_index_to_shared_index.find(index);
+		if (shared_iter != m_index_to_shared_index.end()) {
+			int owner = shared_iter->second;
+			m_index_to_shared_index.erase(shared_iter);
+			m_index_to_view.erase(index);
+			apply_views(owner);
+			return;
+		}
+
+		auto iter = m_index_to_mpv_wrapper.find(index);
+		auto process_iter = m_index_to_tile_process.find(index);
+		if (iter == m_index_to_mpv_wrapper.end() && process_iter == m_index_to_tile_process.end()) {
+			return;
+		}
+		if (iter != m_index_to_mpv_wrapper.end()) {
+			// the player goes on for the tiles sharing it, the first of them owns it from now on
+			std::vector<int> views = get_view_indexes(index);
+			if (views.size() > 1) {
+				int heir = views[1];
+				m_index_to_shared_index.erase(heir);
+				for (auto shared = m_index_to_shared_index.begin(); shared != m_index_to_shared_index.end(); shared++) {
+					if (shared->second == index) {
+						shared->second = heir;
 					}
 				}
-
-				if (!m_stopping) {
-					stop_players();
+				auto move_key = [index, heir](auto &index_to_value) {
+					auto value_iter = index_to_value.find(index);
+					if (value_iter != index_to_value.end()) {
+						index_to_value[heir] = value_iter->second;
+						index_to_value.erase(value_iter);
+					}
+				};
+				move_key(m_index_to_mpv_wrapper);
+				move_key(m_index_to_url);
+				move_key(m_index_to_file_path);
+				move_key(m_index_to_area);
+				move_key(m_index_to_bitrate);
+				if (m_hwdec_indexes.erase(index) > 0) {
+					m_hwdec_indexes.insert(heir);
 				}
+				m_index_to_view.erase(index);
+				apply_views(heir);
+				SPDLOG_INFO("[mpv manager] player of tile {} handed to tile {}\n", index, heir);
+				return;
 			}
-		);
+
+			mpv = iter->second;
+			m_index_to_mpv_wrapper.erase(iter);
+		}
+		if (process_iter != m_index_to_tile_process.end()) {
+			process = process_iter->second;
+			m_index_to_tile_process.erase(process_iter);
+		}
+		m_index_to_file_path.erase(index);
+		m_index_to_url.erase(index);
+		m_index_to_view.erase(index);
+		m_hwdec_indexes.erase(index);
+		m_index_to_area.erase(index);
+		m_index_to_bitrate.erase(index);
+		rebalance_memory();
+		rebalance_decoder_threads();
 	}
 
-	return true;
+	// the feeder may still hold it, stop() makes its writes fail and the next start changes its id
+	if (mpv != nullptr) {
+		mpv->stop();
+		release_player(mpv);
+	}
+
+	// same for a worker, its session id changes with the next start
+	if (process != nullptr) {
+		process->stop();
+		std::lock_guard<std::mutex> lock(m_players_mutex);
+		m_idle_tile_processes.push_back(process);
+	}
 }
 
 
-void MpvManager::stop_players()
+bool MpvManager::change_channel(int index, int64_t wid, std::string video_url, ChannelReadyCallback callback)
 {
-	m_stopping = true;
+	// a worker would need a second worker as standby
+	if (m_process_mode) {
+		return false;
+	}
 
-	for (auto iter = m_index_to_mpv_wrapper.begin(); iter != m_index_to_mpv_wrapper.end(); iter++) {
-		if (iter->second != nullptr) {
-			iter->second->stopping();
+	// the other tiles of a shared player must not follow, the tile switches cold
+	{
+		std::lock_guard<std::mutex> lock(m_players_mutex);
+		if (m_index_to_shared_index.count(index) > 0 || get_view_indexes(index).size() > 1) {
+			return false;
 		}
 	}
 
-	for (auto iter = m_index_to_mpv_wrapper.begin(); iter != m_index_to_mpv_wrapper.end(); iter++) {
-		if (iter->second != nullptr) {
-			delete iter->second;
-			iter->second = nullptr;
+	// a change still in flight is superseded
+	cancel_channel_change(index);
+
+	MpvWrapper *mpv = acquire_player();
+	if (nullptr == mpv) {
+		return false;
+	}
+
+	// the standby takes over decoder, threads and memory share of the player it replaces
+	bool use_hwdec = false;
+	std::map<int, int> index_to_threads;
+	std::map<int, PlayerMemoryLimits> index_to_limits;
+	{
+		std::lock_guard<std::mutex> lock(m_players_mutex);
+		index_to_threads = budget_decoder_threads();
+		index_to_limits = budget_memory();
+		use_hwdec = m_hwdec_indexes.count(index) > 0 || (int)m_hwdec_indexes.size() < m_gpu_ways;
+	}
+
+	// a software standby replacing a gpu player is not in the split yet, it gets its share after the swap
+	auto threads_iter = index_to_threads.find(index);
+	mpv->set_decoder_threads(!use_hwdec && threads_iter != index_to_threads.end() ? threads_iter->second : 0);
+	auto limits_iter = index_to_limits.find(index);
+	mpv->set_memory_limits(limits_iter != index_to_limits.end() ? limits_iter->second : PlayerMemoryLimits{ m_buffer_size, 0, 0 });
+	mpv->set_quality_governor(m_quality_governor);
+	// the current player keeps the sound until the swap
+	mpv->set_audio_enabled(false);
+	mpv->set_render_mode(m_render_mode);
+	mpv->set_render_update_callback(m_render_update_callback);
+	mpv->set_fed_input(is_fed_source(video_url));
+	if (callback) {
+		mpv->set_first_frame_callback([callback, index]() { callback(index); });
+	}
+	else {
+		mpv->set_first_frame_callback(nullptr);
+	}
+
+	auto change_time = STEADY_CLOCK_NOW();
+	if (!mpv->start(wid, video_url, m_profile, m_vo, use_hwdec ? m_hwdec : "", m_gpu_api, m_gpu_context, m_log_level)) {
+		SPDLOG_ERROR("[mpv manager] start standby of source {} error, {}\n", index, video_url);
+		release_player(mpv);
+		return false;
+	}
+
+	// decodes off screen until the swap
+	mpv->set_container_window_visible(false);
+
+	{
+		std::lock_guard<std::mutex> lock(m_players_mutex);
+		m_index_to_standby[index] = mpv;
+		m_index_to_standby_url[index] = video_url;
+		m_index_to_change_time[index] = change_time;
+		if (use_hwdec) {
+			m_standby_hwdec_indexes.insert(index);
+		}
+		if (is_fed_source(video_url)) {
+			m_index_to_standby_file_path[index] = video_url;
 		}
 	}
-	m_index_to_mpv_wrapper.clear();
+	SPDLOG_INFO("[mpv manager] tile {} changes channel to {}, standby {}\n", index, video_url, mpv->get_id());
+
+	m_stopping = false;
+
+	if (nullptr == m_read_file_thread) {
+		m_read_file_thread = new std::thread(feed_files, this);
+	}
+
+	return true;
 }
 
+
+bool MpvManager::swap_channel(int index)
+{
+	MpvWrapper *mpv = nullptr;
+	MpvWrapper *standby = nullptr;
+	int64_t change_ms = 0;
+	int64_t first_frame_ms = -1;
+	{
+		std::lock_guard<std::mutex> lock(m_players_mutex);
+		auto standby_iter = m_index_to_standby.find(index);
+		if (standby_iter == m_index_to_standby.end()) {
+			return false;
+		}
+		standby = standby_iter->second;
+		m_index_to_standby.erase(standby_iter);
+		change_ms = STEADY_CLOCK_DURATION(m_index_to_change_time[index]);
+		m_index_to_change_time.erase(index);
+		first_frame_ms = standby->get_first_frame_ms();
+
+		// one step under the lock, the feeder and the compositor see either player but never none
+		auto iter = m_index_to_mpv_wrapper.find(index);
+		if (iter != m_index_to_mpv_wrapper.end()) {
+			mpv = iter->second;
+		}
+		m_index_to_mpv_wrapper[index] = standby;
+		m_index_to_url[index] = m_index_to_standby_url[index];
+		m_index_to_standby_url.erase(index);
+		auto view_iter = m_index_to_view.find(index);
+		if (view_iter != m_index_to_view.end()) {
+			view_iter->second.frame_serial = 0;
+		}
+		else {
+			m_index_to_view[index] = TileView{ true, 0, 0, 0 };
+		}
+
+		auto path_iter = m_index_to_standby_file_path.find(index);
+		if (path_iter != m_index_to_standby_file_path.end()) {
+			m_index_to_file_path[index] = path_iter->second;
+			m_index_to_standby_file_path.erase(path_iter);
+		}
+		else {
+			m_index_to_file_path.erase(index);
+		}
+		if (m_standby_hwdec_indexes.erase(index) > 0) {
+			m_hwdec_indexes.insert(index);
+		}
+		else {
+			m_hwdec_indexes.erase(index);
+		}
+		// the new source has its own bitrate
+		m_index_to_bitrate.erase(index);
+		rebalance_memory();
+		rebalance_decoder_threads();
+
+		standby->set_audio_enabled(has_audio_focus(index));
+
+		ChannelChangeStatistics &stats = m_channel_change_stats;
+		stats.min_ms = 0 == stats.changes ? change_ms : std::min(stats.min_ms, change_ms);
+		stats.max_ms = std::max(stats.max_ms, change_ms);
+		stats.changes++;
+		stats.last_ms = change_ms;
+		stats.total_ms += change_ms;
+		if (first_frame_ms < 0) {
+			stats.timeouts++;
+		}
+	}
+
+	if (first_frame_ms < 0) {
+		SPDLOG_WARN("[mpv manager] tile {} changed channel after {} ms without a frame of the standby\n", index, change_ms);
+	}
+	else {
+		SPDLOG_INFO("[mpv manager] tile {} changed channel in {} ms, first frame of standby after {} ms\n", index, change_ms, first_frame_ms);
+	}
+	TRACE_INSTANT("manager", "channel_change", index, change_ms);
+
+	// the feeder may still hold it, same as detach
+	if (mpv != nullptr) {
+		mpv->stop();
+		release_player(mpv);
+	}
+
+	return true;
+}
+
+
+void MpvManager::cancel_channel_change(int index)
+{
+	MpvWrapper *standby = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(m_players_mutex);
+		auto standby_iter = m_index_to_standby.find(index);
+		if (standby_iter == m_index_to_standby.end()) {
+			return;
+		}
+		standby = standby_iter->second;
+		m_index_to_standby.erase(standby_iter);
+		m_index_to_standby_url.erase(index);
+		m_index_to_standby_file_path.erase(index);
+		m_standby_hwdec_indexes.erase(index);
+		m_index_to_change_time.erase(index);
+	}
+
+	SPDLOG_INFO("[mpv manager] channel change of tile {} cancelled\n", index);
+	standby->stop();
+	release_player(standby);
+}
+
+
+bool MpvManager::is_channel_ready(int index)
+{
+	std::lock_guard<std::mutex> lock(m_players_mutex);
+	auto standby_iter = m_index_to_standby.find(index);
+	return standby_iter != m_index_to_standby.end() && standby_iter->second->get_first_frame_ms() >= 0;
+}
+
+
+void MpvManager::get_channel_change_statistics(ChannelChangeStatistics &stats)
+{
+	std::lock_guard<std::mutex> lock(m_players_mutex);
+	stats = m_channel_change_stats;
+}
+
+
+std::set<int> MpvManager::get_attached_indexes()
+{
+	std::set<int> indexes;
+	std::lock_guard<std::mutex> lock(m_players_mutex);
+	for (auto iter = m_index_to_mpv_wrapper.begin(); iter != m_index_to_mpv_wrapper.end(); iter++) {
+		indexes.insert(iter->first);
+	}
+	for (auto iter = m_index_to_tile_process.begin(); iter != m_index_to_tile_process.end(); iter++) {
+		indexes.insert(iter->first);
+	}
+	for (auto iter = m_index_to_shared_index.begin(); iter != m_index_to_shared_index.end(); iter++) {
+		indexes.insert(iter->first);
+	}
+	return indexes;
+}
+
+
+void MpvManager::set_render_mode(RenderMode mode)
+{
+	m_render_mode = mode;
+}
+
+
+void MpvManager::set_render_update_callback(std::function<void()> callback)
+{
+	m_render_update_callback = callback;
+}
+
+
+bool MpvManager::render_tile(int index, int width, int height, void *pixels, size_t stride, bool force)
+{
+	MpvWrapper *mpv = nullptr;
+	uint64_t frame_serial = 0;
+	{
+		std::lock_guard<std::mutex> lock(m_players_mutex);
+		auto view_iter = m_index_to_view.find(index);
+		auto iter = m_index_to_mpv_wrapper.find(get_owner_index(index));
+		if (view_iter == m_index_to_view.end() || iter == m_index_to_mpv_wrapper.end() || nullptr == iter->second) {
+			return false;
+		}
+		mpv = iter->second;
+		frame_serial = view_iter->second.frame_serial;
+		m_renders_in_flight++;
+	}
+
+	// a software render takes milliseconds, attach, the feeder and the governor must not wait for it
+	// a player detached meanwhile is stopped, not deleted, and renders nothing
+	bool rendered = mpv->render(width, height, pixels, stride, frame_serial, force);
+
+	{
+		std::lock_guard<std::mutex> lock(m_players_mutex);
+		// the serial belongs to the player the tile still has, a swapped in one starts from 0
+		auto view_iter = m_index_to_view.find(index);
+		auto iter = m_index_to_mpv_wrapper.find(get_owner_index(index));
+		if (view_iter != m_index_to_view.end() && iter != m_index_to_mpv_wrapper.end() && iter->second == mpv) {
+			view_iter->second.frame_serial = frame_serial;
+		}
+		m_renders_in_flight--;
+	}
+	m_renders_done.notify_all();
+
+	return rendered;
+}
+
+
+void MpvManager::feed_files(void *ptr)
+{
+	if (nullptr == ptr) {
+		return;
+	}
+
+	MpvManager *thiz = (MpvManager *)ptr;
+	Tracer::set_thread_name("feeder");
+
+	// one reader per file and one ingest per network source, shared by all sources playing it
+	std::map<std::string, QFile *> path_to_file;
+	// last gop of each file, seeds the players that join it
+	std::map<std::string, GopCache *> path_to_gop_cache;
+	// players and workers by session that got the gop of their file already
+	std::set<std::pair<const void *, uint32_t>> seeded_targets;
+	std::set<std::string> finished_paths;
+	std::chrono::steady_clock::time_point time_point_begin;
+	bool finished = false;
+	while (!thiz->m_stopping && !finished) {
+		time_point_begin = STEADY_CLOCK_NOW();
+		// the round without its sleep
+		bool tracing = Tracer::is_enabled();
+		uint64_t round_begin_ns = tracing ? Tracer::now_ns() : 0;
+
+		// snapshot players with their session id, paging may recycle one while we write to it
+		std::map<std::string, std::vector<FeedTarget>> path_to_players;
+		{
+			std::lock_guard<std::mutex> lock(thiz->m_players_mutex);
+			for (auto iter = thiz->m_index_to_file_path.begin(); iter != thiz->m_index_to_file_path.end(); iter++) {
+				auto mpv_iter = thiz->m_index_to_mpv_wrapper.find(iter->first);
+				if (mpv_iter != thiz->m_index_to_mpv_wrapper.end() && mpv_iter->second != nullptr) {
+					path_to_players[iter->second].push_back(FeedTarget{ mpv_iter->second, nullptr, mpv_iter->second->get_id() });
+				}
+				auto process_iter = thiz->m_index_to_tile_process.find(iter->first);
+				if (process_iter != thiz->m_index_to_tile_process.end()) {
+					path_to_players[iter->second].push_back(FeedTarget{ nullptr, process_iter->second, process_iter->second->get_id() });
+				}
+			}
+			// standbys of channel changes join the reader of their file wherever it is, like a live tune-in
+			for (auto iter = thiz->m_index_to_standby_file_path.begin(); iter != thiz->m_index_to_standby_file_path.end(); iter++) {
+				auto standby_iter = thiz->m_index_to_standby.find(iter->first);
+				if (standby_iter != thiz->m_index_to_standby.end()) {
+					path_to_players[iter->second].push_back(FeedTarget{ standby_iter->second, nullptr, standby_iter->second->get_id() });
+				}
+			}
+		}
+
+		// close files nobody plays anymore
+		for (auto iter = path_to_file.begin(); iter != path_to_file.end();) {
+			if (path_to_players.find(iter->first) == path_to_players.end()) {
+				delete iter->second;
+				finished_paths.erase(iter->first);
+				delete path_to_gop_cache[iter->first];
+				path_to_gop_cache.erase(iter->first);
+				iter = path_to_file.erase(iter);
+			}
+			else {
+				iter++;
+			}
+		}
+		// and hang up on network sources, out of the lock, a receiver may be in the middle of a connect
+		std::vector<NetworkIngest *> closed_ingests;
+		{
+			std::lock_guard<std::mutex> lock(thiz->m_ingest_mutex);
+			for (auto iter = thiz->m_url_to_ingest.begin(); iter != thiz->m_url_to_ingest.end();) {
+				if (path_to_players.find(iter->first) == path_to_players.end()) {
+					closed_ingests.push_back(iter->second);
+					delete path_to_gop_cache[iter->first];
+					path_to_gop_cache.erase(iter->first);
+					iter = thiz->m_url_to_ingest.erase(iter);
+				}
+				else {
+					iter++;
+				}
+			}
+		}
+		for (NetworkIngest *ingest : closed_ingests) {
+			delete ingest;
+		}
+
+		// forget sessions that ended
+		std::set<std::pair<const void *, uint32_t>> targets;
+		for (auto iter = path_to_players.begin(); iter != path_to_players.end(); iter++) {
+			for (auto &player : iter->second) {
+				targets.insert(std::make_pair(nullptr == player.mpv ? (const void *)player.process : (const void *)player.mpv, player.id));
+			}
+		}
+		for (auto iter = seeded_targets.begin(); iter != seeded_targets.end();) {
+			if (targets.count(*iter) == 0) {
+				iter = seeded_targets.erase(iter);
+			}
+			else {
+				iter++;
+			}
+		}
+
+		for (auto iter = path_to_players.begin(); !thiz->m_stopping && iter != path_to_players.end(); iter++) {
+			if (finished_paths.count(iter->first) > 0) {
+				continue;
+			}
+
+			// a network source is connected once, however many players it has
+			NetworkIngest *ingest = nullptr;
+			QFile *file = nullptr;
+			if (!QFile(QString::fromStdString(iter->first)).exists() && NetworkIngest::is_supported(iter->first)) {
+				std::lock_guard<std::mutex> lock(thiz->m_ingest_mutex);
+				auto ingest_iter = thiz->m_url_to_ingest.find(iter->first);
+				if (ingest_iter == thiz->m_url_to_ingest.end()) {
+					ingest = new NetworkIngest(iter->first);
+					if (!ingest->start()) {
+						SPDLOG_ERROR("[mpv manager] ingest {} error\n", iter->first);
+						delete ingest;
+						finished_paths.insert(iter->first);
+						continue;
+					}
+					ingest_iter = thiz->m_url_to_ingest.insert(std::make_pair(iter->first, ingest)).first;
+					if (thiz->m_gop_cache_size > 0) {
+						path_to_gop_cache[iter->first] = new GopCache(thiz->m_gop_cache_size);
+					}
+				}
+				ingest = ingest_iter->second;
+			}
+			else {
+				auto file_iter = path_to_file.find(iter->first);
+				if (file_iter == path_to_file.end()) {
+					QFile *stream = new QFile(QString::fromStdString(iter->first));
+					if (!stream->open(QIODevice::ReadOnly)) {
+						SPDLOG_ERROR("[mpv manager] open {} error\n", iter->first);
+						delete stream;
+						finished_paths.insert(iter->first);
+						continue;
+					}
+					file_iter = path_to_file.insert(std::make_pair(iter->first, stream)).first;
+					if (thiz->m_gop_cache_size > 0) {
+						path_to_gop_cache[iter->first] = new GopCache(thiz->m_gop_cache_size);
+					}
+				}
+				file = file_iter->second;
+			}
+			auto gop_iter = path_to_gop_cache.find(iter->first);
+			GopCache *gop_cache = gop_iter != path_to_gop_cache.end() ? gop_iter->second : nullptr;
+
+			QByteArray buf;
+			if (ingest != nullptr) {
+				TraceSpan read_span("feeder", "read_ingest", -1);
+				buf = ingest->read(INGEST_READ_SIZE);
+				read_span.set_value(buf.size());
+			}
+			else {
+				TraceSpan read_span("feeder", "read_file", -1);
+				buf = file->read(READ_BUFFER_SIZE);
+				if (buf.isEmpty() && thiz->m_loop_file && file->seek(0)) {
+					buf = file->read(READ_BUFFER_SIZE);
+				}
+				read_span.set_value(buf.size());
+			}
+			// a live source had nothing new this round, a file is done
+			if (buf.isEmpty()) {
+				if (nullptr == ingest) {
+					finished_paths.insert(iter->first);
+				}
+				continue;
+			}
+
+			// a player that was stopped or recycled refuses the data, the others go on
+			for (auto &player : iter->second) {
+				if (thiz->m_stopping) {
+					break;
+				}
+
+				// a player joining the file starts with its last gop, then goes on with the live data right after it
+				auto target = std::make_pair(nullptr == player.mpv ? (const void *)player.process : (const void *)player.mpv, player.id);
+				if (seeded_targets.insert(target).second && gop_cache != nullptr && gop_cache->has_gop()) {
+					// a gop that does not fit the ring would stall the feeder on one player
+					if (nullptr == player.mpv || gop_cache->size() < player.mpv->get_buffer_size()) {
+						TRACE_INSTANT("feeder", "gop_seed", player.id, gop_cache->size());
+						if (player.mpv != nullptr) {
+							player.mpv->write(gop_cache->data(), gop_cache->size(), player.id);
+						}
+						else {
+							player.process->write(gop_cache->data(), gop_cache->size(), player.id);
+						}
+					}
+				}
+
+				if (player.mpv != nullptr) {
+					player.mpv->write((const uint8_t *)buf.constData(), (uint32_t)buf.size(), player.id);
+				}
+				else {
+					player.process->write((const uint8_t *)buf.constData(), (uint32_t)buf.size(), player.id);
+				}
+			}
+
+			if (gop_cache != nullptr) {
+				gop_cache->append((const uint8_t *)buf.constData(), (uint32_t)buf.size());
+			}
+		}
+
+		// every file that is played reached its end
+		finished = !path_to_players.empty() && finished_paths.size() >= path_to_players.size();
+
+		auto duration = STEADY_CLOCK_DURATION(time_point_begin);
+		if (tracing) {
+			Tracer::complete("feeder", "feed_round", round_begin_ns, -1, duration);
+		}
+		if (!finished && READ_INTERVAL_MS > duration) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(READ_INTERVAL_MS - duration));
+		}
+	}
+
+	for (auto iter = path_to_file.begin(); iter != path_to_file.end(); iter++) {
+		delete iter->second;
+	}
+	std::map<std::string, NetworkIngest *> url_to_ingest;
+	{
+		std::lock_guard<std::mutex> lock(thiz->m_ingest_mutex);
+		url_to_ingest.swap(thiz->m_url_to_ingest);
+	}
+	for (auto iter = url_to_ingest.begin(); iter != url_to_ingest.end(); iter++) {
+		delete iter->second;
+	}
+	for (auto iter = path_to_gop_cache.begin(); iter != path_to_gop_cache.end(); iter++) {
+		delete iter->second;
+	}
+
+	if (!thiz->m_stopping) {
+		thiz->stop_players();
+	}
+}
+
+
+void MpvManager::supervise_workers(void *ptr)
+{
+	if (nullptr == ptr) {
+		return;
+	}
+
+	MpvManager *thiz = (MpvManager *)ptr;
+	Tracer::set_thread_name("supervisor");
+
+	while (!thiz->m_stopping) {
+		for (int ms = 0; !thiz->m_stopping && ms < SUPERVISE_INTERVAL_MS; ms += GOVERNOR_SLEEP_MS) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(GOVERNOR_SLEEP_MS));
+		}
+		if (thiz->m_stopping) {
+			break;
+		}
+
+		// detach waits for us, so a worker is not stopped while being relaunched
+		std::lock_guard<std::mutex> lock(thiz->m_players_mutex);
+		for (auto iter = thiz->m_index_to_tile_process.begin(); !thiz->m_stopping && iter != thiz->m_index_to_tile_process.end(); iter++) {
+			if (!iter->second->supervise()) {
+				SPDLOG_WARN("[mpv manager] worker of tile {} relaunched\n", iter->first);
+			}
+		}
+	}
+}
+
+
+
+void MpvManager::set_decoder_thread_budget(int cores)
+{
+	std::lock_guard<std::mutex> lock(m_players_mutex);
+	m_decoder_thread_budget = cores;
+	rebalance_decoder_threads();
+}
+
+
+std::map<int, int> MpvManager::budget_decoder_threads()
+{
+	std::map<int, int> index_to_threads;
+	if (m_decoder_thread_budget < 0 || m_index_to_area.empty()) {
+		// keep mpv default
+		return index_to_threads;
+	}
+
+	int budget = m_decoder_thread_budget > 0 ? m_decoder_thread_budget : (int)cpu_core_count();
+
+	// weight by tile area, the spanning first tile of 6/8 ways gets more, unknown sizes weight equally
+	// gpu decoders do not run lavc threads on the cores
+	std::map<int, int64_t> index_to_weight;
+	int64_t total_weight = 0;
+	for (auto iter = m_index_to_area.begin(); iter != m_index_to_area.end(); iter++) {
+		if (m_hwdec_indexes.count(iter->first) > 0) {
+			continue;
+		}
+		int64_t weight = iter->second > 0 ? iter->second : 1;
+		index_to_weight.insert(std::make_pair(iter->first, weight));
+		total_weight += weight;
+	}
+
+	// every tile needs one thread, hand out the rest by largest remainder
+	int spare = budget - (int)index_to_weight.size();
+	std::vector<std::pair<double, int>> remainders;
+	int assigned = 0;
+	for (auto iter = index_to_weight.begin(); iter != index_to_weight.end(); iter++) {
+		double share = spare > 0 ? (double)spare * iter->second / total_weight : 0.0;
+		int extra = (int)share;
+		index_to_threads.insert(std::make_pair(iter->first, 1 + extra));
+		remainders.push_back(std::make_pair(share - extra, iter->first));
+		assigned += extra;
+	}
+	std::sort(remainders.begin(), remainders.end(), [](const std::pair<double, int> &a, const std::pair<double, int> &b) { return a.first > b.first; });
+	for (size_t i = 0; spare > 0 && assigned < spare && i < remainders.size(); i++, assigned++) {
+		index_to_threads[remainders[i].second]++;
+	}
+
+	for (auto iter = index_to_threads.begin(); iter != index_to_threads.end(); iter++) {
+		iter->second = std::min(iter->second, MAX_DECODER_THREADS);
+		SPDLOG_INFO("[mpv manager] tile {} gets {} decoder threads of {} cores\n", iter->first, iter->second, budget);
+	}
+
+	return index_to_threads;
+}
+
+
+void MpvManager::rebalance_decoder_threads()
+{
+	std::map<int, int> index_to_threads = budget_decoder_threads();
+	for (auto iter = index_to_threads.begin(); iter != index_to_threads.end(); iter++) {
+		auto mpv_iter = m_index_to_mpv_wrapper.find(iter->first);
+		// a running decoder keeps its count until it opens again, players starting meanwhile get theirs at once
+		if (mpv_iter != m_index_to_mpv_wrapper.end()) {
+			mpv_iter->second->set_decoder_threads(iter->second);
+		}
+	}
+}
+
+
+void MpvManager::set_memory_budget(uint64_t bytes)
+{
+	std::lock_guard<std::mutex> lock(m_players_mutex);
+	m_memory_budget = bytes;
+	rebalance_memory();
+}
+
+
+void MpvManager::get_memory_usage(MemoryUsage &usage)
+{
+	std::map<int, PlayerStatistics> stats;
+	get_players_statistics(stats);
+
+	usage.budget = m_memory_budget;
+	usage.buffer_bytes = 0;
+	usage.demuxer_limit_bytes = 0;
+	usage.demuxer_cache_bytes = 0;
+	for (auto iter = stats.begin(); iter != stats.end(); iter++) {
+		usage.demuxer_cache_bytes += std::max((int64_t)0, iter->second.demuxer_cache_bytes);
+	}
+
+	std::lock_guard<std::mutex> lock(m_players_mutex);
+	for (auto iter = m_index_to_mpv_wrapper.begin(); iter != m_index_to_mpv_wrapper.end(); iter++) {
+		PlayerMemoryLimits limits;
+		iter->second->get_memory_limits(limits);
+		usage.buffer_bytes += iter->second->get_buffer_size();
+		usage.demuxer_limit_bytes += limits.demuxer_max_bytes + limits.demuxer_max_back_bytes;
+	}
+	for (auto mpv : m_idle_mpv_wrappers) {
+		usage.buffer_bytes += mpv->get_buffer_size();
+	}
+}
+
+
+std::map<int, PlayerMemoryLimits> MpvManager::budget_memory()
+{
+	std::map<int, PlayerMemoryLimits> index_to_limits;
+	if (0 == m_memory_budget || m_index_to_area.empty()) {
+		// keep default ring and mpv default caches
+		return index_to_limits;
+	}
+
+	// weight by bitrate and by area relative to the largest tile, prefetched tiles off screen have no area
+	int64_t max_area = 0;
+	for (auto iter = m_index_to_area.begin(); iter != m_index_to_area.end(); iter++) {
+		max_area = std::max(max_area, iter->second);
+	}
+	std::map<int, double> index_to_weight;
+	double total_weight = 0.0;
+	for (auto iter = m_index_to_area.begin(); iter != m_index_to_area.end(); iter++) {
+		double priority = 1.0;
+		if (max_area > 0) {
+			priority = iter->second > 0 ? (double)iter->second / max_area : MEMORY_HIDDEN_PRIORITY;
+		}
+		auto bitrate_iter = m_index_to_bitrate.find(iter->first);
+		uint32_t bitrate = bitrate_iter != m_index_to_bitrate.end() && bitrate_iter->second > 0 ? bitrate_iter->second : MEMORY_DEFAULT_BITRATE;
+		double weight = priority * bitrate;
+		index_to_weight.insert(std::make_pair(iter->first, weight));
+		total_weight += weight;
+	}
+
+	// a quarter of each share for the ring, the rest for the demuxer cache, 3:1 forward to back
+	uint64_t assigned = 0;
+	uint32_t max_buffer_size = std::max(rounddown_pow_of_two(m_buffer_size), (uint32_t)MEMORY_MIN_BUFFER_SIZE);
+	for (auto iter = index_to_weight.begin(); iter != index_to_weight.end(); iter++) {
+		uint64_t share = (uint64_t)(m_memory_budget * iter->second / total_weight);
+
+		PlayerMemoryLimits limits;
+		limits.buffer_size = (uint32_t)std::min((uint64_t)max_buffer_size, share / 4);
+		limits.buffer_size = std::max(rounddown_pow_of_two(limits.buffer_size), (uint32_t)MEMORY_MIN_BUFFER_SIZE);
+		uint64_t rest = share > limits.buffer_size ? share - limits.buffer_size : 0;
+		limits.demuxer_max_bytes = std::min(std::max((int64_t)(rest * 3 / 4), (int64_t)MEMORY_MIN_DEMUXER_BYTES), (int64_t)MPV_DEMUXER_MAX_BYTES);
+		limits.demuxer_max_back_bytes = std::min(std::max((int64_t)(rest / 4), (int64_t)MEMORY_MIN_DEMUXER_BACK_BYTES), (int64_t)MPV_DEMUXER_MAX_BACK_BYTES);
+		assigned += limits.buffer_size + limits.demuxer_max_bytes + limits.demuxer_max_back_bytes;
+
+		index_to_limits.insert(std::make_pair(iter->first, limits));
+	}
+
+	if (assigned > m_memory_budget) {
+		SPDLOG_WARN("[mpv manager] {} tiles need at least {} bytes, over memory budget of {} bytes\n", index_to_limits.size(), assigned, m_memory_budget);
+	}
+
+	return index_to_limits;
+}
+
+
+void MpvManager::rebalance_memory()
+{
+	std::map<int, PlayerMemoryLimits> index_to_limits = budget_memory();
+	uint64_t assigned = 0;
+	for (auto iter = m_index_to_mpv_wrapper.begin(); iter != m_index_to_mpv_wrapper.end(); iter++) {
+		auto limits_iter = index_to_limits.find(iter->first);
+		PlayerMemoryLimits limits = limits_iter != index_to_limits.end() ? limits_iter->second : PlayerMemoryLimits{ m_buffer_size, 0, 0 };
+		// rings of running players change size on their next start
+		iter->second->set_memory_limits(limits);
+		assigned += limits.buffer_size + limits.demuxer_max_bytes + limits.demuxer_max_back_bytes;
+	}
+
+	if (m_memory_budget > 0) {
+		SPDLOG_INFO("[mpv manager] memory budget {} bytes, {} bytes assigned to {} players\n", m_memory_budget, assigned, m_index_to_mpv_wrapper.size());
+	}
+}
+
+
+void MpvManager::set_quality_governor(bool state)
+{
+	m_quality_governor = state;
+
+	std::lock_guard<std::mutex> lock(m_players_mutex);
+	for (auto iter = m_index_to_mpv_wrapper.begin(); iter != m_index_to_mpv_wrapper.end(); iter++) {
+		if (iter->second != nullptr) {
+			iter->second->set_quality_governor(state);
+		}
+	}
+}
+
+
+void MpvManager::set_audio_focus(int index)
+{
+	std::lock_guard<std::mutex> lock(m_players_mutex);
+	m_audio_focus = index;
+	SPDLOG_INFO("[mpv manager] audio focus {}\n", index);
+
+	// only the players whose focus changed touch their audio chain
+	for (auto iter = m_index_to_mpv_wrapper.begin(); iter != m_index_to_mpv_wrapper.end(); iter++) {
+		apply_views(iter->first);
+	}
+	for (auto iter = m_index_to_tile_process.begin(); iter != m_index_to_tile_process.end(); iter++) {
+		iter->second->set_audio_enabled(has_audio_focus(iter->first));
+	}
+}
+
+
+int MpvManager::get_audio_focus()
+{
+	return m_audio_focus;
+}
+
+
+bool MpvManager::has_audio_focus(int index)
+{
+	return AUDIO_FOCUS_ALL == m_audio_focus || index == m_audio_focus;
+}
+
+
+int MpvManager::get_owner_index(int index)
+{
+	auto iter = m_index_to_shared_index.find(index);
+	return iter != m_index_to_shared_index.end() ? iter->second : index;
+}
+
+
+std::vector<int> MpvManager::get_view_indexes(int owner)
+{
+	std::vector<int> indexes{ owner };
+	for (auto iter = m_index_to_shared_index.begin(); iter != m_index_to_shared_index.end(); iter++) {
+		if (iter->second == owner) {
+			indexes.push_back(iter->first);
+		}
+	}
+	return indexes;
+}
+
+
+void MpvManager::apply_views(int owner)
+{
+	auto iter = m_index_to_mpv_wrapper.find(owner);
+	if (iter == m_index_to_mpv_wrapper.end() || nullptr == iter->second) {
+		return;
+	}
+
+	// decode for the most demanding view: seen by any, at the size of the largest, heard by any
+	bool visible = false;
+	bool audio = false;
+	int width = 0;
+	int height = 0;
+	for (int index : get_view_indexes(owner)) {
+		auto view_iter = m_index_to_view.find(index);
+		if (view_iter == m_index_to_view.end()) {
+			continue;
+		}
+		const TileView &view = view_iter->second;
+		visible = visible || view.visible;
+		audio = audio || has_audio_focus(index);
+		if ((int64_t)view.width * view.height > (int64_t)width * height) {
+			width = view.width;
+			height = view.height;
+		}
+	}
+
+	if (iter->second->is_visible() != visible) {
+		iter->second->set_visible(visible);
+	}
+	if (width > 0 && height > 0) {
+		m_index_to_area[owner] = (int64_t)width * height;
+		iter->second->set_tile_size(width, height);
+	}
+	iter->second->set_audio_enabled(audio);
+}
+
+
+void MpvManager::set_tile_size(int index, int width, int height)
+{
+	std::lock_guard<std::mutex> lock(m_players_mutex);
+	auto view_iter = m_index_to_view.find(index);
+	if (view_iter != m_index_to_view.end()) {
+		view_iter->second.width = width;
+		view_iter->second.height = height;
+		apply_views(get_owner_index(index));
+	}
+
+	auto process_iter = m_index_to_tile_process.find(index);
+	if (process_iter != m_index_to_tile_process.end()) {
+		m_index_to_area[index] = (int64_t)width * height;
+		process_iter->second->set_tile_size(width, height);
+	}
+}
+
+
+void MpvManager::set_tile_visible(int index, bool state)
+{
+	std::lock_guard<std::mutex> lock(m_players_mutex);
+	auto view_iter = m_index_to_view.find(index);
+	if (view_iter != m_index_to_view.end()) {
+		view_iter->second.visible = state;
+		apply_views(get_owner_index(index));
+	}
+
+	auto process_iter = m_index_to_tile_process.find(index);
+	if (process_iter != m_index_to_tile_process.end() && process_iter->second->is_visible() != state) {
+		process_iter->second->set_visible(state);
+	}
+}
+
+
+void MpvManager::set_load_shedding(bool state, double cpu_threshold)
+{
+	m_load_shedding = state;
+	m_shed_cpu_threshold = cpu_threshold;
+}
+
+
+void MpvManager::set_players_shed_level(ShedLevel level)
+{
+	std::lock_guard<std::mutex> lock(m_players_mutex);
+	for (auto iter = m_index_to_mpv_wrapper.begin(); iter != m_index_to_mpv_wrapper.end(); iter++) {
+		iter->second->set_shed_level(level);
+	}
+}
+
+
+void MpvManager::set_stats_key(std::string key)
+{
+	if (key == m_stats_key) {
+		return;
+	}
+	m_stats_key = key;
+
+	// takes effect when the next player is attached
+	if (m_stats_thread != nullptr) {
+		SPDLOG_WARN("[mpv manager] stats key changes after players are stopped\n");
+		return;
+	}
+
+	delete m_stats_segment;
+	m_stats_segment = nullptr;
+	if (key.empty()) {
+		return;
+	}
+
+	m_stats_segment = new StatsSegment();
+	if (!m_stats_segment->create(key)) {
+		delete m_stats_segment;
+		m_stats_segment = nullptr;
+	}
+}
+
+
+void MpvManager::set_loop_file(bool state)
+{
+	m_loop_file = state;
+}
+
+
+void MpvManager::set_source_sharing(bool state)
+{
+	m_source_sharing = state;
+}
+
+
+void MpvManager::set_network_ingest(bool state)
+{
+	m_network_ingest = state;
+}
+
+
+void MpvManager::get_ingest_statistics(IngestStatistics &stats)
+{
+	stats = IngestStatistics();
+	std::lock_guard<std::mutex> lock(m_ingest_mutex);
+	for (auto iter = m_url_to_ingest.begin(); iter != m_url_to_ingest.end(); iter++) {
+		iter->second->get_statistics(stats);
+	}
+}
+
+
+bool MpvManager::is_fed_source(const std::string &video_url)
+{
+	return QFile(QString::fromStdString(video_url)).exists() || (m_network_ingest && NetworkIngest::is_supported(video_url));
+}
+
+
+void MpvManager::set_gop_cache_size(uint32_t bytes)
+{
+	m_gop_cache_size = bytes;
+}
+
+
+void MpvManager::set_process_mode(bool state, std::string program)
+{
+	if (state && RenderMode::Software == m_render_mode) {
+		SPDLOG_WARN("[mpv manager] software rendering needs the frames in this process, players stay in process\n");
+		state = false;
+	}
+
+	m_process_mode = state;
+	m_worker_program = program;
+}
+
+
+void MpvManager::get_players_statistics(std::map<int, PlayerStatistics> &stats)
+{
+	std::lock_guard<std::mutex> lock(m_players_mutex);
+	for (auto iter = m_index_to_mpv_wrapper.begin(); iter != m_index_to_mpv_wrapper.end(); iter++) {
+		if (iter->second != nullptr) {
+			iter->second->get_statistics(stats[iter->first]);
+		}
+	}
+	for (auto iter = m_index_to_tile_process.begin(); iter != m_index_to_tile_process.end(); iter++) {
+		iter->second->get_statistics(stats[iter->first]);
+	}
+}
+
+
+void MpvManager::get_players_quality(std::map<int, PlaybackQuality> &quality)
+{
+	std::lock_guard<std::mutex> lock(m_players_mutex);
+	for (auto iter = m_index_to_mpv_wrapper.begin(); iter != m_index_to_mpv_wrapper.end(); iter++) {
+		if (iter->second != nullptr) {
+			iter->second->get_quality(quality[iter->first]);
+		}
+	}
+}
+
+
+bool MpvManager::play_players()
+{
+	std::vector<std::future<bool>> replies;
+	std::unique_lock<std::mutex> lock(m_players_mutex);
+	for (auto iter = m_index_to_mpv_wrapper.begin(); iter != m_index_to_mpv_wrapper.end(); iter++) {
+		if (iter->second != nullptr) {
+			replies.push_back(iter->second->play_async());
+		}
+	}
+	lock.unlock();
+	return wait_replies(replies);
+}
+
+
+bool MpvManager::pause_players()
+{
+	std::vector<std::future<bool>> replies;
+	std::unique_lock<std::mutex> lock(m_players_mutex);
+	for (auto iter = m_index_to_mpv_wrapper.begin(); iter != m_index_to_mpv_wrapper.end(); iter++) {
+		if (iter->second != nullptr) {
+			replies.push_back(iter->second->pause_async());
+		}
+	}
+	lock.unlock();
+	return wait_replies(replies);
+}
+
+
+bool MpvManager::set_players_speed(double speed)
+{
+	std::vector<std::future<bool>> replies;
+	std::unique_lock<std::mutex> lock(m_players_mutex);
+	for (auto iter = m_index_to_mpv_wrapper.begin(); iter != m_index_to_mpv_wrapper.end(); iter++) {
+		if (iter->second != nullptr) {
+			replies.push_back(iter->second->set_speed_async(speed));
+		}
+	}
+	lock.unlock();
+	return wait_replies(replies);
+}
+
+
+void MpvManager::take_screenshots(std::vector<int> indexes, const ScreenshotOptions &options, ScreenshotReadyCallback callback)
+{
+	WorkerPool *pool = m_worker_pool;
+	auto run_on_pool = [pool](std::function<void()> task) {
+		if (!pool->submit(task)) {
+			task();
+		}
+	};
+
+	std::lock_guard<std::mutex> lock(m_players_mutex);
+	if (indexes.empty()) {
+		for (auto iter = m_index_to_mpv_wrapper.begin(); iter != m_index_to_mpv_wrapper.end(); iter++) {
+			indexes.push_back(iter->first);
+		}
+	}
+
+	// send every request first, players answer in parallel on their event threads
+	for (int index : indexes) {
+		auto shot = std::make_shared<Screenshot>();
+		auto iter = m_index_to_mpv_wrapper.find(index);
+		if (iter == m_index_to_mpv_wrapper.end() || nullptr == iter->second) {
+			run_on_pool([callback, index, shot]() { callback(index, false, *shot); });
+			continue;
+		}
+
+		// on failure to send the callback already ran
+		iter->second->screenshot_raw_async([run_on_pool, callback, options, index, shot](bool ok, const FrameView &view) {
+			if (!ok) {
+				run_on_pool([callback, index, shot]() { callback(index, false, *shot); });
+				return;
+			}
+
+			// the pixels belong to mpv, one copy frees the event thread
+			copy_frame(view, shot->frame);
+
+			run_on_pool([callback, options, index, shot]() {
+				if (options.max_width > 0 || options.max_height > 0) {
+					VideoFrame scaled;
+					downscale_frame(frame_view(shot->frame), options.max_width, options.max_height, scaled);
+					shot->frame = std::move(scaled);
+				}
+
+				bool encoded = true;
+				if (!options.encode_format.empty()) {
+					encoded = encode_frame(shot->frame, options.encode_format, options.quality, shot->encoded);
+				}
+
+				callback(index, encoded, *shot);
+			});
+		});
+	}
+}
+
+
+bool MpvManager::take_screenshot(int index, const ScreenshotOptions &options, Screenshot &shot, int timeout_ms)
+{
+	// shared, so a reply after timeout does not write to the caller
+	auto promise = std::make_shared<std::promise<bool>>();
+	auto result = std::make_shared<Screenshot>();
+	std::future<bool> future = promise->get_future();
+
+	take_screenshots({ index }, options, [promise, result](int, bool ok, Screenshot &s) {
+		if (ok) {
+			*result = std::move(s);
+		}
+		promise->set_value(ok);
+	});
+
+	if (std::future_status::ready != future.wait_for(std::chrono::milliseconds(timeout_ms))) {
+		SPDLOG_WARN("[mpv manager] screenshot of tile {} timeout\n", index);
+		return false;
+	}
+	if (!future.get()) {
+		return false;
+	}
+
+	shot = std::move(*result);
+	return true;
+}
+
+
+bool MpvManager::snapshot_mosaic(const MosaicOptions &options, Mosaic &mosaic)
+{
+	auto deadline = STEADY_CLOCK_NOW() + std::chrono::milliseconds(options.budget_ms);
+
+	std::unique_lock<std::mutex> players_lock(m_players_mutex);
+
+	std::vector<int> indexes;
+	for (auto iter = m_index_to_mpv_wrapper.begin(); iter != m_index_to_mpv_wrapper.end(); iter++) {
+		indexes.push_back(iter->first);
+	}
+	int count = (int)indexes.size();
+	int columns = options.columns > 0 ? options.columns : std::max(1, (int)ceil(sqrt((double)count)));
+	int rows = (count + columns - 1) / columns;
+
+	// same layout keeps the thumbnails of cells that miss the deadline
+	bool layout_changed = indexes != mosaic.indexes || columns != mosaic.columns || rows != mosaic.rows
+		|| options.cell_width * columns != mosaic.frame.width || options.cell_height * rows != mosaic.frame.height;
+	mosaic.indexes = indexes;
+	mosaic.columns = columns;
+	mosaic.rows = rows;
+	mosaic.frame.width = options.cell_width * columns;
+	mosaic.frame.height = options.cell_height * rows;
+	mosaic.frame.stride = mosaic.frame.width * 4;
+	mosaic.frame.pixels.resize((size_t)mosaic.frame.stride * mosaic.frame.height);
+	if (layout_changed) {
+		std::fill(mosaic.frame.pixels.begin(), mosaic.frame.pixels.end(), (uint8_t)0);
+	}
+	mosaic.fresh.assign(count, 0);
+	mosaic.fresh_count = 0;
+	if (0 == count) {
+		return false;
+	}
+
+	auto round = std::make_shared<MosaicRound>(count);
+	round->pixels = mosaic.frame.pixels.data();
+	round->stride = mosaic.frame.stride;
+
+	// send every request first, each event thread scales its own frame into its own cell
+	int cell_width = options.cell_width;
+	int cell_height = options.cell_height;
+	for (int i = 0; i < count; i++) {
+		auto &pending = m_index_to_mosaic_pending[indexes[i]];
+		if (nullptr == pending) {
+			pending = std::make_shared<std::atomic<bool>>(false);
+		}
+		if (pending->exchange(true)) {
+			round->states[i] = MOSAIC_CELL_ABANDONED;
+			continue;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(round->mutex);
+			round->pending++;
+		}
+
+		size_t offset = (size_t)(i / columns) * cell_height * round->stride + (size_t)(i % columns) * cell_width * 4;
+		std::shared_ptr<std::atomic<bool>> pending_flag = pending;
+		m_index_to_mpv_wrapper[indexes[i]]->screenshot_raw_async([round, i, pending_flag, offset, cell_width, cell_height](bool ok, const FrameView &view) {
+			pending_flag->store(false);
+
+			int expected = MOSAIC_CELL_PENDING;
+			if (round->states[i].compare_exchange_strong(expected, MOSAIC_CELL_WRITING)) {
+				if (ok) {
+					downscale_into(view, cell_width, cell_height, round->pixels + offset, round->stride);
+				}
+				round->states[i] = ok ? MOSAIC_CELL_DONE : MOSAIC_CELL_FAILED;
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(round->mutex);
+				round->pending--;
+			}
+			round->cond.notify_all();
+		});
+	}
+	players_lock.unlock();
+
+	{
+		std::unique_lock<std::mutex> lock(round->mutex);
+		round->cond.wait_until(lock, deadline, [&round]() { return 0 == round->pending; });
+	}
+
+	// take back cells still pending, wait for the few being written right now
+	for (int i = 0; i < count; i++) {
+		int expected = MOSAIC_CELL_PENDING;
+		round->states[i].compare_exchange_strong(expected, MOSAIC_CELL_ABANDONED);
+		while (MOSAIC_CELL_WRITING == round->states[i]) {
+			std::this_thread::yield();
+		}
+		if (MOSAIC_CELL_DONE == round->states[i]) {
+			mosaic.fresh[i] = 1;
+			mosaic.fresh_count++;
+		}
+	}
+
+	if (mosaic.fresh_count < count) {
+		SPDLOG_WARN("[mpv manager] mosaic has {} of {} cells fresh within {} ms\n", mosaic.fresh_count, count, options.budget_ms);
+	}
+
+	return mosaic.fresh_count == count;
+}
+
+
+bool MpvManager::wait_replies(std::vector<std::future<bool>> &replies)
+{
+	bool result = true;
+	for (auto &reply : replies) {
+		if (!reply.get()) {
+			result = false;
+		}
+	}
+	return result;
+}
+
+
+void MpvManager::govern_load(void *ptr)
+{
+	if (nullptr == ptr) {
+		return;
+	}
+
+	MpvManager *thiz = (MpvManager *)ptr;
+	Tracer::set_thread_name("governor");
+
+	uint32_t cores = cpu_core_count();
+	auto last_time = std::chrono::steady_clock::now();
+	double last_cpu_seconds = process_cpu_seconds();
+	std::map<uint64_t, ThreadCpuUsage> last_threads;
+	thread_cpu_seconds(last_threads);
+	std::map<int, int64_t> last_drops;
+	int calm_samples = 0;
+	int memory_intervals = 0;
+
+	while (!thiz->m_stopping) {
+		for (int ms = 0; !thiz->m_stopping && ms < GOVERNOR_INTERVAL_MS; ms += GOVERNOR_SLEEP_MS) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(GOVERNOR_SLEEP_MS));
+		}
+		if (thiz->m_stopping) {
+			break;
+		}
+
+		// process cpu as a fraction of all cores
+		auto now = std::chrono::steady_clock::now();
+		double elapsed_seconds = std::chrono::duration<double>(now - last_time).count();
+		double cpu_seconds = process_cpu_seconds();
+		double load = (cpu_seconds - last_cpu_seconds) / elapsed_seconds / cores;
+		last_time = now;
+		last_cpu_seconds = cpu_seconds;
+
+		// tiles that dropped frames since last sample, counters restart with the player
+		std::map<int, PlayerStatistics> stats;
+		thiz->get_players_statistics(stats);
+
+		// move memory towards the tiles whose bitrate went up
+		if (++memory_intervals >= MEMORY_REBALANCE_INTERVALS) {
+			memory_intervals = 0;
+			std::lock_guard<std::mutex> lock(thiz->m_players_mutex);
+			for (auto iter = stats.begin(); iter != stats.end(); iter++) {
+				thiz->m_index_to_bitrate[iter->first] = iter->second.input_bitrate;
+			}
+			if (thiz->m_memory_budget > 0) {
+				thiz->rebalance_memory();
+			}
+		}
+		int dropping_tiles = 0;
+		for (auto iter = stats.begin(); iter != stats.end(); iter++) {
+			int64_t drops = iter->second.frame_drops + iter->second.decoder_frame_drops;
+			auto last_iter = last_drops.find(iter->first);
+			if (last_iter != last_drops.end() && drops > last_iter->second) {
+				dropping_tiles++;
+			}
+			last_drops[iter->first] = drops;
+		}
+
+		// hottest threads, to tell a saturated host from one busy thread
+		std::map<uint64_t, ThreadCpuUsage> threads;
+		thread_cpu_seconds(threads);
+		std::vector<std::pair<double, std::string>> hot_threads;
+		for (auto iter = threads.begin(); iter != threads.end(); iter++) {
+			auto last_iter = last_threads.find(iter->first);
+			double seconds = iter->second.seconds - (last_iter != last_threads.end() ? last_iter->second.seconds : 0.0);
+			hot_threads.push_back(std::make_pair(seconds / elapsed_seconds, fmt::format("{}({})", iter->second.name, iter->first)));
+		}
+		last_threads.swap(threads);
+		size_t hot_count = std::min(hot_threads.size(), (size_t)SHED_HOT_THREADS);
+		std::partial_sort(hot_threads.begin(), hot_threads.begin() + hot_count, hot_threads.end(), [](const std::pair<double, std::string> &a, const std::pair<double, std::string> &b) { return a.first > b.first; });
+		std::string hot_text;
+		for (size_t i = 0; i < hot_count; i++) {
+			hot_text += fmt::format("{} {:.0f}% ", hot_threads[i].second, hot_threads[i].first * 100.0);
+		}
+
+		int drop_limit = std::max(1, (int)stats.size() / 4);
+		bool saturated = load >= thiz->m_shed_cpu_threshold || (load >= thiz->m_shed_cpu_threshold * 0.8 && dropping_tiles >= drop_limit);
+		bool headroom = load < thiz->m_shed_cpu_threshold - SHED_HEADROOM && 0 == dropping_tiles;
+
+		if (saturated) {
+			calm_samples = 0;
+			// catching up by playing faster needs cpu we do not have
+			std::unique_lock<std::mutex> lock(thiz->m_players_mutex);
+			for (auto iter = thiz->m_index_to_mpv_wrapper.begin(); iter != thiz->m_index_to_mpv_wrapper.end(); iter++) {
+				iter->second->set_speedup_allowed(false);
+			}
+			lock.unlock();
+			if (thiz->shed_one_step()) {
+				SPDLOG_WARN("[mpv manager] overloaded, cpu {:.0f}% of {} cores, {} tiles dropping, hottest threads: {}\n", load * 100.0, cores, dropping_tiles, hot_text);
+			}
+		}
+		else if (headroom) {
+			// restore slowly, one step per few calm samples
+			if (++calm_samples >= SHED_RESTORE_SAMPLES) {
+				calm_samples = 0;
+				if (thiz->restore_one_step()) {
+					SPDLOG_INFO("[mpv manager] headroom, cpu {:.0f}% of {} cores\n", load * 100.0, cores);
+				}
+				else {
+					std::lock_guard<std::mutex> lock(thiz->m_players_mutex);
+					for (auto iter = thiz->m_index_to_mpv_wrapper.begin(); iter != thiz->m_index_to_mpv_wrapper.end(); iter++) {
+						iter->second->set_speedup_allowed(true);
+					}
+				}
+			}
+		}
+		else {
+			calm_samples = 0;
+		}
+	}
+}
+
+
+bool MpvManager::shed_one_step()
+{
+	std::lock_guard<std::mutex> lock(m_players_mutex);
+	if (m_index_to_mpv_wrapper.empty()) {
+		return false;
+	}
+
+	// lower index is more important, the first tile is the big one of 6/8 ways and is never paused
+	// depth first: the least important tile goes all the way down before the next one is touched
+	int first_index = m_index_to_mpv_wrapper.begin()->first;
+	MpvWrapper *target = nullptr;
+	int target_index = -1;
+	ShedLevel current = ShedLevel::Off;
+	for (auto iter = m_index_to_mpv_wrapper.rbegin(); iter != m_index_to_mpv_wrapper.rend(); iter++) {
+		ShedLevel level = iter->second->get_shed_level();
+		ShedLevel max_level = iter->first == first_index ? ShedLevel::KeyframesOnly : ShedLevel::Paused;
+		if (level < max_level) {
+			target = iter->second;
+			target_index = iter->first;
+			current = level;
+			break;
+		}
+	}
+	if (nullptr == target) {
+		return false;
+	}
+
+	ShedLevel level = (ShedLevel)((uint8_t)current + 1);
+	SPDLOG_WARN("[mpv manager] shed tile {} to level {}\n", target_index, (int)level);
+	TRACE_INSTANT("governor", "shed", target_index, (int64_t)level);
+	target->set_shed_level(level);
+
+	return true;
+}
+
+
+bool MpvManager::restore_one_step()
+{
+	std::lock_guard<std::mutex> lock(m_players_mutex);
+	// reverse of shedding: the most important shed tile comes all the way back before the next one
+	MpvWrapper *target = nullptr;
+	int target_index = -1;
+	ShedLevel current = ShedLevel::Off;
+	for (auto iter = m_index_to_mpv_wrapper.begin(); iter != m_index_to_mpv_wrapper.end(); iter++) {
+		ShedLevel level = iter->second->get_shed_level();
+		if (level > ShedLevel::Off) {
+			target = iter->second;
+			target_index = iter->first;
+			current = level;
+			break;
+		}
+	}
+	if (nullptr == target) {
+		return false;
+	}
+
+	ShedLevel level = (ShedLevel)((uint8_t)current - 1);
+	SPDLOG_INFO("[mpv manager] restore tile {} to level {}\n", target_index, (int)level);
+	TRACE_INSTANT("governor", "restore", target_index, (int64_t)level);
+	target->set_shed_level(level);
+
+	return true;
+}
+
+
+static void fill_stats_tile(StatsTile &tile, int index, uint32_t player_id, ShedLevel shed_level, const PlayerStatistics &stats)
+{
+	tile.index = index;
+	tile.player_id = player_id;
+	tile.shed_level = (uint32_t)shed_level;
+	tile.buffer_size = stats.buffer_size;
+	tile.buffer_fill = stats.buffer_fill;
+	tile.input_bytes = stats.input_bytes;
+	tile.output_bytes = stats.output_bytes;
+	tile.bitrate = stats.input_bitrate;
+	tile.fps = stats.fps;
+	tile.speed = stats.speed;
+	tile.frame_drops = stats.frame_drops;
+	tile.decoder_frame_drops = stats.decoder_frame_drops;
+	tile.restarts = stats.restarts;
+	tile.write_stalls = stats.write_stalls;
+	tile.read_stalls = stats.read_stalls;
+}
+
+
+void MpvManager::publish_stats(void *ptr)
+{
+	if (nullptr == ptr) {
+		return;
+	}
+
+	MpvManager *thiz = (MpvManager *)ptr;
+	Tracer::set_thread_name("stats");
+
+	// large, keep it off the stack
+	std::unique_ptr<StatsSnapshot> snapshot(new StatsSnapshot());
+	auto last_time = std::chrono::steady_clock::now();
+	double last_cpu_seconds = process_cpu_seconds();
+	while (!thiz->m_stopping) {
+		for (int ms = 0; !thiz->m_stopping && ms < STATS_PUBLISH_INTERVAL_MS; ms += GOVERNOR_SLEEP_MS) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(GOVERNOR_SLEEP_MS));
+		}
+		if (thiz->m_stopping) {
+			break;
+		}
+
+		auto now = std::chrono::steady_clock::now();
+		double cpu_seconds = process_cpu_seconds();
+		double elapsed_seconds = std::chrono::duration<double>(now - last_time).count();
+		snapshot->cpu_percent = elapsed_seconds > 0.0 ? (cpu_seconds - last_cpu_seconds) * 100.0 / elapsed_seconds : 0.0;
+		last_time = now;
+		last_cpu_seconds = cpu_seconds;
+
+		snapshot->pid = QCoreApplication::applicationPid();
+		snapshot->update_time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+		snapshot->cpu_cores = cpu_core_count();
+		snapshot->rss_bytes = process_rss_bytes();
+
+		// one short pass over counters the players keep in memory, get_statistics never waits for a core
+		uint32_t count = 0;
+		std::unique_lock<std::mutex> lock(thiz->m_players_mutex);
+		for (auto iter = thiz->m_index_to_mpv_wrapper.begin(); iter != thiz->m_index_to_mpv_wrapper.end() && count < STATS_MAX_TILES; iter++) {
+			if (iter->second == nullptr) {
+				continue;
+			}
+			PlayerStatistics stats;
+			iter->second->get_statistics(stats);
+			fill_stats_tile(snapshot->tiles[count++], iter->first, iter->second->get_id(), iter->second->get_shed_level(), stats);
+		}
+		for (auto iter = thiz->m_index_to_tile_process.begin(); iter != thiz->m_index_to_tile_process.end() && count < STATS_MAX_TILES; iter++) {
+			PlayerStatistics stats;
+			iter->second->get_statistics(stats);
+			fill_stats_tile(snapshot->tiles[count++], iter->first, iter->second->get_id(), iter->second->get_shed_level(), stats);
+		}
+		lock.unlock();
+		snapshot->tile_count = count;
+
+		thiz->m_stats_segment->publish(*snapshot);
+	}
+}
@@ -4,21 +4,103 @@
 #include <stdint.h>
 
 // c++
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <string>
+#include <functional>
+#include <future>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <thread>
+#include <vector>
 
 // qt
 class QWidget;
 
 // project
 class MpvWrapper;
+struct PlayerStatistics;
+struct PlaybackQuality;
+struct PlayerMemoryLimits;
+enum class RenderMode : uint8_t;
+enum class ShedLevel : uint8_t;
+struct ScreenshotOptions;
+struct Screenshot;
+struct MosaicOptions;
+struct Mosaic;
+class WorkerPool;
+class StatsSegment;
+class TileProcess;
+class NetworkIngest;
+struct IngestStatistics;
 
 
 #ifndef DEFUALT_BUFFER_SIZE
 #define DEFUALT_BUFFER_SIZE 2048 * 1024
 #endif // !DEFUALT_BUFFER_SIZE
 
+#ifndef DEFAULT_MEMORY_BUDGET
+#define DEFAULT_MEMORY_BUDGET 0
+#endif // !DEFAULT_MEMORY_BUDGET
+
+#ifndef DEFAULT_SHED_CPU_THRESHOLD
+#define DEFAULT_SHED_CPU_THRESHOLD 0.9
+#endif // !DEFAULT_SHED_CPU_THRESHOLD
+
+#ifndef DEFAULT_CHANNEL_CHANGE_TIMEOUT_MS
+#define DEFAULT_CHANNEL_CHANGE_TIMEOUT_MS 10000
+#endif // !DEFAULT_CHANNEL_CHANGE_TIMEOUT_MS
+
+// audio focus on every source, or on none
+#define AUDIO_FOCUS_ALL -1
+#define AUDIO_FOCUS_NONE -2
+
+
+
+// memory held by players against the budget
+struct MemoryUsage {
+	// 0 means no limit
+	uint64_t budget;
+	// stream buffers of attached and idle players
+	uint64_t buffer_bytes;
+	// demuxer-max-bytes plus demuxer-max-back-bytes of attached players, 0 for players on mpv defaults
+	uint64_t demuxer_limit_bytes;
+	// bytes the demuxer caches of attached players hold now
+	uint64_t demuxer_cache_bytes;
+};
+
+
+// what one tile shows of a player, tiles of a shared source each have one of the same player
+struct TileView {
+	bool visible;
+	int width;
+	int height;
+	// last frame rendered into the tile
+	uint64_t frame_serial;
+};
+
+
+// channel changes since start, timed from change_channel to swap_channel
+struct ChannelChangeStatistics {
+	uint64_t changes;
+	// swapped before the standby had a frame
+	uint64_t timeouts;
+	int64_t last_ms;
+	int64_t min_ms;
+	int64_t max_ms;
+	int64_t total_ms;
+};
+
+
+// the standby of a channel change has its first frame, runs once on an mpv event thread
+typedef std::function<void(int index)> ChannelReadyCallback;
+
+
+// a screenshot is done, runs once per requested index on a worker thread
+typedef std::function<void(int index, bool ok, Screenshot &shot)> ScreenshotReadyCallback;
 
 
 class MpvManager {
@@ -31,12 +113,234 @@ public:
 		std::string profile, std::string vo, std::string hwdec,
 		std::string gpu_api, std::string gpu_context, std::string log_level
 	);
+	// wid 0 means no container (headless)
+	bool start_players(
+		std::map<int, int64_t> &index_to_wid, int gpu_ways, std::string video_url,
+		std::string profile, std::string vo, std::string hwdec,
+		std::string gpu_api, std::string gpu_context, std::string log_level
+	);
 	void stop_players();
 
+	// have stream buffers of count players allocated before they start
+	void reserve_buffers(uint32_t count);
+
+	// options of players started by attach_player, the first gpu_ways players decode on gpu
+	void set_player_options(
+		int gpu_ways, std::string profile, std::string vo, std::string hwdec,
+		std::string gpu_api, std::string gpu_context, std::string log_level
+	);
+	// play a source in a container, reusing a recycled player when there is one, shown false keeps container hidden
+	bool attach_player(int index, int64_t wid, std::string video_url, int64_t area = 0, bool shown = true);
+	// stop the player of a source and keep it for the next attach
+	void detach_player(int index);
+	// sources that have a player
+	std::set<int> get_attached_indexes();
+
+	// fast channel change: play video_url on a hidden standby player in wid while the current player keeps the tile
+	// callback runs once the standby has its first frame, then swap_channel puts it in the tile
+	// returns false in process mode or when the standby did not start, attach_player switches cold then
+	bool change_channel(int index, int64_t wid, std::string video_url, ChannelReadyCallback callback = nullptr);
+	// the standby of index takes over and its old player is recycled, false when there is no standby
+	bool swap_channel(int index);
+	// stop the standby of index, the current player stays
+	void cancel_channel_change(int index);
+	// the standby of index has its first frame
+	bool is_channel_ready(int index);
+	void get_channel_change_statistics(ChannelChangeStatistics &stats);
+
+	// how players started by attach_player put video on screen, software players ignore wid
+	void set_render_mode(RenderMode mode);
+	// called on mpv threads when any software player has a new frame
+	void set_render_update_callback(std::function<void()> callback);
+	// render current frame of a software player as bgr0, only when it has a new one unless force is set
+	bool render_tile(int index, int width, int height, void *pixels, size_t stride, bool force = false);
+
+	// cores shared by decoder threads of all players, 0 means all cores, negative means mpv default
+	void set_decoder_thread_budget(int cores);
+
+	// bytes shared by stream buffers and demuxer caches of all players, 0 means no limit
+	void set_memory_budget(uint64_t bytes);
+	// what players hold against the budget
+	void get_memory_usage(MemoryUsage &usage);
+
+	// choose decode quality of each player from its tile size
+	void set_quality_governor(bool state);
+	// size of a tile changed
+	void set_tile_size(int index, int width, int height);
+	// a tile was hidden, shown, minimized or occluded
+	void set_tile_visible(int index, bool state);
+
+	// decode audio of the source at index only, the others play video alone, AUDIO_FOCUS_ALL and AUDIO_FOCUS_NONE as well
+	// moving focus switches audio tracks on the fly, video keeps playing
+	void set_audio_focus(int index);
+	int get_audio_focus();
+
+	// shed load from the least important tiles when process cpu reaches threshold (fraction of all cores)
+	void set_load_shedding(bool state, double cpu_threshold = DEFAULT_SHED_CPU_THRESHOLD);
+	// put every in-process player at one shed level, the governor moves them again when load shedding is on
+	void set_players_shed_level(ShedLevel level);
+
+	// publish live counters to the shared memory of key for qt-mpv-top, empty turns it off
+	void set_stats_key(std::string key);
+
+	// rewind local file at eof instead of stopping players
+	void set_loop_file(bool state);
+
+	// tiles of the same source share one decoding player, each renders its frames at its own size
+	// software render mode and headless players only, a native container shows one player, takes effect on next attach
+	void set_source_sharing(bool state);
+
+	// open each distinct http or tcp:// source once and fan its bytes out to all players of it, like a local file
+	// upstream connections and bandwidth then scale with sources instead of tiles, takes effect on next attach
+	void set_network_ingest(bool state);
+	// upstream traffic of the ingests open now
+	void get_ingest_statistics(IngestStatistics &stats);
+
+	// bytes of the last gop kept per local mpeg-ts file, players joining the file start with it, 0 turns it off
+	// takes effect on files opened afterwards
+	void set_gop_cache_size(uint32_t bytes);
+
+	// host each player started by attach_player in a child process running program, so a crash or hang only takes its tile down
+	// window render mode only, screenshots, quality windows and load shedding stay with in-process players
+	void set_process_mode(bool state, std::string program);
+
+	// sample counters of all players
+	void get_players_statistics(std::map<int, PlayerStatistics> &stats);
+	// playback quality of all players over their rolling windows
+	void get_players_quality(std::map<int, PlaybackQuality> &quality);
+
+	// ask players for raw screenshots at once, empty indexes means all, copy off the event thread then downscale and encode on worker pool
+	void take_screenshots(std::vector<int> indexes, const ScreenshotOptions &options, ScreenshotReadyCallback callback);
+	// one screenshot, waits at most timeout
+	bool take_screenshot(int index, const ScreenshotOptions &options, Screenshot &shot, int timeout_ms = 3000);
+
+	// thumbnail of every player in one buffer, each event thread scales its frame straight into its cell, returns false if any cell is stale
+	bool snapshot_mosaic(const MosaicOptions &options, Mosaic &mosaic);
+
+	// fan out to all players, send every request before waiting for the replies
+	bool play_players();
+	bool pause_players();
+	bool set_players_speed(double speed);
+
 
 private:
+	// wait for all replies of a fan out
+	bool wait_replies(std::vector<std::future<bool>> &replies);
+
+	// split decoder thread budget by area of attached tiles decoding in software
+	std::map<int, int> budget_decoder_threads();
+	// hand the split to running software players, under players lock
+	void rebalance_decoder_threads();
+
+	// split memory budget by area and input bitrate of attached tiles
+	std::map<int, PlayerMemoryLimits> budget_memory();
+	// hand the split to attached players, under players lock
+	void rebalance_memory();
+
+	// source at index decodes audio under current focus
+	bool has_audio_focus(int index);
+
+	// played through the feeder, a local file or an ingested network source
+	bool is_fed_source(const std::string &video_url);
+
+	// tile owning the player that tile index shows, index itself unless it shares one, under players lock
+	int get_owner_index(int index);
+	// owner first, then the tiles sharing its player, under players lock
+	std::vector<int> get_view_indexes(int owner);
+	// hand visibility, largest size and audio focus of all views to the player of owner, under players lock
+	void apply_views(int owner);
+
+	// a recycled player or a new one
+	MpvWrapper *acquire_player();
+	// a stopped player back to the idle ones
+	void release_player(MpvWrapper *mpv);
+
+	// attach_player in process mode
+	bool attach_tile_process(int index, int64_t wid, std::string video_url, int64_t area, bool shown);
+
+	// feed local files to the players attached to them
+	static void feed_files(void *ptr);
+
+	// keep workers of process mode alive, relaunch the ones that crashed or hung
+	static void supervise_workers(void *ptr);
+
+	// sample cpu and drops, shed or restore one step per interval
+	static void govern_load(void *ptr);
+	// raise shed level of the least important tile at the lowest level
+	bool shed_one_step();
+	// lower shed level of the most important tile at the highest level
+	bool restore_one_step();
+
+	// copy counters of players and process into the stats segment once per interval
+	static void publish_stats(void *ptr);
+
 	bool m_stopping;
+	bool m_loop_file;
+	uint32_t m_gop_cache_size;
+	// decode a source once for all tiles showing it
+	bool m_source_sharing;
+	// one upstream connection per network source
+	bool m_network_ingest;
+	// ingests by url, created and deleted by the feeder alone, the lock is for statistics readers
+	std::mutex m_ingest_mutex;
+	std::map<std::string, NetworkIngest *> m_url_to_ingest;
+	int m_decoder_thread_budget;
+	bool m_quality_governor;
+	// source that decodes audio, or AUDIO_FOCUS_ALL / AUDIO_FOCUS_NONE
+	int m_audio_focus;
+	bool m_load_shedding;
+	double m_shed_cpu_threshold;
+	std::thread *m_governor_thread;
+	std::map<int, int64_t> m_index_to_area;
+	uint64_t m_memory_budget;
+	// input bitrate last sampled by the governor
+	std::map<int, uint32_t> m_index_to_bitrate;
 	uint32_t m_buffer_size;
 	std::thread *m_read_file_thread;
+	int m_gpu_ways;
+	std::string m_profile;
+	std::string m_vo;
+	std::string m_hwdec;
+	std::string m_gpu_api;
+	std::string m_gpu_context;
+	std::string m_log_level;
+	RenderMode m_render_mode;
+	std::function<void()> m_render_update_callback;
+	// guard attached players, paging runs on gui thread while feeder and governor iterate them
+	std::mutex m_players_mutex;
+	// software renders running outside the players lock, stop_players waits for them before deleting players
+	int m_renders_in_flight;
+	std::condition_variable m_renders_done;
 	std::map<int, MpvWrapper *> m_index_to_mpv_wrapper;
+	std::map<int, std::string> m_index_to_file_path;
+	// source of tiles with a player of their own
+	std::map<int, std::string> m_index_to_url;
+	// tiles showing the player of another tile, to the index of that tile
+	std::map<int, int> m_index_to_shared_index;
+	// views of tiles with a player, their own or a shared one
+	std::map<int, TileView> m_index_to_view;
+	std::set<int> m_hwdec_indexes;
+	// stopped players waiting for the next attach, under m_players_mutex like the maps
+	std::vector<MpvWrapper *> m_idle_mpv_wrappers;
+	// standby players of channel changes in flight, with their files, hwdec and when the change was asked
+	std::map<int, MpvWrapper *> m_index_to_standby;
+	std::map<int, std::string> m_index_to_standby_url;
+	std::map<int, std::string> m_index_to_standby_file_path;
+	std::set<int> m_standby_hwdec_indexes;
+	std::map<int, std::chrono::steady_clock::time_point> m_index_to_change_time;
+	ChannelChangeStatistics m_channel_change_stats;
+	// process mode, tiles hosted by workers instead of players
+	bool m_process_mode;
+	std::string m_worker_program;
+	std::map<int, TileProcess *> m_index_to_tile_process;
+	std::vector<TileProcess *> m_idle_tile_processes;
+	std::thread *m_supervisor_thread;
+	// downscale and encode screenshots
+	WorkerPool *m_worker_pool;
+	// live counters for readers in other processes
+	std::string m_stats_key;
+	StatsSegment *m_stats_segment;
+	std::thread *m_stats_thread;
+	// players that did not answer a mosaic request yet are skipped, so slow ones do not pile up requests
+	std::map<int, std::shared_ptr<std::atomic<bool>>> m_index_to_mosaic_pending;
 };
@@ -8,13 +8,16 @@
 #include <locale.h>
 
 // c++
+#include <algorithm>
 #include <chrono>
+#include <cstring>
 #include <fstream>
 #include <sstream>
 #include <thread>
 
 // libmpv
 #include <mpv/client.h>
+#include <mpv/render.h>
 #include <mpv/stream_cb.h>
 
 // fmt
@@ -24,6 +27,11 @@
 // spdlog
 #include <spdlog/spdlog.h>
 
+// project
+#include "buffer_pool.hpp"
+#include "probe_cache.hpp"
+#include "trace.hpp"
+
 // windows
 #ifdef _WIN32
 #ifndef VC_EXTRALEAN
@@ -78,6 +86,8 @@ int open_fn(void *user_data, char *uri, mpv_stream_cb_info *info)
 		return MPV_ERROR_LOADING_FAILED;
 	}
 
+	thiz->on_stream_open();
+
 	info->cookie = thiz;
 	info->size_fn = size_fn;
 	info->read_fn = read_fn;
@@ -88,23 +98,76 @@ int open_fn(void *user_data, char *uri, mpv_stream_cb_info *info)
 }
 
 
+// reply_userdata of observed properties
+enum ObservedProperty : uint64_t {
+	OBSERVED_VIDEO_WIDTH = 1,
+	OBSERVED_VIDEO_HEIGHT,
+	OBSERVED_VIDEO_FORMAT,
+	OBSERVED_FRAME_DROPS,
+	OBSERVED_DECODER_FRAME_DROPS,
+	OBSERVED_VO_DELAYED_FRAMES,
+	OBSERVED_AVSYNC,
+	OBSERVED_DISPLAY_FPS,
+	OBSERVED_DECODED_FPS,
+	OBSERVED_SPEED,
+	OBSERVED_DEMUXER_CACHE_STATE,
+};
+
+
 std::atomic<uint16_t> MpvWrapper::s_index(0);
+std::atomic<uint32_t> MpvWrapper::s_log_rate_limit(0);
 
 
 MpvWrapper::MpvWrapper(uint32_t buffer_size)
 	: m_id(0)
 	, m_stopping(false)
 	, m_is_restarting(false)
+	, m_reload_pending(false)
+	, m_event_generation(0)
 	, m_mpv_context(nullptr)
+	, m_render_mode(RenderMode::Window)
+	, m_render_context(nullptr)
+	, m_frame_serial(0)
+	, m_async_request_id(1)
 	, m_event_thread(nullptr)
 	, m_container_wid(0)
+	, m_stream_input(false)
+	, m_fed_input(false)
+	, m_decoder_threads(0)
+	, m_quality_governor(false)
+	, m_tile_width(0)
+	, m_tile_height(0)
+	, m_decode_quality(DecodeQuality::Full)
+	, m_shed_level(ShedLevel::Off)
+	, m_applied_shed_level(ShedLevel::Off)
+	, m_visible(true)
+	, m_applied_visible(true)
+	, m_applied_fast(false)
+	, m_decoder_options_pending(false)
+	, m_pending_fast(false)
+	, m_speedup_allowed(true)
+	, m_audio_enabled(true)
 	, m_buffer_size(buffer_size)
+	, m_demuxer_max_bytes(0)
+	, m_demuxer_max_back_bytes(0)
 	, m_input_size_2s(0)
 	, m_estimated_bitrate(0)
 	, m_min_bitrate(0)
 	, m_estimated_speed(1.0)
 	, m_width(0)
 	, m_height(0)
+	, m_input_bytes(0)
+	, m_output_bytes(0)
+	, m_restarts(0)
+	, m_write_stalls(0)
+	, m_read_stalls(0)
+	, m_frame_drops(0)
+	, m_decoder_frame_drops(0)
+	, m_decoded_fps(0.0)
+	, m_observed_speed(1.0)
+	, m_demuxer_cache_bytes(0)
+	, m_first_frame_ms(-1)
+	, m_probe_cached(false)
 {
 }
 
@@ -112,6 +175,8 @@ MpvWrapper::MpvWrapper(uint32_t buffer_size)
 MpvWrapper::~MpvWrapper()
 {
 	stop();
+
+	BufferPool::instance().release(m_spsc.release_buffer());
 }
 
 
@@ -121,6 +186,15 @@ bool MpvWrapper::start(
 	std::string gpu_api, std::string gpu_context, std::string log_level
 )
 {
+	// the software render api needs its own vo, hwdec must copy frames back to memory
+	if (RenderMode::Software == m_render_mode) {
+		container_wid = 0;
+		vo = "libmpv";
+		if ("auto" == hwdec) {
+			hwdec = "auto-copy";
+		}
+	}
+
 	// record options
 	m_video_url = video_url;
 	m_profile = profile;
@@ -130,14 +204,41 @@ bool MpvWrapper::start(
 	m_gpu_context = gpu_context;
 	m_log_level = log_level;
 
-	// auto-incrementing index
+	// auto-incrementing index, taken under write lock so a writer checking the id sees either session
 	if (!m_is_restarting) {
+		std::lock_guard<std::mutex> lock(m_write_mutex);
 		m_id = s_index++;
 	}
 
 	m_width = 0;
 	m_height = 0;
 	m_estimated_speed = 1.0;
+	// a new handle counts from 0, the window of the tile survives restarts
+	m_frame_drops = 0;
+	m_decoder_frame_drops = 0;
+	m_decoded_fps = 0.0;
+	m_observed_speed = 1.0;
+	m_demuxer_cache_bytes = 0;
+	if (!m_is_restarting) {
+		m_quality_window.reset();
+		m_start_time = std::chrono::steady_clock::now();
+		m_first_frame_ms = -1;
+		// a recycled player or a channel change must not see the codec of the previous source as a change
+		std::lock_guard<std::mutex> lock(m_video_codec_mutex);
+		m_video_codec.clear();
+	}
+	// a new handle starts with mpv defaults
+	m_decode_quality = DecodeQuality::Full;
+	m_applied_shed_level = ShedLevel::Off;
+	m_applied_visible = true;
+	m_applied_skip_loop_filter = "default";
+	m_applied_skip_frame = "default";
+	m_applied_fast = false;
+	m_decoder_options_pending = false;
+	m_default_scale.clear();
+	m_default_dscale.clear();
+
+	m_log_rate_limiter.set_rate(s_log_rate_limit);
 
 	do {
 		setlocale(LC_NUMERIC, "C");
@@ -146,8 +247,11 @@ bool MpvWrapper::start(
 			break;
 		}
 
-		if (!set_option("wid", container_wid)) {
-			break;
+		// no container in headless mode
+		if (container_wid != 0) {
+			if (!set_option("wid", container_wid)) {
+				break;
+			}
 		}
 
 		if (!profile.empty()) {
@@ -184,6 +288,50 @@ bool MpvWrapper::start(
 			break;
 		}
 
+		// no audio decoder, resampler or output for tiles nobody listens to
+		if (!m_audio_enabled) {
+			if (!set_option("aid", std::string("no"))) {
+				break;
+			}
+		}
+
+		if (m_decoder_threads > 0) {
+			if (!set_option("vd-lavc-threads", (int64_t)m_decoder_threads)) {
+				break;
+			}
+		}
+
+		if (m_demuxer_max_bytes > 0) {
+			if (!set_option("demuxer-max-bytes", (int64_t)m_demuxer_max_bytes)) {
+				break;
+			}
+		}
+
+		if (m_demuxer_max_back_bytes > 0) {
+			if (!set_option("demuxer-max-back-bytes", (int64_t)m_demuxer_max_back_bytes)) {
+				break;
+			}
+		}
+
+		// a source opened before skips format probing and most of the stream analysis
+		// a restart probes in full, the decoder it recovers from may have been short of stream info
+		m_probe_cached = false;
+		m_cached_probe = ProbeResult();
+		if (!m_is_restarting) {
+			m_probe_cached = !video_url.empty() && ProbeCache::instance().lookup(video_url, m_cached_probe);
+			if (m_probe_cached) {
+				if (!set_option("demuxer-lavf-format", m_cached_probe.format)) {
+					break;
+				}
+				if (!set_option("demuxer-lavf-probesize", (int64_t)PROBE_CACHE_PROBESIZE)) {
+					break;
+				}
+				if (!set_option("demuxer-lavf-analyzeduration", (double)PROBE_CACHE_ANALYZEDURATION)) {
+					break;
+				}
+			}
+		}
+
 		if (!log_level.empty()) {
 			if (!set_log_level(log_level)) {
 				break;
@@ -194,15 +342,53 @@ bool MpvWrapper::start(
 			break;
 		}
 
-		m_event_thread = new std::thread(poll_events, this);
+		// scalers of the profile, so full quality can restore them without asking the core on the gui thread later
+		{
+			std::string scale;
+			std::string dscale;
+			get_property("scale", scale);
+			get_property("dscale", dscale);
+			std::lock_guard<std::mutex> lock(m_decode_quality_mutex);
+			m_default_scale = scale;
+			m_default_dscale = dscale;
+		}
+
+		if (RenderMode::Software == m_render_mode) {
+			if (!create_render_context()) {
+				break;
+			}
+		}
 
-		m_spsc.reset(m_buffer_size);
+		if (!observe_properties()) {
+			break;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_write_mutex);
+			// restarts and recycled players keep their ring, new players check one out of the pool
+			uint32_t buffer_size = m_buffer_size;
+			if (m_spsc.buffer_size() != roundup_pow_of_two(buffer_size)) {
+				BufferPool::instance().release(m_spsc.release_buffer());
+				m_spsc.reset(BufferPool::instance().acquire(buffer_size));
+			}
+			else {
+				m_spsc.reset(buffer_size);
+			}
+			m_ts_scanner.reset();
+			m_reload_pending = false;
+		}
 		if (m_spsc.is_buffer_null()) {
 			break;
 		}
 
+		// a recycled or restarted player still has the flag of its stop, the new event thread would leave at once
+		m_stopping = false;
+		m_event_generation++;
+		m_event_thread = new std::thread(poll_events, this);
+
 		std::ifstream file(video_url);
-		if (!video_url.empty() && !file.good()) {
+		m_stream_input = m_fed_input || video_url.empty() || file.good();
+		if (!m_stream_input) {
 			// read from network
 			if (!call_command({ "loadfile", video_url })) {
 				break;
@@ -219,7 +405,6 @@ bool MpvWrapper::start(
 			}
 		}
 
-		m_stopping = false;
 		m_is_restarting.store(false);
 
 		m_last_bitrate_update_time = std::chrono::steady_clock::now();
@@ -255,10 +440,26 @@ void MpvWrapper::stop()
 	}
 	m_event_thread = nullptr;
 
-	if (m_mpv_context != nullptr) {
-		mpv_terminate_destroy(m_mpv_context);
+	// the render context must go before the core
+	{
+		std::lock_guard<std::mutex> lock(m_render_mutex);
+		if (m_render_context != nullptr) {
+			mpv_render_context_free(m_render_context);
+		}
+		m_render_context = nullptr;
+	}
+
+	// callers on other threads hold the handle lock for their call, so none of them still uses it
+	{
+		std::lock_guard<std::mutex> lock(m_handle_mutex);
+		if (m_mpv_context != nullptr) {
+			mpv_terminate_destroy(m_mpv_context);
+		}
+		m_mpv_context = nullptr;
 	}
-	m_mpv_context = nullptr;
+
+	// replies of a destroyed handle never arrive
+	cancel_async_callbacks();
 
 	m_width = 0;
 	m_height = 0;
@@ -294,24 +495,60 @@ bool MpvWrapper::is_buffer_null()
 }
 
 
-bool MpvWrapper::write(const uint8_t *buf, uint32_t length)
+uint32_t MpvWrapper::get_id()
+{
+	return m_id;
+}
+
+
+bool MpvWrapper::write(const uint8_t *buf, uint32_t length, int64_t id)
 {
+	TraceSpan span("stream", "write", m_id);
+	span.set_value(length);
+
 	while (m_is_restarting) {
 		std::this_thread::sleep_for(std::chrono::milliseconds(5));
 	}
 
-	if (m_stopping) {
-		return false;
+	{
+		std::lock_guard<std::mutex> lock(m_write_mutex);
+		if (m_stopping || (id >= 0 && (uint32_t)id != m_id)) {
+			return false;
+		}
+
+		// paused by load shedding, discard instead of stalling the feeder
+		if (ShedLevel::Paused == m_shed_level) {
+			m_input_bytes += length;
+			return true;
+		}
 	}
 
+	// the lock covers one put at a time, never a wait for space
+	// a reload rewinding spsc in on_stream_open gets in between puts, mpv drains nothing while it waits
 	uint32_t offset = 0;
-	while (!m_stopping && offset < length) {
-		uint32_t c = m_spsc.put_if_not_full(buf, length);
+	while (offset < length) {
+		uint32_t c = 0;
+		{
+			std::lock_guard<std::mutex> lock(m_write_mutex);
+			if (m_stopping || (id >= 0 && (uint32_t)id != m_id)) {
+				break;
+			}
+			uint32_t input_offset = m_spsc.input_offset();
+			c = m_spsc.put(buf + offset, length - offset);
+			m_ts_scanner.feed(buf + offset, c, input_offset);
+		}
 		offset += c;
 		if (0 == c) {
+			m_write_stalls++;
+			TRACE_INSTANT("stream", "write_stall", m_id, length - offset);
 			std::this_thread::sleep_for(std::chrono::milliseconds(5));
 		}
 	}
+	// a stop or a channel change in between takes the rest of the chunk, only what spsc got counts
+	m_input_bytes += offset;
+	if (offset < length) {
+		return false;
+	}
 
 	// estimate bitrate
 	estimate_bitrate(length);
@@ -325,19 +562,50 @@ bool MpvWrapper::write(const uint8_t *buf, uint32_t length)
 
 int64_t MpvWrapper::read(char *buf, uint64_t nbytes)
 {
-	return (int64_t)m_spsc.get_if_not_empty((uint8_t *)buf, (uint32_t)nbytes);;
+	TraceSpan span("stream", "read", m_id);
+
+	if (m_spsc.is_buffer_empty()) {
+		m_read_stalls++;
+		TRACE_INSTANT("stream", "read_stall", m_id, 0);
+	}
+	int64_t length = (int64_t)m_spsc.get_if_not_empty((uint8_t *)buf, (uint32_t)nbytes);
+	if (length > 0) {
+		m_output_bytes += length;
+	}
+	span.set_value(length);
+	return length;
+}
+
+
+void MpvWrapper::on_stream_open()
+{
+	if (!m_reload_pending.exchange(false)) {
+		return;
+	}
+
+	// the old stream is closed and the writer is kept out between its puts, so nobody touches spsc
+	std::lock_guard<std::mutex> lock(m_write_mutex);
+
+	uint32_t input_offset = m_spsc.input_offset();
+	uint32_t keyframe_offset = 0;
+	if (!m_ts_scanner.get_last_keyframe(keyframe_offset) || !m_spsc.seek_output(keyframe_offset)) {
+		SPDLOG_WARN("[mpv {}] no key frame in buffer, reload continues with {} buffered bytes\n", m_id, m_spsc.available_data_size());
+		return;
+	}
+
+	SPDLOG_INFO("[mpv {}] reload from last key frame, {} bytes before live edge\n", m_id, input_offset - keyframe_offset);
 }
 
 
 bool MpvWrapper::play()
 {
-	return call_command({ "play" });
+	return set_property("pause", false);
 }
 
 
 bool MpvWrapper::pause()
 {
-	return call_command({ "pause" });
+	return set_property("pause", true);
 }
 
 
@@ -347,6 +615,24 @@ bool MpvWrapper::step()
 }
 
 
+std::future<bool> MpvWrapper::play_async()
+{
+	auto promise = std::make_shared<std::promise<bool>>();
+	// callback also runs when the request could not be sent
+	set_property_async("pause", false, [promise](int code, struct mpv_node *) { promise->set_value(code >= 0); });
+	return promise->get_future();
+}
+
+
+std::future<bool> MpvWrapper::pause_async()
+{
+	auto promise = std::make_shared<std::promise<bool>>();
+	// callback also runs when the request could not be sent
+	set_property_async("pause", true, [promise](int code, struct mpv_node *) { promise->set_value(code >= 0); });
+	return promise->get_future();
+}
+
+
 bool MpvWrapper::get_mute_state()
 {
 	bool r;
@@ -379,7 +665,7 @@ bool MpvWrapper::get_resolution(int64_t &width, int64_t &height)
 {
 	if (m_width > 0 && m_height > 0) {
 		width = m_width;
-		height = height;
+		height = m_height;
 		return true;
 	}
 
@@ -389,6 +675,13 @@ bool MpvWrapper::get_resolution(int64_t &width, int64_t &height)
 }
 
 
+std::string MpvWrapper::get_video_codec()
+{
+	std::lock_guard<std::mutex> lock(m_video_codec_mutex);
+	return m_video_codec;
+}
+
+
 double MpvWrapper::get_speed()
 {
 	double r;
@@ -403,6 +696,15 @@ bool MpvWrapper::set_speed(double v)
 }
 
 
+std::future<bool> MpvWrapper::set_speed_async(double v)
+{
+	auto promise = std::make_shared<std::promise<bool>>();
+	// callback also runs when the request could not be sent
+	set_property_async("speed", v, [promise](int code, struct mpv_node *) { promise->set_value(code >= 0); });
+	return promise->get_future();
+}
+
+
 int MpvWrapper::get_bitrate()
 {
 	if (m_estimated_bitrate > 0) {
@@ -423,6 +725,223 @@ int MpvWrapper::get_fps()
 }
 
 
+void MpvWrapper::get_statistics(PlayerStatistics &stats)
+{
+	// observed on event thread
+	stats.fps = m_decoded_fps;
+	stats.frame_drops = m_frame_drops;
+	stats.decoder_frame_drops = m_decoder_frame_drops;
+
+	stats.speed = m_observed_speed;
+
+	stats.input_bytes = m_input_bytes;
+	stats.output_bytes = m_output_bytes;
+	stats.buffer_size = m_spsc.buffer_size();
+	stats.buffer_fill = m_spsc.available_data_size();
+	stats.restarts = m_restarts;
+	stats.write_stalls = m_write_stalls;
+	stats.read_stalls = m_read_stalls;
+	stats.input_bitrate = m_estimated_bitrate;
+	stats.demuxer_cache_bytes = m_demuxer_cache_bytes;
+}
+
+
+void MpvWrapper::get_quality(PlaybackQuality &quality)
+{
+	m_quality_window.summarize(quality);
+}
+
+
+void MpvWrapper::set_memory_limits(const PlayerMemoryLimits &limits)
+{
+	if (limits.buffer_size > 0) {
+		m_buffer_size = limits.buffer_size;
+	}
+
+	// a limit going back to 0 restores the mpv default
+	int64_t previous_max_bytes = m_demuxer_max_bytes.exchange(limits.demuxer_max_bytes);
+	int64_t previous_max_back_bytes = m_demuxer_max_back_bytes.exchange(limits.demuxer_max_back_bytes);
+	if (nullptr == m_mpv_context) {
+		return;
+	}
+
+	if (limits.demuxer_max_bytes != previous_max_bytes) {
+		set_property_async("demuxer-max-bytes", limits.demuxer_max_bytes > 0 ? limits.demuxer_max_bytes : (int64_t)MPV_DEMUXER_MAX_BYTES);
+	}
+	if (limits.demuxer_max_back_bytes != previous_max_back_bytes) {
+		set_property_async("demuxer-max-back-bytes", limits.demuxer_max_back_bytes > 0 ? limits.demuxer_max_back_bytes : (int64_t)MPV_DEMUXER_MAX_BACK_BYTES);
+	}
+}
+
+
+void MpvWrapper::get_memory_limits(PlayerMemoryLimits &limits)
+{
+	limits.buffer_size = m_buffer_size;
+	limits.demuxer_max_bytes = m_demuxer_max_bytes;
+	limits.demuxer_max_back_bytes = m_demuxer_max_back_bytes;
+}
+
+
+uint32_t MpvWrapper::get_buffer_size()
+{
+	return m_spsc.buffer_size();
+}
+
+
+void MpvWrapper::set_decoder_threads(int threads)
+{
+	if (threads == m_decoder_threads.exchange(threads)) {
+		return;
+	}
+
+	// lavc takes its thread count when the decoder opens, a running one keeps its count until its next open
+	// reopening here would blank every software tile until its next key frame on each attach
+	if (m_mpv_context != nullptr && threads > 0) {
+		set_property_async("vd-lavc-threads", (int64_t)threads);
+	}
+}
+
+
+void MpvWrapper::set_quality_governor(bool state)
+{
+	m_quality_governor = state;
+	update_decode_quality();
+}
+
+
+void MpvWrapper::set_tile_size(int width, int height)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_decode_quality_mutex);
+		m_tile_width = width;
+		m_tile_height = height;
+	}
+	update_decode_quality();
+}
+
+
+DecodeQuality MpvWrapper::get_decode_quality()
+{
+	return m_decode_quality;
+}
+
+
+void MpvWrapper::set_shed_level(ShedLevel level)
+{
+	m_shed_level = level;
+	update_decode_quality();
+}
+
+
+ShedLevel MpvWrapper::get_shed_level()
+{
+	return m_shed_level;
+}
+
+
+void MpvWrapper::set_speedup_allowed(bool state)
+{
+	m_speedup_allowed = state;
+}
+
+
+void MpvWrapper::set_audio_enabled(bool state)
+{
+	if (m_audio_enabled.exchange(state) == state || nullptr == m_mpv_context) {
+		return;
+	}
+
+	// only the audio chain is built or torn down, the option survives reloads
+	TRACE_INSTANT("player", "audio", m_id, state);
+	set_property_async("aid", std::string(state ? "auto" : "no"));
+}
+
+
+bool MpvWrapper::is_audio_enabled()
+{
+	return m_audio_enabled;
+}
+
+
+void MpvWrapper::set_visible(bool state)
+{
+	m_visible = state;
+	update_decode_quality();
+}
+
+
+bool MpvWrapper::is_visible()
+{
+	return m_visible;
+}
+
+
+void MpvWrapper::set_render_mode(RenderMode mode)
+{
+	m_render_mode = mode;
+}
+
+
+void MpvWrapper::set_fed_input(bool state)
+{
+	m_fed_input = state;
+}
+
+
+void MpvWrapper::set_render_update_callback(std::function<void()> callback)
+{
+	m_render_update_callback = callback;
+}
+
+
+void MpvWrapper::set_first_frame_callback(std::function<void()> callback)
+{
+	m_first_frame_callback = callback;
+}
+
+
+int64_t MpvWrapper::get_first_frame_ms()
+{
+	return m_first_frame_ms;
+}
+
+
+bool MpvWrapper::render(int width, int height, void *pixels, size_t stride, uint64_t &frame_serial, bool force)
+{
+	std::lock_guard<std::mutex> lock(m_render_mutex);
+
+	if (nullptr == m_render_context || width <= 0 || height <= 0 || nullptr == pixels) {
+		return false;
+	}
+
+	// must be called after every update callback, even when not rendering
+	uint64_t flags = mpv_render_context_update(m_render_context);
+	if (flags & MPV_RENDER_UPDATE_FRAME) {
+		m_frame_serial++;
+	}
+	if (frame_serial == m_frame_serial && !force) {
+		return false;
+	}
+	frame_serial = m_frame_serial;
+
+	int size[2] = { width, height };
+	char format[] = "bgr0";
+	mpv_render_param params[] = {
+		{ MPV_RENDER_PARAM_SW_SIZE, size },
+		{ MPV_RENDER_PARAM_SW_FORMAT, format },
+		{ MPV_RENDER_PARAM_SW_STRIDE, &stride },
+		{ MPV_RENDER_PARAM_SW_POINTER, pixels },
+		{ MPV_RENDER_PARAM_INVALID, nullptr },
+	};
+	int code = mpv_render_context_render(m_render_context, params);
+	if (code < 0) {
+		SPDLOG_ERROR("[mpv {}] mpv_render_context_render({}x{}) error, code: {}, msg: {}\n", m_id, width, height, code, mpv_error_string(code));
+		return false;
+	}
+	return true;
+}
+
+
 bool MpvWrapper::screenshot(std::string &path)
 {
 #ifdef _WIN32
@@ -468,8 +987,55 @@ bool MpvWrapper::screenshot(std::string &path)
 }
 
 
+bool MpvWrapper::screenshot_raw_async(ScreenshotCallback callback)
+{
+	// "video" leaves out osd and subtitles, the result is a node map of w, h, stride, format and data
+	return call_command_async({ "screenshot-raw", "video" }, [this, callback](int code, struct mpv_node *result) {
+		FrameView view = { 0, 0, 0, nullptr };
+		std::string format;
+		if (code >= 0 && result != nullptr && MPV_FORMAT_NODE_MAP == result->format && result->u.list != nullptr) {
+			mpv_node_list *list = result->u.list;
+			for (int i = 0; i < list->num; i++) {
+				std::string key(list->keys[i]);
+				mpv_node *value = &list->values[i];
+				if ("w" == key && MPV_FORMAT_INT64 == value->format) {
+					view.width = (int)value->u.int64;
+				}
+				else if ("h" == key && MPV_FORMAT_INT64 == value->format) {
+					view.height = (int)value->u.int64;
+				}
+				else if ("stride" == key && MPV_FORMAT_INT64 == value->format) {
+					view.stride = (int)value->u.int64;
+				}
+				else if ("format" == key && MPV_FORMAT_STRING == value->format) {
+					format = value->u.string;
+				}
+				else if ("data" == key && MPV_FORMAT_BYTE_ARRAY == value->format && value->u.ba != nullptr) {
+					view.pixels = (const uint8_t *)value->u.ba->data;
+				}
+			}
+		}
+
+		bool ok = "bgr0" == format && view.pixels != nullptr && view.width > 0 && view.height > 0 && view.stride >= view.width * 4;
+		if (code >= 0 && !ok) {
+			SPDLOG_ERROR("[mpv {}] screenshot-raw returned unexpected frame, {}x{}, stride: {}, format: {}\n", m_id, view.width, view.height, view.stride, format);
+		}
+		if (callback) {
+			callback(ok, view);
+		}
+	});
+}
+
+
+void MpvWrapper::set_log_rate_limit(uint32_t lines_per_second)
+{
+	s_log_rate_limit = lines_per_second;
+}
+
+
 bool MpvWrapper::create_handle()
 {
+	std::lock_guard<std::mutex> lock(m_handle_mutex);
 	m_mpv_context = mpv_create();
 	if (nullptr == m_mpv_context) {
 		SPDLOG_ERROR("[mpv {}] mpv_create() error\n", m_id);
@@ -490,6 +1056,27 @@ bool MpvWrapper::initialize_handle()
 }
 
 
+bool MpvWrapper::create_render_context()
+{
+	char api_type[] = MPV_RENDER_API_TYPE_SW;
+	mpv_render_param params[] = {
+		{ MPV_RENDER_PARAM_API_TYPE, api_type },
+		{ MPV_RENDER_PARAM_INVALID, nullptr },
+	};
+
+	std::lock_guard<std::mutex> lock(m_render_mutex);
+	int code = mpv_render_context_create(&m_render_context, m_mpv_context, params);
+	if (code < 0) {
+		SPDLOG_ERROR("[mpv {}] mpv_render_context_create({}, sw) error, code: {}, msg: {}\n", m_id, fmt::ptr(m_mpv_context), code, mpv_error_string(code));
+		m_render_context = nullptr;
+		return false;
+	}
+
+	mpv_render_context_set_update_callback(m_render_context, on_render_update, this);
+	return true;
+}
+
+
 bool MpvWrapper::register_stream_callbacks()
 {
 	int code = mpv_stream_cb_add_ro(m_mpv_context, "myprotocol", (void *)this, open_fn);
@@ -512,46 +1099,125 @@ bool MpvWrapper::set_log_level(std::string min_level)
 }
 
 
-bool MpvWrapper::call_command(std::vector<std::string> args)
+bool MpvWrapper::observe_property(uint64_t id, std::string key, int format)
 {
-	// new array of str
-	char **cmd = new char *[args.size() + 1];
-	for (int i = 0; i < args.size(); i++) {
-		char *c = new char[args[i].size() + 1];
-		strncpy(c, args[i].c_str(), args[i].size());
-		c[args[i].size()] = '\0';
-
-		cmd[i] = c;
-	}
-	cmd[args.size()] = NULL;
-
-	int code = mpv_command(m_mpv_context, (const char **)cmd);
-
-	// delete array of str
-	for (int i = 0; i < args.size(); i++) {
-		delete[] cmd[i];
-	}
-	delete[] cmd;
-
+	int code = mpv_observe_property(m_mpv_context, id, key.c_str(), (mpv_format)format);
 	if (code < 0) {
-		SPDLOG_ERROR("[mpv {}] mpv_command({}, {}) error, code: {}, msg: {}\n", m_id, fmt::ptr(m_mpv_context), fmt::join(args, ", "), code, mpv_error_string(code));
+		SPDLOG_ERROR("[mpv {}] mpv_observe_property({}, {}, {}, {}) error, code: {}, msg: {}\n", m_id, fmt::ptr(m_mpv_context), id, key, format, code, mpv_error_string(code));
 		return false;
 	}
 	return true;
 }
 
 
-bool MpvWrapper::set_option(std::string key, bool value)
+bool MpvWrapper::observe_properties()
 {
-	int v = value ? 1 : 0;
-	int code = mpv_set_option(m_mpv_context, key.c_str(), MPV_FORMAT_FLAG, &v);
-	if (code < 0) {
-		SPDLOG_ERROR("[mpv {}] mpv_set_option_flag({}, {}, {}) error, code: {}, msg: {}\n", m_id, fmt::ptr(m_mpv_context), key, value, code, mpv_error_string(code));
+	// decoded size, same as "Decoder format: WxH" in the verbose log
+	if (!observe_property(OBSERVED_VIDEO_WIDTH, "video-params/w", MPV_FORMAT_INT64)) {
 		return false;
 	}
-	return true;
-}
-
+	if (!observe_property(OBSERVED_VIDEO_HEIGHT, "video-params/h", MPV_FORMAT_INT64)) {
+		return false;
+	}
+
+	// codec short name, e.g. h264 or hevc
+	if (!observe_property(OBSERVED_VIDEO_FORMAT, "video-format", MPV_FORMAT_STRING)) {
+		return false;
+	}
+
+	// playback quality, mpv checks these after every frame and only sends changes
+	if (!observe_property(OBSERVED_FRAME_DROPS, "frame-drop-count", MPV_FORMAT_INT64)) {
+		return false;
+	}
+	if (!observe_property(OBSERVED_DECODER_FRAME_DROPS, "decoder-frame-drop-count", MPV_FORMAT_INT64)) {
+		return false;
+	}
+	if (!observe_property(OBSERVED_VO_DELAYED_FRAMES, "vo-delayed-frame-count", MPV_FORMAT_INT64)) {
+		return false;
+	}
+	if (!observe_property(OBSERVED_AVSYNC, "avsync", MPV_FORMAT_DOUBLE)) {
+		return false;
+	}
+	if (!observe_property(OBSERVED_DISPLAY_FPS, "estimated-display-fps", MPV_FORMAT_DOUBLE)) {
+		return false;
+	}
+	if (!observe_property(OBSERVED_DECODED_FPS, "estimated-vf-fps", MPV_FORMAT_DOUBLE)) {
+		return false;
+	}
+
+	// counters of get_statistics, callers sample them every second for every player and must not wait for the core
+	if (!observe_property(OBSERVED_SPEED, "speed", MPV_FORMAT_DOUBLE)) {
+		return false;
+	}
+	// mpv rate limits updates of the cache state
+	if (!observe_property(OBSERVED_DEMUXER_CACHE_STATE, "demuxer-cache-state", MPV_FORMAT_NODE)) {
+		return false;
+	}
+
+	return true;
+}
+
+
+int MpvWrapper::with_handle(std::function<int(mpv_handle *)> call)
+{
+	std::lock_guard<std::mutex> lock(m_handle_mutex);
+	if (nullptr == m_mpv_context) {
+		return MPV_ERROR_UNINITIALIZED;
+	}
+	return call(m_mpv_context);
+}
+
+
+bool MpvWrapper::call_command(std::vector<std::string> args)
+{
+	// mpv copies the arguments, so point at the strings instead of duplicating them
+	std::vector<const char *> cmd;
+	cmd.reserve(args.size() + 1);
+	for (auto &arg : args) {
+		cmd.push_back(arg.c_str());
+	}
+	cmd.push_back(nullptr);
+
+	int code = with_handle([&](mpv_handle *handle) { return mpv_command(handle, cmd.data()); });
+	if (code < 0) {
+		SPDLOG_ERROR("[mpv {}] mpv_command({}, {}) error, code: {}, msg: {}\n", m_id, fmt::ptr(m_mpv_context), fmt::join(args, ", "), code, mpv_error_string(code));
+		return false;
+	}
+	return true;
+}
+
+
+bool MpvWrapper::call_command_async(std::vector<std::string> args, AsyncReplyCallback callback)
+{
+	std::vector<const char *> cmd;
+	cmd.reserve(args.size() + 1);
+	for (auto &arg : args) {
+		cmd.push_back(arg.c_str());
+	}
+	cmd.push_back(nullptr);
+
+	uint64_t id = add_async_callback(callback);
+	int code = with_handle([&](mpv_handle *handle) { return mpv_command_async(handle, id, cmd.data()); });
+	if (code < 0) {
+		complete_async_callback(id, code, nullptr);
+		SPDLOG_ERROR("[mpv {}] mpv_command_async({}, {}, {}) error, code: {}, msg: {}\n", m_id, fmt::ptr(m_mpv_context), id, fmt::join(args, ", "), code, mpv_error_string(code));
+		return false;
+	}
+	return true;
+}
+
+
+bool MpvWrapper::set_option(std::string key, bool value)
+{
+	int v = value ? 1 : 0;
+	int code = mpv_set_option(m_mpv_context, key.c_str(), MPV_FORMAT_FLAG, &v);
+	if (code < 0) {
+		SPDLOG_ERROR("[mpv {}] mpv_set_option_flag({}, {}, {}) error, code: {}, msg: {}\n", m_id, fmt::ptr(m_mpv_context), key, value, code, mpv_error_string(code));
+		return false;
+	}
+	return true;
+}
+
 
 bool MpvWrapper::set_option(std::string key, int64_t value)
 {
@@ -589,7 +1255,7 @@ bool MpvWrapper::set_option(std::string key, std::string value)
 bool MpvWrapper::get_property(std::string key, bool &value)
 {
 	int v;
-	int code = mpv_get_property(m_mpv_context, key.c_str(), MPV_FORMAT_FLAG, &v);
+	int code = with_handle([&](mpv_handle *handle) { return mpv_get_property(handle, key.c_str(), MPV_FORMAT_FLAG, &v); });
 	if (code < 0) {
 		SPDLOG_ERROR("[mpv {}] get_property_flag({}, {}) error, code: {}, msg: {}\n", m_id, fmt::ptr(m_mpv_context), key, code, mpv_error_string(code));
 		return false;
@@ -601,7 +1267,7 @@ bool MpvWrapper::get_property(std::string key, bool &value)
 
 bool MpvWrapper::get_property(std::string key, int64_t &value)
 {
-	int code = mpv_get_property(m_mpv_context, key.c_str(), MPV_FORMAT_INT64, &value);
+	int code = with_handle([&](mpv_handle *handle) { return mpv_get_property(handle, key.c_str(), MPV_FORMAT_INT64, &value); });
 	if (code < 0) {
 		SPDLOG_ERROR("[mpv {}] get_property_int64({}, {}) error, code: {}, msg: {}\n", m_id, fmt::ptr(m_mpv_context), key, code, mpv_error_string(code));
 		return false;
@@ -612,7 +1278,7 @@ bool MpvWrapper::get_property(std::string key, int64_t &value)
 
 bool MpvWrapper::get_property(std::string key, double &value)
 {
-	int code = mpv_get_property(m_mpv_context, key.c_str(), MPV_FORMAT_DOUBLE, &value);
+	int code = with_handle([&](mpv_handle *handle) { return mpv_get_property(handle, key.c_str(), MPV_FORMAT_DOUBLE, &value); });
 	if (code < 0) {
 		SPDLOG_ERROR("[mpv {}] get_property_double({}, {}) error, code: {}, msg: {}\n", m_id, fmt::ptr(m_mpv_context), key, code, mpv_error_string(code));
 		return false;
@@ -623,11 +1289,15 @@ bool MpvWrapper::get_property(std::string key, double &value)
 
 bool MpvWrapper::get_property(std::string key, std::string &value)
 {
-	int code = mpv_get_property(m_mpv_context, key.c_str(), MPV_FORMAT_STRING, &value);
+	// mpv returns a char * allocated by itself
+	char *v = nullptr;
+	int code = with_handle([&](mpv_handle *handle) { return mpv_get_property(handle, key.c_str(), MPV_FORMAT_STRING, &v); });
 	if (code < 0) {
 		SPDLOG_ERROR("[mpv {}] get_property_string({}, {}) error, code: {}, msg: {}\n", m_id, fmt::ptr(m_mpv_context), key, code, mpv_error_string(code));
 		return false;
 	}
+	value = v != nullptr ? v : "";
+	mpv_free(v);
 	return true;
 }
 
@@ -635,7 +1305,7 @@ bool MpvWrapper::get_property(std::string key, std::string &value)
 bool MpvWrapper::set_property(std::string key, bool value)
 {
 	int v = value ? 1 : 0;
-	int code = mpv_set_property(m_mpv_context, key.c_str(), MPV_FORMAT_FLAG, &v);
+	int code = with_handle([&](mpv_handle *handle) { return mpv_set_property(handle, key.c_str(), MPV_FORMAT_FLAG, &v); });
 	if (code < 0) {
 		SPDLOG_ERROR("[mpv {}] mpv_set_property_flag({}, {}, {}) error, code: {}, msg: {}\n", m_id, fmt::ptr(m_mpv_context), key, value, code, mpv_error_string(code));
 		return false;
@@ -646,7 +1316,7 @@ bool MpvWrapper::set_property(std::string key, bool value)
 
 bool MpvWrapper::set_property(std::string key, int64_t value)
 {
-	int code = mpv_set_property(m_mpv_context, key.c_str(), MPV_FORMAT_INT64, &value);
+	int code = with_handle([&](mpv_handle *handle) { return mpv_set_property(handle, key.c_str(), MPV_FORMAT_INT64, &value); });
 	if (code < 0) {
 		SPDLOG_ERROR("[mpv {}] mpv_set_property_int64({}, {}, {}) error, code: {}, msg: {}\n", m_id, fmt::ptr(m_mpv_context), key, value, code, mpv_error_string(code));
 		return false;
@@ -657,7 +1327,7 @@ bool MpvWrapper::set_property(std::string key, int64_t value)
 
 bool MpvWrapper::set_property(std::string key, double value)
 {
-	int code = mpv_set_property(m_mpv_context, key.c_str(), MPV_FORMAT_DOUBLE, &value);
+	int code = with_handle([&](mpv_handle *handle) { return mpv_set_property(handle, key.c_str(), MPV_FORMAT_DOUBLE, &value); });
 	if (code < 0) {
 		SPDLOG_ERROR("[mpv {}] mpv_set_property_double({}, {}, {}) error, code: {}, msg: {}\n", m_id, fmt::ptr(m_mpv_context), key, value, code, mpv_error_string(code));
 		return false;
@@ -668,7 +1338,7 @@ bool MpvWrapper::set_property(std::string key, double value)
 
 bool MpvWrapper::set_property(std::string key, std::string value)
 {
-	int code = mpv_set_property_string(m_mpv_context, key.c_str(), value.c_str());
+	int code = with_handle([&](mpv_handle *handle) { return mpv_set_property_string(handle, key.c_str(), value.c_str()); });
 	if (code < 0) {
 		SPDLOG_ERROR("[mpv {}] mpv_set_property_string({}, {}, {}) error, code: {}, msg: {}\n", m_id, fmt::ptr(m_mpv_context), key, value, code, mpv_error_string(code));
 		return false;
@@ -677,8 +1347,109 @@ bool MpvWrapper::set_property(std::string key, std::string value)
 }
 
 
+bool MpvWrapper::set_property_async(std::string key, bool value, AsyncReplyCallback callback)
+{
+	int v = value ? 1 : 0;
+	uint64_t id = add_async_callback(callback);
+	int code = with_handle([&](mpv_handle *handle) { return mpv_set_property_async(handle, id, key.c_str(), MPV_FORMAT_FLAG, &v); });
+	if (code < 0) {
+		complete_async_callback(id, code, nullptr);
+		SPDLOG_ERROR("[mpv {}] mpv_set_property_async_flag({}, {}, {}, {}) error, code: {}, msg: {}\n", m_id, fmt::ptr(m_mpv_context), id, key, value, code, mpv_error_string(code));
+		return false;
+	}
+	return true;
+}
+
+
+bool MpvWrapper::set_property_async(std::string key, int64_t value, AsyncReplyCallback callback)
+{
+	uint64_t id = add_async_callback(callback);
+	int code = with_handle([&](mpv_handle *handle) { return mpv_set_property_async(handle, id, key.c_str(), MPV_FORMAT_INT64, &value); });
+	if (code < 0) {
+		complete_async_callback(id, code, nullptr);
+		SPDLOG_ERROR("[mpv {}] mpv_set_property_async_int64({}, {}, {}, {}) error, code: {}, msg: {}\n", m_id, fmt::ptr(m_mpv_context), id, key, value, code, mpv_error_string(code));
+		return false;
+	}
+	return true;
+}
+
+
+bool MpvWrapper::set_property_async(std::string key, double value, AsyncReplyCallback callback)
+{
+	uint64_t id = add_async_callback(callback);
+	int code = with_handle([&](mpv_handle *handle) { return mpv_set_property_async(handle, id, key.c_str(), MPV_FORMAT_DOUBLE, &value); });
+	if (code < 0) {
+		complete_async_callback(id, code, nullptr);
+		SPDLOG_ERROR("[mpv {}] mpv_set_property_async_double({}, {}, {}, {}) error, code: {}, msg: {}\n", m_id, fmt::ptr(m_mpv_context), id, key, value, code, mpv_error_string(code));
+		return false;
+	}
+	return true;
+}
+
+
+bool MpvWrapper::set_property_async(std::string key, std::string value, AsyncReplyCallback callback)
+{
+	const char *v = value.c_str();
+	uint64_t id = add_async_callback(callback);
+	int code = with_handle([&](mpv_handle *handle) { return mpv_set_property_async(handle, id, key.c_str(), MPV_FORMAT_STRING, &v); });
+	if (code < 0) {
+		complete_async_callback(id, code, nullptr);
+		SPDLOG_ERROR("[mpv {}] mpv_set_property_async_string({}, {}, {}, {}) error, code: {}, msg: {}\n", m_id, fmt::ptr(m_mpv_context), id, key, value, code, mpv_error_string(code));
+		return false;
+	}
+	return true;
+}
+
+
+uint64_t MpvWrapper::add_async_callback(AsyncReplyCallback callback)
+{
+	uint64_t id = m_async_request_id++;
+	if (callback) {
+		std::lock_guard<std::mutex> lock(m_async_callbacks_mutex);
+		m_async_callbacks.insert(std::make_pair(id, callback));
+	}
+	return id;
+}
+
+
+void MpvWrapper::complete_async_callback(uint64_t id, int code, struct mpv_node *result)
+{
+	AsyncReplyCallback callback;
+	{
+		std::lock_guard<std::mutex> lock(m_async_callbacks_mutex);
+		auto iter = m_async_callbacks.find(id);
+		if (iter == m_async_callbacks.end()) {
+			return;
+		}
+		callback = iter->second;
+		m_async_callbacks.erase(iter);
+	}
+
+	// run outside the lock, callback may issue another request
+	callback(code, result);
+}
+
+
+void MpvWrapper::cancel_async_callbacks()
+{
+	std::map<uint64_t, AsyncReplyCallback> callbacks;
+	{
+		std::lock_guard<std::mutex> lock(m_async_callbacks_mutex);
+		callbacks.swap(m_async_callbacks);
+	}
+
+	for (auto iter = callbacks.begin(); iter != callbacks.end(); iter++) {
+		iter->second(MPV_ERROR_UNINITIALIZED, nullptr);
+	}
+}
+
+
 void MpvWrapper::set_container_window_visible(bool state)
 {
+	if (0 == m_container_wid) {
+		return;
+	}
+
 #ifdef _WIN32
 	ShowWindow((HWND)m_container_wid, state ? SW_SHOW : SW_HIDE);
 #endif // _WIN32
@@ -703,13 +1474,80 @@ void MpvWrapper::set_container_window_visible(bool state)
 }
 
 
-bool MpvWrapper::restart_when_codec_changed(struct mpv_event_log_message *msg)
+bool MpvWrapper::reload_in_place()
+{
+	if (nullptr == m_mpv_context) {
+		return false;
+	}
+
+	TRACE_INSTANT("player", "reload", m_id, m_stream_input);
+
+	// decoder options set at runtime belong to the handle and survive loadfile
+	m_reload_pending = m_stream_input;
+	bool ok = call_command_async({ "loadfile", m_stream_input ? "myprotocol://fake" : m_video_url }, [this](int code, struct mpv_node *result) {
+		if (code < 0) {
+			m_reload_pending = false;
+			SPDLOG_ERROR("[mpv {}] reload error, code: {}, msg: {}\n", m_id, code, mpv_error_string(code));
+		}
+	});
+	if (!ok) {
+		m_reload_pending = false;
+		return false;
+	}
+
+	m_restarts++;
+	return true;
+}
+
+
+void MpvWrapper::restart()
+{
+	TRACE_INSTANT("player", "restart", m_id, 0);
+	m_restarts++;
+	m_is_restarting.store(true);
+	stop();
+	start(m_container_wid, m_video_url, m_profile, m_vo, m_hwdec, m_gpu_api, m_gpu_context, m_log_level);
+	m_is_restarting.store(false);
+}
+
+
+bool MpvWrapper::restart_when_codec_changed(struct mpv_event_property *prop)
+{
+	if (prop->data == nullptr || prop->format != MPV_FORMAT_STRING) {
+		return false;
+	}
+
+	std::string codec(*(char **)prop->data);
+	bool changed = false;
+	{
+		std::lock_guard<std::mutex> lock(m_video_codec_mutex);
+		changed = !m_video_codec.empty() && m_video_codec != codec;
+		m_video_codec = codec;
+	}
+	if (!changed) {
+		return false;
+	}
+
+	if (!reload_in_place()) {
+		restart();
+	}
+
+	return true;
+}
+
+
+bool MpvWrapper::restart_when_decoder_failed(struct mpv_event_log_message *msg)
 {
+	// ffmpeg reports it as an error while the stream keeps playing, so there is no structured event for it
 	if (msg->log_level <= MPV_LOG_LEVEL_WARN && strstr(msg->prefix, "ffmpeg/video") != nullptr && strstr(msg->text, "data partitioning is not implemented") != nullptr) {
-		m_is_restarting.store(true);
-		stop();
-		start(m_container_wid, m_video_url, m_profile, m_vo, m_hwdec, m_gpu_api, m_gpu_context, m_log_level);
-		m_is_restarting.store(false);
+		// the failing stream keeps logging until the reload reaches it
+		if (m_reload_pending) {
+			return false;
+		}
+
+		if (!reload_in_place()) {
+			restart();
+		}
 
 		return true;
 	}
@@ -718,22 +1556,22 @@ bool MpvWrapper::restart_when_codec_changed(struct mpv_event_log_message *msg)
 }
 
 
-bool MpvWrapper::get_decoded_resolution(struct mpv_event_log_message *msg)
+bool MpvWrapper::get_decoded_resolution(uint64_t id, struct mpv_event_property *prop)
 {
-	const char *pattern = nullptr;
+	// video-params is unavailable (MPV_FORMAT_NONE) until the first frame was decoded
+	if (prop->data == nullptr || prop->format != MPV_FORMAT_INT64) {
+		return false;
+	}
 
-	// msg->text = Decoder format: 1920x1080 [0:1] d3d11[nv12] auto/auto/auto/auto/auto CL=mpeg2/4/h264 crop=1920x1080+0+0
-	if ((pattern = strstr(msg->text, "Decoder format: ")) != nullptr) {
-		m_width = atoi(pattern + 16);
-		m_height = atoi(strchr(pattern, 'x') + 1);
+	int64_t value = *(int64_t *)prop->data;
+	if (OBSERVED_VIDEO_WIDTH == id) {
+		m_width = (uint32_t)value;
 	}
-	// [vo/gpu] reconfig to 720x480 yuv420p bt.601/bt.601-525/bt.1886/limited/display CL=mpeg2/4/h264 crop=720x480+0+0
-	else if ((pattern = strstr(msg->text, "reconfig to ")) != nullptr) {
-		m_width = atoi(pattern + 12);
-		m_height = atoi(strchr(pattern, 'x') + 1);
+	else {
+		m_height = (uint32_t)value;
 	}
 
-	if (pattern != nullptr) {
+	if (m_width > 0 && m_height > 0) {
 		if (m_width * m_height >= 3840 * 2160) {
 			m_min_bitrate = 1600 * 1024 / 4;
 		}
@@ -757,6 +1595,114 @@ bool MpvWrapper::get_decoded_resolution(struct mpv_event_log_message *msg)
 }
 
 
+void MpvWrapper::update_quality(uint64_t id, struct mpv_event_property *prop)
+{
+	// unavailable (MPV_FORMAT_NONE) without video or audio
+	if (nullptr == prop->data) {
+		return;
+	}
+
+	if (MPV_FORMAT_INT64 == prop->format) {
+		int64_t value = *(int64_t *)prop->data;
+		switch (id) {
+		case OBSERVED_FRAME_DROPS:
+			m_frame_drops = value;
+			m_quality_window.add_frame_drops(value);
+			break;
+		case OBSERVED_DECODER_FRAME_DROPS:
+			m_decoder_frame_drops = value;
+			m_quality_window.add_decoder_frame_drops(value);
+			break;
+		case OBSERVED_VO_DELAYED_FRAMES:
+			m_quality_window.add_vo_delayed_frames(value);
+			break;
+		}
+	}
+	else if (MPV_FORMAT_DOUBLE == prop->format) {
+		double value = *(double *)prop->data;
+		switch (id) {
+		case OBSERVED_AVSYNC:
+			m_quality_window.add_avsync(value);
+			break;
+		case OBSERVED_DISPLAY_FPS:
+			m_quality_window.add_display_fps(value);
+			break;
+		case OBSERVED_DECODED_FPS:
+			m_decoded_fps = value;
+			m_quality_window.add_decoded_fps(value);
+			TRACE_COUNTER("quality", "fps", m_id, (int64_t)value);
+			break;
+		}
+	}
+}
+
+
+void MpvWrapper::update_statistics(uint64_t id, struct mpv_event_property *prop)
+{
+	if (OBSERVED_SPEED == id && MPV_FORMAT_DOUBLE == prop->format && prop->data != nullptr) {
+		m_observed_speed = *(double *)prop->data;
+	}
+	else if (OBSERVED_DEMUXER_CACHE_STATE == id) {
+		// forward and backward cache, the node map also lists cached ranges, none without a demuxer
+		int64_t bytes = 0;
+		mpv_node *node = MPV_FORMAT_NODE == prop->format ? (mpv_node *)prop->data : nullptr;
+		if (node != nullptr && MPV_FORMAT_NODE_MAP == node->format && node->u.list != nullptr) {
+			for (int i = 0; i < node->u.list->num; i++) {
+				if (0 == strcmp(node->u.list->keys[i], "total-bytes") && MPV_FORMAT_INT64 == node->u.list->values[i].format) {
+					bytes = node->u.list->values[i].u.int64;
+				}
+			}
+		}
+		m_demuxer_cache_bytes = bytes;
+	}
+}
+
+
+void MpvWrapper::log_end_file(struct mpv_event_end_file *end_file)
+{
+	if (MPV_END_FILE_REASON_ERROR == end_file->reason) {
+		SPDLOG_ERROR("[mpv {}] playback ended with error, code: {}, msg: {}\n", m_id, end_file->error, mpv_error_string(end_file->error));
+	}
+	else {
+		SPDLOG_INFO("[mpv {}] playback ended, reason: {}\n", m_id, end_file->reason);
+	}
+}
+
+
+void MpvWrapper::update_probe_cache(int64_t first_frame_ms)
+{
+	ProbeCache::instance().record_first_frame(m_probe_cached, first_frame_ms);
+
+	// only lavf takes demuxer-lavf-format, mpv's own demuxers name formats differently
+	std::string demuxer;
+	ProbeResult result;
+	if (!get_property("current-demuxer", demuxer) || demuxer != "lavf" || !get_property("file-format", result.format)) {
+		return;
+	}
+	result.video_codec = get_video_codec();
+	result.width = m_width;
+	result.height = m_height;
+
+	// the short probe of a hit may miss what changed behind the url, a different video makes the next open probe in full
+	if (m_probe_cached) {
+		// either side may not have known the video at its first frame
+		bool same_codec = result.video_codec.empty() || m_cached_probe.video_codec.empty() || result.video_codec == m_cached_probe.video_codec;
+		bool same_size = 0 == result.width || 0 == m_cached_probe.width || (result.width == m_cached_probe.width && result.height == m_cached_probe.height);
+		if (result.format != m_cached_probe.format || !same_codec || !same_size) {
+			SPDLOG_WARN(
+				"[mpv {}] cached probe of {} is stale, {} {} {}x{} now, {} {} {}x{} cached\n",
+				m_id, m_video_url, result.format, result.video_codec, result.width, result.height,
+				m_cached_probe.format, m_cached_probe.video_codec, m_cached_probe.width, m_cached_probe.height
+			);
+			ProbeCache::instance().invalidate(m_video_url);
+		}
+		return;
+	}
+
+	ProbeCache::instance().store(m_video_url, result);
+}
+
+
 void MpvWrapper::estimate_bitrate(uint32_t length)
 {
 	m_input_size_2s += length;
@@ -783,7 +1729,8 @@ void MpvWrapper::reduce_latency()
 		return;
 	}
 
-	double lag_seconds = (double)m_spsc.buffer_size() / bitrate;
+	double lag_seconds = (double)m_spsc.available_data_size() / bitrate;
+	TRACE_COUNTER("stream", "lag_ms", m_id, (int64_t)(lag_seconds * 1000));
 	if (lag_seconds < 6) {
 		return;
 	}
@@ -807,19 +1754,187 @@ void MpvWrapper::reduce_latency()
 		speeding_up = true;
 	}
 
+	// playing faster costs more cpu, which makes an overloaded host worse
+	if (!m_speedup_allowed || m_shed_level != ShedLevel::Off) {
+		speeding_up = false;
+	}
+
 	if (speeding_up) {
 		if (m_estimated_speed < speed && speed != get_speed()) {
+			TRACE_INSTANT("speed", "speed_up", m_id, (int64_t)(speed * 100));
 			set_speed(speed);
 		}
 	}
 	else {
 		if (m_estimated_speed != get_speed()) {
+			TRACE_INSTANT("speed", "speed_restore", m_id, (int64_t)(m_estimated_speed * 100));
 			set_speed(m_estimated_speed);
 		}
 	}
 }
 
 
+void MpvWrapper::update_decode_quality()
+{
+	std::lock_guard<std::mutex> lock(m_decode_quality_mutex);
+
+	if (nullptr == m_mpv_context) {
+		return;
+	}
+
+	DecodeQuality quality = DecodeQuality::Full;
+	int64_t tile_area = (int64_t)m_tile_width * m_tile_height;
+	int64_t video_area = (int64_t)m_width * m_height;
+	if (m_quality_governor && tile_area > 0 && video_area > 0) {
+		// how many decoded pixels fall on one pixel of the tile
+		double ratio = (double)video_area / tile_area;
+		if (ratio >= 4.0) {
+			quality = DecodeQuality::Low;
+		}
+		else if (ratio >= 2.0) {
+			quality = DecodeQuality::Reduced;
+		}
+	}
+
+	ShedLevel shed = m_shed_level;
+	bool visible = m_visible;
+	if (quality == m_decode_quality && shed == m_applied_shed_level && visible == m_applied_visible) {
+		return;
+	}
+
+	SPDLOG_INFO(
+		"[mpv {}] decode quality {} -> {}, shed level {} -> {}, visible {} -> {}, video {}x{}, tile {}x{}\n",
+		m_id, (int)m_decode_quality.load(), (int)quality, (int)m_applied_shed_level, (int)shed, m_applied_visible, visible, m_width, m_height, m_tile_width, m_tile_height
+	);
+	apply_decode_settings(quality, shed, m_applied_shed_level, visible);
+	m_decode_quality = quality;
+	m_applied_shed_level = shed;
+	m_applied_visible = visible;
+}
+
+
+void MpvWrapper::reopen_decoder()
+{
+	// selecting the video track again opens a new decoder with the current lavc options, the stream is not reopened
+	set_property_async("vid", std::string("no"));
+	set_property_async("vid", std::string("auto"));
+	TRACE_INSTANT("player", "decoder_reopen", m_id, 0);
+}
+
+
+// order of lavc skip values, higher skips more
+static int skip_rank(const std::string &value)
+{
+	if ("nonref" == value) {
+		return 1;
+	}
+	if ("nonkey" == value) {
+		return 2;
+	}
+	if ("all" == value) {
+		return 3;
+	}
+	return 0;
+}
+
+
+void MpvWrapper::apply_pending_decoder_options()
+{
+	if (!m_decoder_options_pending) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(m_decode_quality_mutex);
+	if (!m_decoder_options_pending) {
+		return;
+	}
+
+	// cheaper in every option relieves an overloaded host, anything else waits longer
+	bool lower = skip_rank(m_pending_skip_loop_filter) >= skip_rank(m_applied_skip_loop_filter)
+		&& skip_rank(m_pending_skip_frame) >= skip_rank(m_applied_skip_frame)
+		&& m_pending_fast >= m_applied_fast;
+	int64_t settle_ms = lower ? DECODER_LOWER_SETTLE_MS : DECODER_RAISE_SETTLE_MS;
+	if (std::chrono::steady_clock::now() - m_pending_since < std::chrono::milliseconds(settle_ms)) {
+		return;
+	}
+
+	SPDLOG_INFO(
+		"[mpv {}] decoder opens again, skiploopfilter {} -> {}, skipframe {} -> {}, fast {} -> {}\n",
+		m_id, m_applied_skip_loop_filter, m_pending_skip_loop_filter, m_applied_skip_frame, m_pending_skip_frame, m_applied_fast, m_pending_fast
+	);
+	set_property_async("vd-lavc-skiploopfilter", m_pending_skip_loop_filter);
+	set_property_async("vd-lavc-skipframe", m_pending_skip_frame);
+	set_property_async("vd-lavc-fast", m_pending_fast);
+	reopen_decoder();
+	m_applied_skip_loop_filter = m_pending_skip_loop_filter;
+	m_applied_skip_frame = m_pending_skip_frame;
+	m_applied_fast = m_pending_fast;
+	m_decoder_options_pending = false;
+}
+
+
+void MpvWrapper::apply_decode_settings(DecodeQuality quality, ShedLevel shed, ShedLevel previous_shed, bool visible)
+{
+	// the cheaper of what tile size and load shedding ask for
+	// visibility leaves the decoder alone, undoing skipped frames needs a reopen and a new gop, a shown tile must not wait for one
+	std::string skip_loop_filter = "default";
+	if (DecodeQuality::Low == quality || shed >= ShedLevel::LowFrameRate) {
+		skip_loop_filter = "all";
+	}
+	else if (DecodeQuality::Reduced == quality) {
+		skip_loop_filter = "nonref";
+	}
+
+	std::string skip_frame = "default";
+	if (shed >= ShedLevel::KeyframesOnly) {
+		skip_frame = "nonkey";
+	}
+	else if (DecodeQuality::Low == quality || ShedLevel::LowFrameRate == shed) {
+		skip_frame = "nonref";
+	}
+
+	bool cheap = quality != DecodeQuality::Full || shed != ShedLevel::Off;
+	// a hidden tile only scales cheaply, that switches back on its next frame
+	bool cheap_scalers = cheap || !visible;
+
+	// lavc reads its options when the decoder opens, and reopening blanks the tile until the next key frame
+	// so a change waits until it settled, a resize or a governor step that is undone soon costs nothing
+	if (skip_loop_filter == m_applied_skip_loop_filter && skip_frame == m_applied_skip_frame && cheap == m_applied_fast) {
+		m_decoder_options_pending = false;
+	}
+	else if (!m_decoder_options_pending || skip_loop_filter != m_pending_skip_loop_filter || skip_frame != m_pending_skip_frame || cheap != m_pending_fast) {
+		m_pending_skip_loop_filter = skip_loop_filter;
+		m_pending_skip_frame = skip_frame;
+		m_pending_fast = cheap;
+		m_pending_since = std::chrono::steady_clock::now();
+		m_decoder_options_pending = true;
+	}
+
+	// async, the gui thread and the governor must not wait for the core, scalers apply on the next frame
+	if (cheap_scalers) {
+		set_property_async("scale", std::string("bilinear"));
+		set_property_async("dscale", std::string("bilinear"));
+	}
+	else {
+		if (!m_default_scale.empty()) {
+			set_property_async("scale", m_default_scale);
+		}
+		if (!m_default_dscale.empty()) {
+			set_property_async("dscale", m_default_dscale);
+		}
+	}
+
+	if (ShedLevel::Paused == shed && previous_shed != ShedLevel::Paused) {
+		set_property_async("pause", true);
+	}
+	else if (ShedLevel::Paused == previous_shed && shed != ShedLevel::Paused) {
+		// discard what was demuxed before pausing, so playback resumes at live edge
+		call_command_async({ "drop-buffers" });
+		set_property_async("pause", false);
+	}
+}
+
+
 //    mpv log level        ->   spdlog log level
 // 70 MPV_LOG_LEVEL_TRACE  -> 0 SPDLOG_LEVEL_TRACE
 // 60 MPV_LOG_LEVEL_DEBUG  -> 1 SPDLOG_LEVEL_DEBUG
@@ -861,13 +1976,20 @@ void MpvWrapper::poll_events(void *ptr)
 	std::ostringstream oss;
 	oss << std::this_thread::get_id() << std::endl;
 	SPDLOG_INFO("[mpv {}] poll_events begin, thread: {}", thiz->m_id, oss.str());
+	Tracer::set_thread_name(fmt::format("mpv {} events", thiz->m_id));
 
-	while (thiz != nullptr && !thiz->m_stopping && thiz->m_mpv_context != nullptr) {
+	// a restart on this thread starts a new event thread for the new handle
+	uint32_t generation = thiz->m_event_generation;
+	while (thiz != nullptr && !thiz->m_stopping && thiz->m_mpv_context != nullptr && generation == thiz->m_event_generation) {
 		mpv_event *event = mpv_wait_event(thiz->m_mpv_context, 16);
-		if (nullptr == event) {
+		thiz->apply_pending_decoder_options();
+		if (nullptr == event || MPV_EVENT_NONE == event->event_id) {
 			continue;
 		}
 
+		// names of mpv_event_name are static
+		TraceSpan span("event", mpv_event_name(event->event_id), thiz->m_id);
+
 		switch (event->event_id) {
 		case MPV_EVENT_LOG_MESSAGE:
 		{
@@ -877,19 +1999,97 @@ void MpvWrapper::poll_events(void *ptr)
 			}
 
 			// log message
-			SPDLOG_MPV_MESSAGE(msg, thiz->m_id);
+			uint32_t suppressed = 0;
+			if (thiz->m_log_rate_limiter.acquire(suppressed)) {
+				if (suppressed > 0) {
+					SPDLOG_WARN("[mpv {}] suppressed {} log messages\n", thiz->m_id, suppressed);
+				}
+				SPDLOG_MPV_MESSAGE(msg, thiz->m_id);
+			}
 
 			// restart
-			if (thiz->restart_when_codec_changed(msg)) {
-				SPDLOG_INFO("[mpv {}] restart when the codec was changed\n", thiz->m_id);
+			if (thiz->restart_when_decoder_failed(msg)) {
+				SPDLOG_INFO("[mpv {}] reload when the decoder failed\n", thiz->m_id);
+				continue;
+			}
+		}
+		break;
+		case MPV_EVENT_PROPERTY_CHANGE:
+		{
+			struct mpv_event_property *prop = event->data != nullptr ? (struct mpv_event_property *)event->data : nullptr;
+			if (nullptr == prop) {
 				continue;
 			}
 
-			// extract resolution
-			if (thiz->get_decoded_resolution(msg)) {
-				SPDLOG_INFO("[mpv {}] get video width ({}) and height ({})\n", thiz->m_id, thiz->m_width, thiz->m_height);
+			switch (event->reply_userdata) {
+			case OBSERVED_VIDEO_WIDTH:
+			case OBSERVED_VIDEO_HEIGHT:
+				// extract resolution
+				if (thiz->get_decoded_resolution(event->reply_userdata, prop)) {
+					SPDLOG_INFO("[mpv {}] get video width ({}) and height ({})\n", thiz->m_id, thiz->m_width, thiz->m_height);
+					thiz->update_decode_quality();
+				}
+				break;
+			case OBSERVED_VIDEO_FORMAT:
+				// restart
+				if (thiz->restart_when_codec_changed(prop)) {
+					SPDLOG_INFO("[mpv {}] reload when the codec was changed\n", thiz->m_id);
+				}
+				break;
+			case OBSERVED_FRAME_DROPS:
+			case OBSERVED_DECODER_FRAME_DROPS:
+			case OBSERVED_VO_DELAYED_FRAMES:
+			case OBSERVED_AVSYNC:
+			case OBSERVED_DISPLAY_FPS:
+			case OBSERVED_DECODED_FPS:
+				thiz->update_quality(event->reply_userdata, prop);
+				break;
+			case OBSERVED_SPEED:
+			case OBSERVED_DEMUXER_CACHE_STATE:
+				thiz->update_statistics(event->reply_userdata, prop);
+				break;
+			}
+		}
+		break;
+		case MPV_EVENT_COMMAND_REPLY:
+		{
+			struct mpv_event_command *cmd = event->data != nullptr ? (struct mpv_event_command *)event->data : nullptr;
+			thiz->complete_async_callback(event->reply_userdata, event->error, nullptr == cmd ? nullptr : &cmd->result);
+		}
+		break;
+		case MPV_EVENT_SET_PROPERTY_REPLY:
+		{
+			thiz->complete_async_callback(event->reply_userdata, event->error, nullptr);
+		}
+		break;
+		case MPV_EVENT_PLAYBACK_RESTART:
+		{
+			// the first one of a session follows loading, later ones follow seeks and reloads
+			int64_t expected = -1;
+			int64_t ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - thiz->m_start_time).count();
+			if (thiz->m_first_frame_ms.compare_exchange_strong(expected, ms)) {
+				SPDLOG_INFO("[mpv {}] first frame after {} ms\n", thiz->m_id, ms);
+				TRACE_INSTANT("player", "first_frame", thiz->m_id, ms);
+				thiz->update_probe_cache(ms);
+				if (thiz->m_first_frame_callback) {
+					thiz->m_first_frame_callback();
+				}
+			}
+		}
+		break;
+		case MPV_EVENT_END_FILE:
+		{
+			struct mpv_event_end_file *end_file = event->data != nullptr ? (struct mpv_event_end_file *)event->data : nullptr;
+			if (nullptr == end_file) {
 				continue;
 			}
+
+			thiz->log_end_file(end_file);
+
+			// a cached probe that did not get the source to a frame is not tried again
+			if (MPV_END_FILE_REASON_ERROR == end_file->reason && thiz->m_probe_cached && thiz->m_first_frame_ms < 0) {
+				ProbeCache::instance().invalidate(thiz->m_video_url);
+			}
 		}
 		break;
 		}
@@ -898,3 +2098,12 @@ void MpvWrapper::poll_events(void *ptr)
 	SPDLOG_INFO("[mpv {}] poll_events end, thread: {}", thiz->m_id, oss.str());
 }
 
+
+void MpvWrapper::on_render_update(void *ptr)
+{
+	// runs on an mpv thread, must not call mpv
+	MpvWrapper *thiz = (MpvWrapper *)ptr;
+	if (thiz != nullptr && thiz->m_render_update_callback) {
+		thiz->m_render_update_callback();
+	}
+}
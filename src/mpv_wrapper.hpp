@@ -2,17 +2,132 @@
 
 // c++
 #include <chrono>
+#include <functional>
+#include <future>
 #include <map>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 // project
+#include "async_log_sink.hpp"
+#include "playback_quality.hpp"
+#include "probe_cache.hpp"
 #include "spsc.hpp"
+#include "ts_scanner.hpp"
 
 // libmpv
 struct mpv_handle;
+struct mpv_render_context;
 struct mpv_event_log_message;
+struct mpv_event_property;
+struct mpv_event_end_file;
+struct mpv_node;
 
 
+// mpv defaults of the demuxer cache limits
+#define MPV_DEMUXER_MAX_BYTES (150 * 1024 * 1024)
+#define MPV_DEMUXER_MAX_BACK_BYTES (50 * 1024 * 1024)
+
+// how long cheaper decode options must stay asked for before the decoder opens again with them
+#define DECODER_LOWER_SETTLE_MS 2000
+// the same for dearer ones, longer, so a tile swinging across a quality step does not blank twice
+#define DECODER_RAISE_SETTLE_MS 10000
+
+
+
+// completion of an async request, code is an mpv_error, result is only set for commands
+typedef std::function<void(int code, struct mpv_node *result)> AsyncReplyCallback;
+
+
+
+// how a player puts video on screen
+enum class RenderMode : uint8_t {
+	// vo draws into its own native container window (wid)
+	Window = 0,
+	// vo=libmpv, the app renders frames into memory with the software render api
+	Software = 1,
+};
+
+
+// decode cost level, higher is cheaper
+enum class DecodeQuality : uint8_t {
+	// mpv defaults
+	Full = 0,
+	// skip loop filter on non-reference frames, fast decoding, bilinear scaling
+	Reduced = 1,
+	// also skip loop filter everywhere and drop non-reference frames
+	Low = 2,
+};
+
+
+// load shedding level, higher sheds more
+enum class ShedLevel : uint8_t {
+	// decode as the quality level says
+	Off = 0,
+	// skip loop filter and non-reference frames
+	LowFrameRate = 1,
+	// decode key frames only
+	KeyframesOnly = 2,
+	// stop decoding, discard input
+	Paused = 3,
+};
+
+
+// counters of one player
+struct PlayerStatistics {
+	// decoded frames per second
+	double fps;
+	// frames dropped by vo
+	int64_t frame_drops;
+	// frames dropped by decoder
+	int64_t decoder_frame_drops;
+	// bytes written to spsc
+	uint64_t input_bytes;
+	// bytes read from spsc by the demuxer
+	uint64_t output_bytes;
+	// spsc size and bytes waiting in it
+	uint32_t buffer_size;
+	uint32_t buffer_fill;
+	// playback speed
+	double speed;
+	// reloads and restarts after codec changes or decoder failures
+	uint64_t restarts;
+	// times the writer waited for space in spsc
+	uint64_t write_stalls;
+	// times the reader found spsc empty
+	uint64_t read_stalls;
+	// bytes per second written to spsc, 0 for network sources
+	uint32_t input_bitrate;
+	// bytes held by the demuxer cache
+	int64_t demuxer_cache_bytes;
+};
+
+
+// memory a player may hold, 0 keeps the default
+struct PlayerMemoryLimits {
+	// spsc size, taken on next start
+	uint32_t buffer_size;
+	// mpv demuxer-max-bytes
+	int64_t demuxer_max_bytes;
+	// mpv demuxer-max-back-bytes
+	int64_t demuxer_max_back_bytes;
+};
+
+
+// pixels of a raw screenshot, bgr0, owned by mpv and only valid inside the callback
+struct FrameView {
+	int width;
+	int height;
+	int stride;
+	const uint8_t *pixels;
+};
+
+
+// completion of a raw screenshot, runs once on event thread or on failure
+typedef std::function<void(bool ok, const FrameView &view)> ScreenshotCallback;
+
 
 class MpvWrapper {
 public:
@@ -24,7 +139,7 @@ public:
 		int64_t container_wid, std::string video_url = "",
 		std::string profile = "low-latency", std::string vo = "gpu",
 		std::string hwdec = "auto", std::string gpu_api = "auto",
-		std::string gpu_context = "auto", std::string log_level = "v"
+		std::string gpu_context = "auto", std::string log_level = "warn"
 	);
 	// stop player
 	void stop();
@@ -35,12 +150,18 @@ public:
 	// validate spsc
 	bool is_buffer_null();
 
-	// write av stream to spsc
-	bool write(const uint8_t *buf, uint32_t length);
+	// id of current session, changes on every start except restarts
+	uint32_t get_id();
+
+	// write av stream to spsc, a non-negative id drops data meant for a previous session of a recycled player
+	bool write(const uint8_t *buf, uint32_t length, int64_t id = -1);
 
 	// read av stream from spsc
 	int64_t read(char *buf, uint64_t nbytes);
 
+	// custom stream opened, a reload resumes reading at the last key frame still in spsc
+	void on_stream_open();
+
 	// play
 	bool play();
 	// pause
@@ -49,11 +170,20 @@ public:
 	// play one frame
 	bool step();
 
+	// play without waiting for mpv
+	std::future<bool> play_async();
+	// pause without waiting for mpv
+	std::future<bool> pause_async();
+
 	// is mute
 	bool get_mute_state();
 	// set mute or unmute
 	void set_mute_state(const bool state);
 
+	// decode audio or deselect the audio track (aid=no), switching keeps video playing
+	void set_audio_enabled(bool state);
+	bool is_audio_enabled();
+
 	// get volume
 	int get_volume();
 	// set volume
@@ -62,10 +192,15 @@ public:
 	// get video resolution
 	bool get_resolution(int64_t &width, int64_t &height);
 
+	// get video codec
+	std::string get_video_codec();
+
 	// get speed
 	double get_speed();
 	// set speed
 	bool set_speed(double v);
+	// set speed without waiting for mpv
+	std::future<bool> set_speed_async(double v);
 
 	// get bitrate
 	int get_bitrate();
@@ -73,8 +208,63 @@ public:
 	// get fps
 	int get_fps();
 
+	// sample counters, all observed on the event thread, never waits for the core
+	void get_statistics(PlayerStatistics &stats);
+	// drops, a/v sync and display rate over the last DEFAULT_QUALITY_WINDOW_SECONDS, kept across restarts
+	void get_quality(PlaybackQuality &quality);
+
+	// spsc size is taken on next start, demuxer cache limits at once
+	void set_memory_limits(const PlayerMemoryLimits &limits);
+	void get_memory_limits(PlayerMemoryLimits &limits);
+	// bytes held by spsc
+	uint32_t get_buffer_size();
+
+	// set vd-lavc-threads, 0 means mpv default, a running decoder takes it on its next open
+	void set_decoder_threads(int threads);
+
+	// enable or disable choosing decode quality from tile size
+	void set_quality_governor(bool state);
+	// size of the container on screen
+	void set_tile_size(int width, int height);
+	// current decode quality
+	DecodeQuality get_decode_quality();
+
+	// shed load on an overloaded host
+	void set_shed_level(ShedLevel level);
+	ShedLevel get_shed_level();
+
+	// allow playing faster than real time to catch up
+	void set_speedup_allowed(bool state);
+
+	// hidden tiles keep decoding as they were and only scale cheaply, so a shown tile has its next frame at once
+	void set_visible(bool state);
+	bool is_visible();
+
+	// show/hide container window
+	void set_container_window_visible(bool state);
+
+	// takes effect on next start
+	void set_render_mode(RenderMode mode);
+	// the caller writes video_url through spsc even though it is not a local file, takes effect on next start
+	void set_fed_input(bool state);
+	// called on an mpv thread when a new frame can be rendered, must not call mpv
+	void set_render_update_callback(std::function<void()> callback);
+
+	// called on event thread once per start when the first video frame is out, set it before start
+	void set_first_frame_callback(std::function<void()> callback);
+	// milliseconds from start to the first video frame, -1 until it is out
+	int64_t get_first_frame_ms();
+	// software mode: render current frame as bgr0 into pixels if it is newer than frame_serial or force is set
+	// frame_serial is kept by the caller per view, so several views of one player each get every frame
+	bool render(int width, int height, void *pixels, size_t stride, uint64_t &frame_serial, bool force = false);
+
 	// take screenshot from video
 	bool screenshot(std::string &path);
+	// take screenshot of the decoded video into memory without waiting for mpv
+	bool screenshot_raw_async(ScreenshotCallback callback);
+
+	// limit mpv log lines per player per second, 0 means unlimited
+	static void set_log_rate_limit(uint32_t lines_per_second);
 
 
 protected:
@@ -87,12 +277,22 @@ protected:
 	// wrap mpv_stream_cb_add_ro to register custom stream protocol
 	bool register_stream_callbacks();
 
+	// wrap mpv_render_context_create to render with the software api
+	bool create_render_context();
+
 	// wrap mpv_request_log_messages to set log level
 	bool set_log_level(std::string min_level);
 
+	// run call on the handle under the handle lock, MPV_ERROR_UNINITIALIZED when there is none
+	// the governor, stats and gui threads reach the handle while restart may destroy it on the event thread
+	int with_handle(std::function<int(mpv_handle *)> call);
+
 	// wrap mpv_command to call mpv command
 	bool call_command(std::vector<std::string> args);
 
+	// wrap mpv_command_async to call mpv command, callback runs once on event thread or on failure
+	bool call_command_async(std::vector<std::string> args, AsyncReplyCallback callback = nullptr);
+
 	// wrap mpv_set_option to set mpv option
 	bool set_option(std::string key, bool value);
 	bool set_option(std::string key, int64_t value);
@@ -111,14 +311,50 @@ protected:
 	bool set_property(std::string key, double value);
 	bool set_property(std::string key, std::string value);
 
-	// show/hide container window
-	void set_container_window_visible(bool state);
+	// wrap mpv_set_property_async to set mpv properity, callback runs once on event thread or on failure
+	bool set_property_async(std::string key, bool value, AsyncReplyCallback callback = nullptr);
+	bool set_property_async(std::string key, int64_t value, AsyncReplyCallback callback = nullptr);
+	bool set_property_async(std::string key, double value, AsyncReplyCallback callback = nullptr);
+	bool set_property_async(std::string key, std::string value, AsyncReplyCallback callback = nullptr);
+
+	// remember callback and return its reply_userdata
+	uint64_t add_async_callback(AsyncReplyCallback callback);
+	// run and forget callback of a reply
+	void complete_async_callback(uint64_t id, int code, struct mpv_node *result);
+	// fail all callbacks whose replies will never come
+	void cancel_async_callbacks();
+
+	// wrap mpv_observe_property to receive property changes as events
+	bool observe_property(uint64_t id, std::string key, int format);
+
+	// observe the properties that carry stream state
+	bool observe_properties();
+
+	// reopen the stream on the same handle, decoder and vo are recreated while spsc is kept
+	bool reload_in_place();
+
+	// destroy and recreate the handle
+	void restart();
 
 	// restart when the codec was changed
-	bool restart_when_codec_changed(struct mpv_event_log_message *msg);
+	bool restart_when_codec_changed(struct mpv_event_property *prop);
+
+	// restart when the decoder reports an unsupported bitstream
+	bool restart_when_decoder_failed(struct mpv_event_log_message *msg);
 
 	// get decoded resolution
-	bool get_decoded_resolution(struct mpv_event_log_message *msg);
+	bool get_decoded_resolution(uint64_t id, struct mpv_event_property *prop);
+
+	// record an observed playback counter in the quality window
+	void update_quality(uint64_t id, struct mpv_event_property *prop);
+	// keep observed speed and demuxer cache size for get_statistics
+	void update_statistics(uint64_t id, struct mpv_event_property *prop);
+
+	// log why playback ended
+	void log_end_file(struct mpv_event_end_file *end_file);
+
+	// count time to first frame and remember what the open found for later opens of the source
+	void update_probe_cache(int64_t first_frame_ms);
 
 	// estimate bitrate
 	void estimate_bitrate(uint32_t length);
@@ -126,21 +362,70 @@ protected:
 	// fast speed to reduce latency
 	void reduce_latency();
 
+	// pick decode quality from decoded resolution and tile size, then apply it with shed level
+	void update_decode_quality();
+
+	// open the video decoder again, lavc options only take effect then
+	void reopen_decoder();
+	// event thread: open the decoder with pending lavc options that stayed asked for long enough
+	void apply_pending_decoder_options();
+	// set decoder, scaler and pause options of a quality and shed level
+	void apply_decode_settings(DecodeQuality quality, ShedLevel shed, ShedLevel previous_shed, bool visible);
+
 	// poll events
 	static void poll_events(void *ptr);
 
+	// render update callback of mpv
+	static void on_render_update(void *ptr);
+
 
 private:
 	// id
 	uint32_t m_id;
 	// auto-incrementing index
 	static std::atomic<uint16_t> s_index;
-	// flag to break infinite loop
-	bool m_stopping;
+	// mpv log lines per player per second
+	static std::atomic<uint32_t> s_log_rate_limit;
+	// limit mpv log lines of this player
+	LogRateLimiter m_log_rate_limiter;
+	// flag to break infinite loop, read by the event thread, the writer and the stream callbacks
+	std::atomic<bool> m_stopping;
 	// is restarting
 	std::atomic<bool> m_is_restarting;
+	// a reload waits for the custom stream to be opened again
+	std::atomic<bool> m_reload_pending;
+	// changes on every start, an event thread left behind by a restart exits when it differs
+	std::atomic<uint32_t> m_event_generation;
 	// mpv handle ctx
 	mpv_handle *m_mpv_context;
+	// guard the handle between its destruction in stop and calls from other threads
+	std::mutex m_handle_mutex;
+	// how video is put on screen
+	RenderMode m_render_mode;
+	// software render context
+	mpv_render_context *m_render_context;
+	// guard render context between gui thread rendering and restarts on event thread
+	std::mutex m_render_mutex;
+	// frames the render context announced, guarded by render lock
+	uint64_t m_frame_serial;
+	// tell the compositor a frame is ready
+	std::function<void()> m_render_update_callback;
+	// tell the manager a standby player is ready
+	std::function<void()> m_first_frame_callback;
+	// start of the session, restarts excluded
+	std::chrono::steady_clock::time_point m_start_time;
+	// milliseconds from start to the first video frame, -1 until it is out
+	std::atomic<int64_t> m_first_frame_ms;
+	// the session opened with a cached probe
+	bool m_probe_cached;
+	// that probe, the first frame checks its video against what the open found
+	ProbeResult m_cached_probe;
+	// reply_userdata of next async request
+	std::atomic<uint64_t> m_async_request_id;
+	// pending async requests
+	std::map<uint64_t, AsyncReplyCallback> m_async_callbacks;
+	// guard pending async requests
+	std::mutex m_async_callbacks_mutex;
 	// event thread
 	std::thread *m_event_thread;
 	// input size in one second
@@ -157,10 +442,38 @@ private:
 	uint32_t m_width;
 	// video height
 	uint32_t m_height;
+	// bytes written to spsc
+	std::atomic<uint64_t> m_input_bytes;
+	// bytes read from spsc
+	std::atomic<uint64_t> m_output_bytes;
+	// reloads and restarts
+	std::atomic<uint64_t> m_restarts;
+	// times the writer waited for space in spsc
+	std::atomic<uint64_t> m_write_stalls;
+	// times the reader found spsc empty
+	std::atomic<uint64_t> m_read_stalls;
+	// latest observed frame-drop-count and decoder-frame-drop-count of the current handle
+	std::atomic<int64_t> m_frame_drops;
+	std::atomic<int64_t> m_decoder_frame_drops;
+	// latest observed estimated-vf-fps
+	std::atomic<double> m_decoded_fps;
+	// latest observed speed and total-bytes of demuxer-cache-state
+	std::atomic<double> m_observed_speed;
+	std::atomic<int64_t> m_demuxer_cache_bytes;
+	// rolling playback quality of this tile
+	PlaybackQualityWindow m_quality_window;
+	// video codec
+	std::string m_video_codec;
+	// guard video codec between event thread and callers
+	std::mutex m_video_codec_mutex;
 	// player's parent window id
 	int64_t m_container_wid;
 	// video to play
 	std::string m_video_url;
+	// video is fed through spsc by the custom stream protocol
+	bool m_stream_input;
+	// network video ingested by the caller, fed like a local file
+	bool m_fed_input;
 	// mpv profile option
 	std::string m_profile;
 	// mpv vo option
@@ -173,9 +486,53 @@ private:
 	std::string m_gpu_context;
 	// mpv log level
 	std::string m_log_level;
+	// mpv vd-lavc-threads option
+	std::atomic<int> m_decoder_threads;
+	// choose decode quality from tile size
+	std::atomic<bool> m_quality_governor;
+	// container width on screen
+	int m_tile_width;
+	// container height on screen
+	int m_tile_height;
+	// applied decode quality
+	std::atomic<DecodeQuality> m_decode_quality;
+	// requested shed level
+	std::atomic<ShedLevel> m_shed_level;
+	// applied shed level
+	ShedLevel m_applied_shed_level;
+	// requested visibility
+	std::atomic<bool> m_visible;
+	// applied visibility
+	bool m_applied_visible;
+	// lavc options the decoder was last opened with
+	std::string m_applied_skip_loop_filter;
+	std::string m_applied_skip_frame;
+	bool m_applied_fast;
+	// lavc options asked for since m_pending_since, the event thread opens the decoder with them once they settled
+	std::atomic<bool> m_decoder_options_pending;
+	std::string m_pending_skip_loop_filter;
+	std::string m_pending_skip_frame;
+	bool m_pending_fast;
+	std::chrono::steady_clock::time_point m_pending_since;
+	// allow playing faster than real time
+	std::atomic<bool> m_speedup_allowed;
+	// audio track selected, taken by start and switched at runtime
+	std::atomic<bool> m_audio_enabled;
+	// scaler options of the profile, read by start
+	std::string m_default_scale;
+	std::string m_default_dscale;
+	// guard tile size and decode quality between gui thread and event thread
+	std::mutex m_decode_quality_mutex;
 	// spsc size
-	uint32_t m_buffer_size;
+	std::atomic<uint32_t> m_buffer_size;
+	// mpv demuxer-max-bytes and demuxer-max-back-bytes, 0 means mpv default
+	std::atomic<int64_t> m_demuxer_max_bytes;
+	std::atomic<int64_t> m_demuxer_max_back_bytes;
+	// keep writer away while spsc is reset by a recycling start
+	std::mutex m_write_mutex;
 	// spsc
 	lock_free_spsc<uint8_t> m_spsc;
+	// key frames in the bytes put to spsc, guarded by write lock
+	TsKeyframeScanner m_ts_scanner;
 };
 
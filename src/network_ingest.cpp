@@ -0,0 +1,276 @@
+// self
+#include "network_ingest.hpp"
+
+// c++
+#include <algorithm>
+#include <chrono>
+
+// qt
+#include <QtCore/QString>
+#include <QtCore/QUrl>
+#include <QtNetwork/QTcpSocket>
+
+// fmt
+#include <fmt/format.h>
+
+// spdlog
+#include <spdlog/spdlog.h>
+
+// project
+#include "trace.hpp"
+#include "ts_scanner.hpp"
+
+
+
+NetworkIngest::NetworkIngest(std::string url, uint32_t buffer_size)
+	: m_url(url)
+	, m_buffer_size(buffer_size)
+	, m_thread(nullptr)
+	, m_stopping(true)
+	, m_connects(0)
+	, m_received_bytes(0)
+	, m_dropped_bytes(0)
+{
+}
+
+
+NetworkIngest::~NetworkIngest()
+{
+	stop();
+}
+
+
+bool NetworkIngest::is_supported(const std::string &url)
+{
+	QUrl qurl(QString::fromStdString(url));
+	if (!qurl.isValid() || qurl.host().isEmpty()) {
+		return false;
+	}
+	QString scheme = qurl.scheme();
+	// raw tcp has no default port
+	return scheme == "http" || (scheme == "tcp" && qurl.port() > 0);
+}
+
+
+bool NetworkIngest::start()
+{
+	stop();
+
+	m_spsc.reset(m_buffer_size);
+	if (m_spsc.is_buffer_null()) {
+		return false;
+	}
+
+	m_stopping = false;
+	m_thread = new std::thread(receive, this);
+	SPDLOG_INFO("[ingest] {} started\n", m_url);
+
+	return true;
+}
+
+
+void NetworkIngest::stop()
+{
+	if (nullptr == m_thread) {
+		return;
+	}
+
+	m_stopping = true;
+	if (m_thread->joinable()) {
+		m_thread->join();
+	}
+	delete m_thread;
+	m_thread = nullptr;
+
+	m_spsc.reset(0);
+	SPDLOG_INFO(
+		"[ingest] {} stopped, {} connects, {:.1f} MB received, {:.1f} MB dropped\n",
+		m_url, m_connects.load(), m_received_bytes.load() / 1024.0 / 1024.0, m_dropped_bytes.load() / 1024.0 / 1024.0
+	);
+}
+
+
+QByteArray NetworkIngest::read(uint32_t max_length)
+{
+	QByteArray buf;
+	if (nullptr == m_thread) {
+		return buf;
+	}
+
+	// an empty get would log a warning every round a live source is idle
+	uint32_t length = std::min(max_length, m_spsc.available_data_size());
+	if (0 == length) {
+		return buf;
+	}
+
+	buf.resize((int)length);
+	length = m_spsc.get((uint8_t *)buf.data(), length);
+	buf.resize((int)length);
+
+	return buf;
+}
+
+
+void NetworkIngest::get_statistics(IngestStatistics &stats)
+{
+	stats.sources++;
+	stats.connects += m_connects.load();
+	stats.received_bytes += m_received_bytes.load();
+	stats.dropped_bytes += m_dropped_bytes.load();
+}
+
+
+void NetworkIngest::receive(void *ptr)
+{
+	if (nullptr == ptr) {
+		return;
+	}
+
+	NetworkIngest *thiz = (NetworkIngest *)ptr;
+	Tracer::set_thread_name("ingest");
+
+	// blocking socket api, this thread has no event loop
+	QTcpSocket socket;
+	bool connected = false;
+	while (!thiz->m_stopping) {
+		if (!connected) {
+			connected = thiz->open_source(socket);
+			if (!connected) {
+				socket.abort();
+				for (int ms = 0; !thiz->m_stopping && ms < INGEST_RECONNECT_INTERVAL_MS; ms += INGEST_WAIT_MS) {
+					std::this_thread::sleep_for(std::chrono::milliseconds(INGEST_WAIT_MS));
+				}
+				continue;
+			}
+			thiz->m_connects++;
+			SPDLOG_INFO("[ingest] {} connected, connect {}\n", thiz->m_url, thiz->m_connects.load());
+		}
+
+		if (socket.bytesAvailable() > 0 || socket.waitForReadyRead(INGEST_WAIT_MS)) {
+			QByteArray buf = socket.readAll();
+			thiz->put(buf.constData(), (uint32_t)buf.size());
+			continue;
+		}
+
+		// a wait that timed out leaves the socket connected, a source that went away does not
+		if (socket.state() != QAbstractSocket::ConnectedState) {
+			SPDLOG_WARN("[ingest] {} disconnected, {}\n", thiz->m_url, socket.errorString().toStdString());
+			// the tail of a finite file is no cut packet, it goes as it is
+			thiz->put_ring(thiz->m_partial.constData(), (uint32_t)thiz->m_partial.size());
+			thiz->m_partial.clear();
+			TRACE_INSTANT("ingest", "disconnect", -1, thiz->m_connects.load());
+			socket.abort();
+			connected = false;
+		}
+	}
+
+	socket.abort();
+}
+
+
+bool NetworkIngest::open_source(QTcpSocket &socket)
+{
+	QUrl url(QString::fromStdString(m_url));
+	bool http = url.scheme() == "http";
+
+	socket.abort();
+	m_partial.clear();
+	socket.connectToHost(url.host(), (uint16_t)url.port(http ? 80 : 0));
+	if (!socket.waitForConnected(INGEST_CONNECT_TIMEOUT_MS)) {
+		SPDLOG_ERROR("[ingest] connect {} error, {}\n", m_url, socket.errorString().toStdString());
+		return false;
+	}
+
+	// raw stream, every byte is payload
+	if (!http) {
+		return true;
+	}
+
+	// http/1.0 keeps the body free of chunked transfer encoding
+	std::string target = url.toEncoded(QUrl::RemoveScheme | QUrl::RemoveAuthority | QUrl::RemoveFragment).toStdString();
+	std::string host = url.port() > 0 ? fmt::format("{}:{}", url.host().toStdString(), url.port()) : url.host().toStdString();
+	std::string request = fmt::format(
+		"GET {} HTTP/1.0\r\nHost: {}\r\nUser-Agent: qt-mpv\r\nAccept: */*\r\nConnection: close\r\n\r\n",
+		target.empty() ? "/" : target, host
+	);
+	socket.write(request.c_str(), (int64_t)request.size());
+	if (!socket.waitForBytesWritten(INGEST_CONNECT_TIMEOUT_MS)) {
+		SPDLOG_ERROR("[ingest] request {} error, {}\n", m_url, socket.errorString().toStdString());
+		return false;
+	}
+
+	QByteArray head;
+	int head_end = -1;
+	while (!m_stopping && (head_end = head.indexOf("\r\n\r\n")) < 0) {
+		if (head.size() > INGEST_MAX_HEADER_SIZE) {
+			SPDLOG_ERROR("[ingest] {} response head over {} bytes\n", m_url, INGEST_MAX_HEADER_SIZE);
+			return false;
+		}
+		if (0 == socket.bytesAvailable() && !socket.waitForReadyRead(INGEST_CONNECT_TIMEOUT_MS)) {
+			SPDLOG_ERROR("[ingest] {} no response, {}\n", m_url, socket.errorString().toStdString());
+			return false;
+		}
+		head.append(socket.readAll());
+	}
+	if (head_end < 0) {
+		return false;
+	}
+
+	// status line: HTTP/1.x 200 OK
+	int space = head.indexOf(' ');
+	int status = space > 0 ? head.mid(space + 1, 3).toInt() : 0;
+	if (status < 200 || status >= 300) {
+		SPDLOG_ERROR("[ingest] {} answered {}\n", m_url, head.left(head.indexOf("\r\n")).toStdString());
+		return false;
+	}
+
+	// the body may have come along with the head
+	put(head.constData() + head_end + 4, (uint32_t)(head.size() - head_end - 4));
+
+	return true;
+}
+
+
+void NetworkIngest::put(const char *buf, uint32_t length)
+{
+	if (nullptr == buf || 0 == length) {
+		return;
+	}
+
+	m_received_bytes += length;
+
+	// complete the packet the last read cut
+	if (!m_partial.isEmpty()) {
+		uint32_t missing = std::min(length, (uint32_t)(TS_PACKET_SIZE - m_partial.size()));
+		m_partial.append(buf, (int)missing);
+		buf += missing;
+		length -= missing;
+		if (m_partial.size() < TS_PACKET_SIZE) {
+			return;
+		}
+		put_ring(m_partial.constData(), TS_PACKET_SIZE);
+		m_partial.clear();
+	}
+
+	uint32_t packets_size = length / TS_PACKET_SIZE * TS_PACKET_SIZE;
+	put_ring(buf, packets_size);
+	// the cut packet waits for the rest of it
+	if (packets_size < length) {
+		m_partial.append(buf + packets_size, (int)(length - packets_size));
+	}
+}
+
+
+void NetworkIngest::put_ring(const char *buf, uint32_t length)
+{
+	if (nullptr == buf || 0 == length) {
+		return;
+	}
+
+	// a full ring drops whole packets, the demuxer resyncs on the next one instead of reading a cut one
+	uint32_t space = m_spsc.available_space_size() / TS_PACKET_SIZE * TS_PACKET_SIZE;
+	uint32_t written = m_spsc.put((const uint8_t *)buf, std::min(length, space));
+	if (written < length) {
+		m_dropped_bytes += length - written;
+	}
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+// c
+#include <stdint.h>
+
+// c++
+#include <atomic>
+#include <string>
+#include <thread>
+
+// qt
+#include <QtCore/QByteArray>
+
+// project
+#include "spsc.hpp"
+
+// qt
+class QTcpSocket;
+
+
+#ifndef DEFAULT_INGEST_BUFFER_SIZE
+#define DEFAULT_INGEST_BUFFER_SIZE (4 * 1024 * 1024)
+#endif // !DEFAULT_INGEST_BUFFER_SIZE
+
+#define INGEST_CONNECT_TIMEOUT_MS 5000
+#define INGEST_RECONNECT_INTERVAL_MS 1000
+// longest the receiver waits on the socket before it looks at the stop flag again
+#define INGEST_WAIT_MS 100
+#define INGEST_MAX_HEADER_SIZE (64 * 1024)
+
+
+
+// upstream traffic of ingests since start
+struct IngestStatistics {
+	// distinct sources opened
+	uint64_t sources;
+	// connections made to them, reconnects included
+	uint64_t connects;
+	// stream bytes received, headers excluded
+	uint64_t received_bytes;
+	// bytes the feeder did not take in time
+	uint64_t dropped_bytes;
+};
+
+
+// the one upstream connection of a network source, whose bytes the feeder fans out to every tile playing it
+// http without tls, the body taken as is, and tcp:// raw streams such as mpegts over tcp
+// a source that goes away is reconnected until stop, a finite http file plays again from its start
+class NetworkIngest {
+public:
+	NetworkIngest(std::string url, uint32_t buffer_size = DEFAULT_INGEST_BUFFER_SIZE);
+	~NetworkIngest();
+
+	// url is a scheme the ingest speaks, others stay with the players
+	static bool is_supported(const std::string &url);
+
+	// connect from a background thread, returns at once
+	bool start();
+	void stop();
+
+	// up to max_length bytes received since the last read, empty when none arrived meanwhile, never waits
+	QByteArray read(uint32_t max_length);
+
+	// add the counters of this source to stats
+	void get_statistics(IngestStatistics &stats);
+
+
+private:
+	static void receive(void *ptr);
+	// connect, send the request and skip the response head, leftover body bytes go to the ring
+	bool open_source(QTcpSocket &socket);
+	// hand bytes to the feeder in whole 188 byte packets, dropping the packets that do not fit, a live source does not wait
+	void put(const char *buf, uint32_t length);
+	// bytes to the ring, as many whole packets as fit, the rest counts as dropped
+	void put_ring(const char *buf, uint32_t length);
+
+	std::string m_url;
+	uint32_t m_buffer_size;
+	std::thread *m_thread;
+	std::atomic<bool> m_stopping;
+	// receiver puts, feeder gets
+	lock_free_spsc<uint8_t> m_spsc;
+	// start of a packet the socket cut, receiver thread only
+	QByteArray m_partial;
+	std::atomic<uint64_t> m_connects;
+	std::atomic<uint64_t> m_received_bytes;
+	std::atomic<uint64_t> m_dropped_bytes;
+};
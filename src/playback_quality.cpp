@@ -0,0 +1,163 @@
+// self
+#include "playback_quality.hpp"
+
+// c
+#include <math.h>
+
+// c++
+#include <algorithm>
+
+
+
+PlaybackQualityWindow::PlaybackQualityWindow(uint32_t seconds)
+	: m_buckets(std::max(seconds, (uint32_t)1))
+	, m_epoch(std::chrono::steady_clock::now())
+	, m_frame_drops_total(-1)
+	, m_decoder_frame_drops_total(-1)
+	, m_vo_delayed_frames_total(-1)
+{
+	reset();
+}
+
+
+void PlaybackQualityWindow::reset()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for (auto &bucket : m_buckets) {
+		bucket.second = -1;
+	}
+	m_epoch = std::chrono::steady_clock::now();
+	m_frame_drops_total = -1;
+	m_decoder_frame_drops_total = -1;
+	m_vo_delayed_frames_total = -1;
+}
+
+
+void PlaybackQualityWindow::add_frame_drops(int64_t total)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	current_bucket().frame_drops += increase(m_frame_drops_total, total);
+}
+
+
+void PlaybackQualityWindow::add_decoder_frame_drops(int64_t total)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	current_bucket().decoder_frame_drops += increase(m_decoder_frame_drops_total, total);
+}
+
+
+void PlaybackQualityWindow::add_vo_delayed_frames(int64_t total)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	current_bucket().vo_delayed_frames += increase(m_vo_delayed_frames_total, total);
+}
+
+
+void PlaybackQualityWindow::add_avsync(double seconds)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	Bucket &bucket = current_bucket();
+	double value = fabs(seconds);
+	bucket.avsync_abs_sum += value;
+	bucket.avsync_abs_max = std::max(bucket.avsync_abs_max, value);
+	bucket.avsync_samples++;
+}
+
+
+void PlaybackQualityWindow::add_display_fps(double fps)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	Bucket &bucket = current_bucket();
+	bucket.display_fps_sum += fps;
+	bucket.display_fps_min = 0 == bucket.display_fps_samples ? fps : std::min(bucket.display_fps_min, fps);
+	bucket.display_fps_samples++;
+}
+
+
+void PlaybackQualityWindow::add_decoded_fps(double fps)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	Bucket &bucket = current_bucket();
+	bucket.decoded_fps_sum += fps;
+	bucket.decoded_fps_min = 0 == bucket.decoded_fps_samples ? fps : std::min(bucket.decoded_fps_min, fps);
+	bucket.decoded_fps_samples++;
+}
+
+
+void PlaybackQualityWindow::summarize(PlaybackQuality &quality)
+{
+	quality = PlaybackQuality();
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	int64_t now = now_second();
+	int64_t oldest = now;
+	uint32_t avsync_samples = 0;
+	uint32_t display_fps_samples = 0;
+	uint32_t decoded_fps_samples = 0;
+	for (auto &bucket : m_buckets) {
+		if (bucket.second < 0 || bucket.second <= now - (int64_t)m_buckets.size()) {
+			continue;
+		}
+		oldest = std::min(oldest, bucket.second);
+
+		quality.frame_drops += bucket.frame_drops;
+		quality.decoder_frame_drops += bucket.decoder_frame_drops;
+		quality.vo_delayed_frames += bucket.vo_delayed_frames;
+
+		quality.avsync_mean_abs += bucket.avsync_abs_sum;
+		quality.avsync_max_abs = std::max(quality.avsync_max_abs, bucket.avsync_abs_max);
+		avsync_samples += bucket.avsync_samples;
+
+		if (bucket.display_fps_samples > 0) {
+			quality.display_fps_mean += bucket.display_fps_sum;
+			quality.display_fps_min = 0 == display_fps_samples ? bucket.display_fps_min : std::min(quality.display_fps_min, bucket.display_fps_min);
+			display_fps_samples += bucket.display_fps_samples;
+		}
+
+		if (bucket.decoded_fps_samples > 0) {
+			quality.decoded_fps_mean += bucket.decoded_fps_sum;
+			quality.decoded_fps_min = 0 == decoded_fps_samples ? bucket.decoded_fps_min : std::min(quality.decoded_fps_min, bucket.decoded_fps_min);
+			decoded_fps_samples += bucket.decoded_fps_samples;
+		}
+	}
+
+	quality.seconds = (uint32_t)(now - oldest + 1);
+	quality.avsync_mean_abs = avsync_samples > 0 ? quality.avsync_mean_abs / avsync_samples : 0.0;
+	quality.display_fps_mean = display_fps_samples > 0 ? quality.display_fps_mean / display_fps_samples : 0.0;
+	quality.decoded_fps_mean = decoded_fps_samples > 0 ? quality.decoded_fps_mean / decoded_fps_samples : 0.0;
+}
+
+
+PlaybackQualityWindow::Bucket &PlaybackQualityWindow::current_bucket()
+{
+	int64_t second = now_second();
+	Bucket &bucket = m_buckets[second % m_buckets.size()];
+	if (bucket.second != second) {
+		bucket = Bucket();
+		bucket.second = second;
+	}
+	return bucket;
+}
+
+
+int64_t PlaybackQualityWindow::increase(int64_t &last_total, int64_t total)
+{
+	int64_t value = 0;
+	if (last_total >= 0 && total >= last_total) {
+		value = total - last_total;
+	}
+	else if (last_total >= 0) {
+		// counted from 0 again, everything reported is new
+		value = total;
+	}
+	last_total = total;
+	return value;
+}
+
+
+int64_t PlaybackQualityWindow::now_second()
+{
+	return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - m_epoch).count();
+}
+
@@ -0,0 +1,99 @@
+#pragma once
+
+// c
+#include <stdint.h>
+
+// c++
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+
+#ifndef DEFAULT_QUALITY_WINDOW_SECONDS
+#define DEFAULT_QUALITY_WINDOW_SECONDS 60
+#endif // !DEFAULT_QUALITY_WINDOW_SECONDS
+
+
+
+// playback quality of one tile over the rolling window
+struct PlaybackQuality {
+	// seconds covered, shorter than the window right after start
+	uint32_t seconds;
+	// frames dropped by vo
+	int64_t frame_drops;
+	// frames dropped by decoder
+	int64_t decoder_frame_drops;
+	// frames shown late by vo
+	int64_t vo_delayed_frames;
+	// audio minus video position, in seconds
+	double avsync_mean_abs;
+	double avsync_max_abs;
+	// frames per second the vo shows
+	double display_fps_mean;
+	double display_fps_min;
+	// frames per second the decoder outputs
+	double decoded_fps_mean;
+	double decoded_fps_min;
+};
+
+
+// per second buckets of observed playback counters, written by the event thread and read by anyone
+class PlaybackQualityWindow {
+public:
+	PlaybackQualityWindow(uint32_t seconds = DEFAULT_QUALITY_WINDOW_SECONDS);
+
+	// forget all buckets and counter totals, a new handle counts from 0
+	void reset();
+
+	// cumulative counters as mpv reports them, the window keeps the increase
+	void add_frame_drops(int64_t total);
+	void add_decoder_frame_drops(int64_t total);
+	void add_vo_delayed_frames(int64_t total);
+
+	// instantaneous values
+	void add_avsync(double seconds);
+	void add_display_fps(double fps);
+	void add_decoded_fps(double fps);
+
+	// aggregate buckets still inside the window
+	void summarize(PlaybackQuality &quality);
+
+
+private:
+	// one second of samples
+	struct Bucket {
+		// seconds since window epoch, -1 is empty
+		int64_t second;
+		int64_t frame_drops;
+		int64_t decoder_frame_drops;
+		int64_t vo_delayed_frames;
+		double avsync_abs_sum;
+		double avsync_abs_max;
+		uint32_t avsync_samples;
+		double display_fps_sum;
+		double display_fps_min;
+		uint32_t display_fps_samples;
+		double decoded_fps_sum;
+		double decoded_fps_min;
+		uint32_t decoded_fps_samples;
+	};
+
+	// bucket of now, emptied when it is reused for a new second, under lock
+	Bucket &current_bucket();
+
+	// increase of a cumulative counter, a smaller total means mpv started over
+	static int64_t increase(int64_t &last_total, int64_t total);
+
+	// seconds since window epoch
+	int64_t now_second();
+
+	std::vector<Bucket> m_buckets;
+	std::chrono::steady_clock::time_point m_epoch;
+	// last reported totals, -1 before the first report
+	int64_t m_frame_drops_total;
+	int64_t m_decoder_frame_drops_total;
+	int64_t m_vo_delayed_frames_total;
+	// guard buckets and totals between event thread and readers
+	std::mutex m_mutex;
+};
+
@@ -0,0 +1,94 @@
+// self
+#include "probe_cache.hpp"
+
+// spdlog
+#include <spdlog/spdlog.h>
+
+
+
+ProbeCache &ProbeCache::instance()
+{
+	static ProbeCache cache;
+	return cache;
+}
+
+
+ProbeCache::ProbeCache()
+	: m_enabled(true)
+	, m_stats()
+{
+}
+
+
+void ProbeCache::set_enabled(bool state)
+{
+	m_enabled = state;
+}
+
+
+bool ProbeCache::is_enabled()
+{
+	return m_enabled;
+}
+
+
+bool ProbeCache::lookup(const std::string &source, ProbeResult &result)
+{
+	if (!m_enabled) {
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto iter = m_source_to_result.find(source);
+	if (iter == m_source_to_result.end()) {
+		return false;
+	}
+	result = iter->second;
+	return true;
+}
+
+
+void ProbeCache::store(const std::string &source, const ProbeResult &result)
+{
+	if (!m_enabled || source.empty() || result.format.empty()) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto iter = m_source_to_result.find(source);
+	if (iter == m_source_to_result.end() || iter->second.format != result.format) {
+		SPDLOG_INFO("[probe cache] {}: format {}, video {} {}x{}\n", source, result.format, result.video_codec, result.width, result.height);
+	}
+	m_source_to_result[source] = result;
+}
+
+
+void ProbeCache::invalidate(const std::string &source)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_source_to_result.erase(source) > 0) {
+		m_stats.invalidations++;
+		SPDLOG_WARN("[probe cache] {} dropped, the cached probe failed an open\n", source);
+	}
+}
+
+
+void ProbeCache::record_first_frame(bool cached, int64_t ms)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (cached) {
+		m_stats.warm_opens++;
+		m_stats.warm_first_frame_ms += ms;
+	}
+	else {
+		m_stats.cold_opens++;
+		m_stats.cold_first_frame_ms += ms;
+	}
+}
+
+
+void ProbeCache::get_statistics(ProbeCacheStatistics &stats)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	stats = m_stats;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+// c
+#include <stdint.h>
+
+// c++
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+
+
+// lavf probe of a source opened before, its format is known and its codecs show up early
+#define PROBE_CACHE_PROBESIZE (64 * 1024)
+#define PROBE_CACHE_ANALYZEDURATION 0.5
+
+
+
+// what the first open of a source found
+struct ProbeResult {
+	// lavf demuxer name, mpv file-format
+	std::string format;
+	// video at the first frame, an open using this result that finds another drops it
+	std::string video_codec;
+	int64_t width;
+	int64_t height;
+};
+
+
+// time to first frame of opens with a full probe and with a cached one
+struct ProbeCacheStatistics {
+	// opens that reached a first frame, and the sum of their times to it
+	uint64_t cold_opens;
+	int64_t cold_first_frame_ms;
+	uint64_t warm_opens;
+	int64_t warm_first_frame_ms;
+	// cached results that failed an open and were dropped
+	uint64_t invalidations;
+};
+
+
+// process-wide probe results by source, so only the first of many players of a source pays for a full lavf probe
+class ProbeCache {
+public:
+	static ProbeCache &instance();
+
+	// off makes every open probe in full
+	void set_enabled(bool state);
+	bool is_enabled();
+
+	// result of an earlier open of source
+	bool lookup(const std::string &source, ProbeResult &result);
+	// remember what an open of source found
+	void store(const std::string &source, const ProbeResult &result);
+	// the cached result of source failed an open, probe in full next time
+	void invalidate(const std::string &source);
+
+	// an open reached its first frame after ms, cached tells whether it used a cached result
+	void record_first_frame(bool cached, int64_t ms);
+	// sample counters
+	void get_statistics(ProbeCacheStatistics &stats);
+
+
+protected:
+	ProbeCache();
+
+	ProbeCache(const ProbeCache &) = delete;
+	ProbeCache &operator=(const ProbeCache &) = delete;
+
+
+private:
+	std::atomic<bool> m_enabled;
+	std::map<std::string, ProbeResult> m_source_to_result;
+	// counters
+	ProbeCacheStatistics m_stats;
+	// guard results and counters
+	std::mutex m_mutex;
+};
@@ -0,0 +1,170 @@
+// self
+#include "render_compositor.hpp"
+
+// c++
+#include <algorithm>
+#include <set>
+
+// qt
+#include <QtCore/QTimerEvent>
+#include <QtGui/QGuiApplication>
+#include <QtGui/QPainter>
+#include <QtGui/QPaintEvent>
+#include <QtGui/QResizeEvent>
+#include <QtGui/QScreen>
+
+// project
+#include "mpv_manager.hpp"
+
+
+#define DEFAULT_REFRESH_RATE 60.0
+#define SCRATCH_SIZE 16
+
+
+
+RenderCompositor::RenderCompositor(MpvManager *mpv_manager, QWidget *parent)
+	: QWidget(parent)
+	, m_mpv_manager(mpv_manager)
+	, m_update_pending(false)
+	, m_force_render(true)
+	, m_refresh_timer_id(0)
+	, m_rows(1)
+	, m_columns(1)
+	, m_scratch(SCRATCH_SIZE * SCRATCH_SIZE * 4, 0)
+{
+	// every pixel comes from the frame buffer
+	setAttribute(Qt::WA_OpaquePaintEvent);
+	setAttribute(Qt::WA_NoSystemBackground);
+
+	// one compositing pass per display refresh at most
+	double refresh_rate = DEFAULT_REFRESH_RATE;
+	if (QGuiApplication::primaryScreen() != nullptr && QGuiApplication::primaryScreen()->refreshRate() > 0.0) {
+		refresh_rate = QGuiApplication::primaryScreen()->refreshRate();
+	}
+	m_refresh_timer_id = startTimer((int)(1000.0 / refresh_rate), Qt::PreciseTimer);
+}
+
+
+RenderCompositor::~RenderCompositor()
+{
+	if (m_refresh_timer_id != 0) {
+		killTimer(m_refresh_timer_id);
+	}
+	m_refresh_timer_id = 0;
+}
+
+
+void RenderCompositor::set_grid(int rows, int columns)
+{
+	m_rows = std::max(1, rows);
+	m_columns = std::max(1, columns);
+	m_force_render = true;
+	update();
+}
+
+
+void RenderCompositor::set_tile(int index, TileCell cell)
+{
+	m_index_to_cell[index] = cell;
+
+	QRect rect = get_cell_rect(cell);
+	m_mpv_manager->set_tile_size(index, rect.width(), rect.height());
+
+	m_force_render = true;
+	update();
+}
+
+
+void RenderCompositor::clear_tiles()
+{
+	m_index_to_cell.clear();
+	m_force_render = true;
+	update();
+}
+
+
+bool RenderCompositor::has_tile(int index)
+{
+	return m_index_to_cell.find(index) != m_index_to_cell.end();
+}
+
+
+QRect RenderCompositor::get_cell_rect(TileCell cell)
+{
+	int left = cell.column * width() / m_columns;
+	int top = cell.row * height() / m_rows;
+	int right = (cell.column + cell.column_span) * width() / m_columns;
+	int bottom = (cell.row + cell.row_span) * height() / m_rows;
+	return QRect(left, top, right - left, bottom - top);
+}
+
+
+void RenderCompositor::request_update()
+{
+	m_update_pending = true;
+}
+
+
+void RenderCompositor::paintEvent(QPaintEvent *event)
+{
+	if (m_frame.isNull()) {
+		return;
+	}
+
+	bool force = m_force_render;
+	if (force) {
+		m_frame.fill(Qt::black);
+		m_force_render = false;
+	}
+
+	// each tile renders straight into its rectangle of the shared frame buffer
+	std::set<int> rendered;
+	for (auto iter = m_index_to_cell.begin(); iter != m_index_to_cell.end(); iter++) {
+		QRect rect = get_cell_rect(iter->second).intersected(m_frame.rect());
+		if (rect.isEmpty()) {
+			continue;
+		}
+		uint8_t *pixels = m_frame.bits() + (size_t)rect.y() * m_frame.bytesPerLine() + (size_t)rect.x() * 4;
+		m_mpv_manager->render_tile(iter->first, rect.width(), rect.height(), pixels, (size_t)m_frame.bytesPerLine(), force);
+		rendered.insert(iter->first);
+	}
+
+	// prefetched players are off screen but still hand out frames
+	std::set<int> indexes = m_mpv_manager->get_attached_indexes();
+	for (int index : indexes) {
+		if (rendered.count(index) == 0) {
+			m_mpv_manager->render_tile(index, SCRATCH_SIZE, SCRATCH_SIZE, m_scratch.data(), SCRATCH_SIZE * 4);
+		}
+	}
+
+	QPainter painter(this);
+	painter.drawImage(event->rect(), m_frame, event->rect());
+}
+
+
+void RenderCompositor::resizeEvent(QResizeEvent *event)
+{
+	m_frame = QImage(event->size(), QImage::Format_RGB32);
+	m_force_render = true;
+
+	for (auto iter = m_index_to_cell.begin(); iter != m_index_to_cell.end(); iter++) {
+		QRect rect = get_cell_rect(iter->second);
+		m_mpv_manager->set_tile_size(iter->first, rect.width(), rect.height());
+	}
+
+	QWidget::resizeEvent(event);
+}
+
+
+void RenderCompositor::timerEvent(QTimerEvent *event)
+{
+	if (event->timerId() != m_refresh_timer_id) {
+		QWidget::timerEvent(event);
+		return;
+	}
+
+	// update() is coalesced by qt, so many callbacks between ticks cost one pass
+	if (m_update_pending.exchange(false)) {
+		update();
+	}
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+// c
+#include <stdint.h>
+
+// c++
+#include <atomic>
+#include <map>
+#include <vector>
+
+// qt
+#include <QtCore/QRect>
+#include <QtGui/QImage>
+#include <QtWidgets/QWidget>
+
+// project
+class MpvManager;
+
+
+
+// position of a tile in the grid layout
+struct TileCell {
+	int row;
+	int column;
+	int row_span;
+	int column_span;
+};
+
+
+// one widget showing all software rendered tiles, composited in one shared frame buffer per display refresh
+class RenderCompositor : public QWidget {
+public:
+	RenderCompositor(MpvManager *mpv_manager, QWidget *parent = nullptr);
+	~RenderCompositor();
+
+	// grid the tile cells are placed on
+	void set_grid(int rows, int columns);
+	// put a source on a cell
+	void set_tile(int index, TileCell cell);
+	// take all sources off screen
+	void clear_tiles();
+	// is a source on screen
+	bool has_tile(int index);
+	// where a cell is on the widget
+	QRect get_cell_rect(TileCell cell);
+
+	// a player has a new frame, safe to call from any thread
+	void request_update();
+
+
+protected:
+	// render tiles with new frames into the frame buffer, then draw it once
+	void paintEvent(QPaintEvent *event) override;
+
+	// re-create the frame buffer and tell players their new tile sizes
+	void resizeEvent(QResizeEvent *event) override;
+
+	// refresh tick, repaint when a frame arrived since last tick
+	void timerEvent(QTimerEvent *event) override;
+
+
+private:
+	MpvManager *m_mpv_manager;
+	// set by render update callbacks, cleared by refresh tick
+	std::atomic<bool> m_update_pending;
+	// redraw every tile, not only those with new frames
+	bool m_force_render;
+	int m_refresh_timer_id;
+	int m_rows;
+	int m_columns;
+	// shared frame buffer, reused until the widget is resized
+	QImage m_frame;
+	// players decoding off screen render here, so mpv does not wait for them
+	std::vector<uint8_t> m_scratch;
+	std::map<int, TileCell> m_index_to_cell;
+};
+
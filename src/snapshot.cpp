@@ -0,0 +1,183 @@
+// self
+#include "snapshot.hpp"
+
+// c
+#include <string.h>
+
+// c++
+#include <algorithm>
+
+// qt
+#include <QtCore/QBuffer>
+#include <QtCore/QByteArray>
+#include <QtGui/QImage>
+
+// spdlog
+#include <spdlog/spdlog.h>
+
+// project
+#include "mpv_wrapper.hpp"
+
+// simd
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SNAPSHOT_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+
+
+void copy_frame(const FrameView &view, VideoFrame &frame)
+{
+	frame.width = view.width;
+	frame.height = view.height;
+	frame.stride = view.width * 4;
+	frame.pixels.resize((size_t)frame.stride * frame.height);
+	for (int y = 0; y < view.height; y++) {
+		memcpy(frame.pixels.data() + (size_t)y * frame.stride, view.pixels + (size_t)y * view.stride, frame.stride);
+	}
+}
+
+
+// sum bytes of rows into 32 bit columns
+static void sum_rows(const uint8_t *rows, int stride, int count, int width_bytes, uint32_t *sums)
+{
+	int x = 0;
+#ifdef SNAPSHOT_USE_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	for (; x + 16 <= width_bytes; x += 16) {
+		__m128i sum0 = zero;
+		__m128i sum1 = zero;
+		__m128i sum2 = zero;
+		__m128i sum3 = zero;
+		for (int r = 0; r < count; r++) {
+			__m128i bytes = _mm_loadu_si128((const __m128i *)(rows + (size_t)r * stride + x));
+			__m128i low = _mm_unpacklo_epi8(bytes, zero);
+			__m128i high = _mm_unpackhi_epi8(bytes, zero);
+			sum0 = _mm_add_epi32(sum0, _mm_unpacklo_epi16(low, zero));
+			sum1 = _mm_add_epi32(sum1, _mm_unpackhi_epi16(low, zero));
+			sum2 = _mm_add_epi32(sum2, _mm_unpacklo_epi16(high, zero));
+			sum3 = _mm_add_epi32(sum3, _mm_unpackhi_epi16(high, zero));
+		}
+		_mm_storeu_si128((__m128i *)(sums + x), sum0);
+		_mm_storeu_si128((__m128i *)(sums + x + 4), sum1);
+		_mm_storeu_si128((__m128i *)(sums + x + 8), sum2);
+		_mm_storeu_si128((__m128i *)(sums + x + 12), sum3);
+	}
+#endif // SNAPSHOT_USE_SSE2
+	for (; x < width_bytes; x++) {
+		uint32_t sum = 0;
+		for (int r = 0; r < count; r++) {
+			sum += rows[(size_t)r * stride + x];
+		}
+		sums[x] = sum;
+	}
+}
+
+
+// mean of pixels of column sums, alpha forced opaque
+static void mean_pixel(const uint32_t *sums, int pixels, int count, uint8_t *out)
+{
+#ifdef SNAPSHOT_USE_SSE2
+	__m128i sum = _mm_setzero_si128();
+	for (int i = 0; i < pixels; i++) {
+		sum = _mm_add_epi32(sum, _mm_loadu_si128((const __m128i *)(sums + (size_t)i * 4)));
+	}
+	__m128 mean = _mm_mul_ps(_mm_cvtepi32_ps(sum), _mm_set1_ps(1.0f / count));
+	__m128i packed = _mm_cvtps_epi32(mean);
+	packed = _mm_packs_epi32(packed, packed);
+	packed = _mm_packus_epi16(packed, packed);
+	uint32_t value = (uint32_t)_mm_cvtsi128_si32(packed) | 0xff000000u;
+	memcpy(out, &value, 4);
+#else
+	uint32_t sum[3] = { 0, 0, 0 };
+	for (int i = 0; i < pixels; i++) {
+		sum[0] += sums[i * 4 + 0];
+		sum[1] += sums[i * 4 + 1];
+		sum[2] += sums[i * 4 + 2];
+	}
+	out[0] = (uint8_t)(sum[0] / count);
+	out[1] = (uint8_t)(sum[1] / count);
+	out[2] = (uint8_t)(sum[2] / count);
+	out[3] = 0xff;
+#endif // SNAPSHOT_USE_SSE2
+}
+
+
+
+FrameView frame_view(const VideoFrame &frame)
+{
+	FrameView view = { frame.width, frame.height, frame.stride, frame.pixels.data() };
+	return view;
+}
+
+
+void downscale_frame(const FrameView &src, int max_width, int max_height, VideoFrame &dst)
+{
+	double scale = 1.0;
+	if (max_width > 0) {
+		scale = std::min(scale, (double)max_width / src.width);
+	}
+	if (max_height > 0) {
+		scale = std::min(scale, (double)max_height / src.height);
+	}
+	if (scale >= 1.0) {
+		copy_frame(src, dst);
+		return;
+	}
+
+	dst.width = std::max(1, (int)(src.width * scale));
+	dst.height = std::max(1, (int)(src.height * scale));
+	dst.stride = dst.width * 4;
+	dst.pixels.resize((size_t)dst.stride * dst.height);
+
+	downscale_into(src, dst.width, dst.height, dst.pixels.data(), dst.stride);
+}
+
+
+void downscale_into(const FrameView &src, int dst_width, int dst_height, uint8_t *dst, int dst_stride)
+{
+	if (src.width <= 0 || src.height <= 0 || dst_width <= 0 || dst_height <= 0) {
+		return;
+	}
+
+	// column sums of one destination row, per event thread so concurrent players do not share it
+	thread_local std::vector<uint32_t> column_sums;
+	column_sums.resize((size_t)src.width * 4);
+
+	for (int y = 0; y < dst_height; y++) {
+		int y0 = (int)((int64_t)y * src.height / dst_height);
+		int y1 = std::max(y0 + 1, (int)((int64_t)(y + 1) * src.height / dst_height));
+
+		// vertical pass, sum the rows of the box
+		sum_rows(src.pixels + (size_t)y0 * src.stride, src.stride, y1 - y0, src.width * 4, column_sums.data());
+
+		// horizontal pass, mean of the columns of the box
+		uint8_t *out = dst + (size_t)y * dst_stride;
+		for (int x = 0; x < dst_width; x++) {
+			int x0 = (int)((int64_t)x * src.width / dst_width);
+			int x1 = std::max(x0 + 1, (int)((int64_t)(x + 1) * src.width / dst_width));
+			mean_pixel(column_sums.data() + (size_t)x0 * 4, x1 - x0, (y1 - y0) * (x1 - x0), out + (size_t)x * 4);
+		}
+	}
+}
+
+
+
+bool encode_frame(const VideoFrame &frame, const std::string &format, int quality, std::vector<uint8_t> &out)
+{
+	if (frame.pixels.empty() || format.empty()) {
+		return false;
+	}
+
+	// bgr0 in memory is QImage::Format_RGB32 on little endian hosts
+	QImage image(frame.pixels.data(), frame.width, frame.height, frame.stride, QImage::Format_RGB32);
+	QByteArray bytes;
+	QBuffer buffer(&bytes);
+	if (!buffer.open(QIODevice::WriteOnly) || !image.save(&buffer, format.c_str(), quality)) {
+		SPDLOG_ERROR("encode {}x{} frame as {} error\n", frame.width, frame.height, format);
+		return false;
+	}
+
+	out.assign((const uint8_t *)bytes.constData(), (const uint8_t *)bytes.constData() + bytes.size());
+	return true;
+}
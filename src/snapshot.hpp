@@ -0,0 +1,92 @@
+#pragma once
+
+// c
+#include <stdint.h>
+
+// c++
+#include <string>
+#include <vector>
+
+// project
+struct FrameView;
+
+
+
+// bgr0 pixels owned by us, capacity is kept when reused
+struct VideoFrame {
+	VideoFrame() : width(0), height(0), stride(0) {}
+
+	int width;
+	int height;
+	int stride;
+	std::vector<uint8_t> pixels;
+};
+
+
+// what to do with a raw screenshot off the event thread
+struct ScreenshotOptions {
+	ScreenshotOptions() : max_width(0), max_height(0), quality(85) {}
+
+	// fit into this size keeping aspect, 0 keeps the decoded size
+	int max_width;
+	int max_height;
+	// qt image format like jpg or png, empty keeps raw pixels only
+	std::string encode_format;
+	// encoder quality 0 - 100
+	int quality;
+};
+
+
+// result of a screenshot
+struct Screenshot {
+	VideoFrame frame;
+	// only set when an encode format was asked for
+	std::vector<uint8_t> encoded;
+};
+
+
+// layout and deadline of a contact sheet round
+struct MosaicOptions {
+	MosaicOptions() : cell_width(160), cell_height(90), columns(0), budget_ms(1000) {}
+
+	// size of one thumbnail, stretched like the tiles (keepaspect=no)
+	int cell_width;
+	int cell_height;
+	// 0 picks a near square grid
+	int columns;
+	// cells not answered by then keep their previous thumbnail
+	int budget_ms;
+};
+
+
+// contact sheet of all tiles, keep it between rounds to reuse its buffers
+struct Mosaic {
+	Mosaic() : columns(0), rows(0), fresh_count(0) {}
+
+	VideoFrame frame;
+	int columns;
+	int rows;
+	// source index of each cell
+	std::vector<int> indexes;
+	// 1 if the cell was updated in the last round
+	std::vector<uint8_t> fresh;
+	int fresh_count;
+};
+
+
+
+// copy a borrowed frame
+void copy_frame(const FrameView &view, VideoFrame &frame);
+
+// borrow an owned frame
+FrameView frame_view(const VideoFrame &frame);
+
+// average boxes of pixels to fit max size keeping aspect, never upscales
+void downscale_frame(const FrameView &src, int max_width, int max_height, VideoFrame &dst);
+
+// average boxes of pixels into a rectangle of a larger buffer, sse2 where available
+void downscale_into(const FrameView &src, int dst_width, int dst_height, uint8_t *dst, int dst_stride);
+
+// encode with qt image writers
+bool encode_frame(const VideoFrame &frame, const std::string &format, int quality, std::vector<uint8_t> &out);
+
@@ -107,6 +107,25 @@ public:
 		}
 	}
 
+	// take over a buffer whose size is a power of two, the previous one is freed
+	void reset(std::vector<T> &&buffer)
+	{
+		reset(0);
+		m_ring_buffer.swap(buffer);
+		if (!m_ring_buffer.empty()) {
+			reset((uint32_t)m_ring_buffer.size());
+		}
+	}
+
+	// hand the buffer out, spsc is null afterwards
+	std::vector<T> release_buffer()
+	{
+		std::vector<T> buffer;
+		m_ring_buffer.swap(buffer);
+		reset(0);
+		return buffer;
+	}
+
 	void clear()
 	{
 		get_all();
@@ -142,6 +161,27 @@ public:
 		return (uint32_t)m_ring_buffer.size() - LOAD_ATOMIC_RELAXED(m_input_offset) + LOAD_ATOMIC_RELAXED(m_output_offset);
 	}
 
+	// stream position of the next byte to put
+	uint32_t input_offset()
+	{
+		return LOAD_ATOMIC_RELAXED(m_input_offset);
+	}
+
+	// move the reader to a stream position still held by the buffer, the last size bytes put stay intact
+	// only while neither producer nor consumer runs, a producer that may run must be held off between its puts by the caller
+	bool seek_output(uint32_t offset)
+	{
+		uint32_t input_offset = LOAD_ATOMIC_RELAXED(m_input_offset);
+		if (input_offset - offset > (uint32_t)m_ring_buffer.size()) {
+			return false;
+		}
+
+		STORE_ATOMIC_RELAXED(m_output_offset, offset);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		return true;
+	}
+
 	uint32_t put(const T item)
 	{
 		T buff[] = { item };
@@ -326,3 +366,201 @@ private:
 	uint32_t m_last_empty_log_repeat_times;
 };
 
+
+
+#define SHARED_SPSC_MAGIC 0x43535053
+
+
+// head of a ring shared by two processes, items follow it
+// positions are offsets from the head, so each process may map the memory at its own address
+struct SharedSpscHeader {
+	uint32_t magic;
+	// items, a power of two
+	uint32_t buffer_size;
+	// set by either side, the other stops waiting
+	std::atomic<uint32_t> stopping;
+	// producer and consumer offsets on their own cache lines
+	alignas(64) std::atomic<uint32_t> input_offset;
+	alignas(64) std::atomic<uint32_t> output_offset;
+};
+
+
+// lock_free_spsc over memory it does not own, e.g. a shared memory segment mapped by producer and consumer processes
+template<typename T>
+class lock_free_shared_spsc
+{
+public:
+	lock_free_shared_spsc()
+		: m_header(nullptr)
+		, m_ring_buffer(nullptr)
+	{
+	}
+
+	// bytes of memory holding a ring of buffer_size items
+	static size_t memory_size(uint32_t buffer_size)
+	{
+		return sizeof(SharedSpscHeader) + sizeof(T) * roundup_pow_of_two(buffer_size);
+	}
+
+	// lay out an empty ring in memory, as many items as fit rounded down to a power of two
+	bool create(void *memory, size_t size)
+	{
+		detach();
+		if (nullptr == memory || size < memory_size(1)) {
+			return false;
+		}
+
+		SharedSpscHeader *header = (SharedSpscHeader *)memory;
+		header->buffer_size = rounddown_pow_of_two((uint32_t)std::min((size - sizeof(SharedSpscHeader)) / sizeof(T), (size_t)UINT32_MAX));
+		header->stopping.store(0);
+		header->input_offset.store(0);
+		header->output_offset.store(0);
+		// the magic goes last, the other side attaching meanwhile sees no ring yet
+		std::atomic_thread_fence(std::memory_order_release);
+		header->magic = SHARED_SPSC_MAGIC;
+
+		m_header = header;
+		m_ring_buffer = (T *)(header + 1);
+		return true;
+	}
+
+	// use a ring another process laid out in memory
+	bool attach(void *memory, size_t size)
+	{
+		detach();
+		if (nullptr == memory || size < memory_size(1)) {
+			return false;
+		}
+
+		SharedSpscHeader *header = (SharedSpscHeader *)memory;
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (header->magic != SHARED_SPSC_MAGIC || memory_size(header->buffer_size) > size) {
+			return false;
+		}
+
+		m_header = header;
+		m_ring_buffer = (T *)(header + 1);
+		return true;
+	}
+
+	// forget the memory, it stays with its owner
+	void detach()
+	{
+		m_header = nullptr;
+		m_ring_buffer = nullptr;
+	}
+
+	bool is_attached()
+	{
+		return m_header != nullptr;
+	}
+
+	// empty the ring and clear stopping, only while the other side does not run
+	void reset()
+	{
+		if (m_header != nullptr) {
+			m_header->input_offset.store(0);
+			m_header->output_offset.store(0);
+			m_header->stopping.store(0);
+		}
+	}
+
+	// seen by both sides
+	void stopping()
+	{
+		if (m_header != nullptr) {
+			m_header->stopping.store(1);
+		}
+	}
+
+	bool is_stopping()
+	{
+		return nullptr == m_header || m_header->stopping.load(std::memory_order_relaxed) != 0;
+	}
+
+	uint32_t buffer_size()
+	{
+		return nullptr == m_header ? 0 : m_header->buffer_size;
+	}
+
+	uint32_t available_data_size()
+	{
+		return nullptr == m_header ? 0 : LOAD_ATOMIC_RELAXED(m_header->input_offset) - LOAD_ATOMIC_RELAXED(m_header->output_offset);
+	}
+
+	uint32_t available_space_size()
+	{
+		return nullptr == m_header ? 0 : m_header->buffer_size - LOAD_ATOMIC_RELAXED(m_header->input_offset) + LOAD_ATOMIC_RELAXED(m_header->output_offset);
+	}
+
+	uint32_t put(const T *input_buffer, uint32_t length)
+	{
+		if (nullptr == m_header) {
+			return 0;
+		}
+
+		uint32_t buffer_size = m_header->buffer_size;
+		length = std::min(length, buffer_size - LOAD_ATOMIC_RELAXED(m_header->input_offset) + m_header->output_offset.load(std::memory_order_acquire));
+		if (0 == length) {
+			return 0;
+		}
+
+		uint32_t input_offset = LOAD_ATOMIC_RELAXED(m_header->input_offset);
+		uint32_t write_offset = input_offset & (buffer_size - 1);
+
+		// first put the data starting from in to buffer end, then the rest (if any) at the beginning
+		uint32_t first_part = std::min(length, buffer_size - write_offset);
+		std::memcpy(m_ring_buffer + write_offset, input_buffer, sizeof(T) * first_part);
+		std::memcpy(m_ring_buffer, input_buffer + first_part, sizeof(T) * (length - first_part));
+
+		// the consumer sees the items before the new offset
+		m_header->input_offset.store(input_offset + length, std::memory_order_release);
+
+		return length;
+	}
+
+	uint32_t get(T *output_buffer, uint32_t length)
+	{
+		if (nullptr == m_header) {
+			return 0;
+		}
+
+		uint32_t buffer_size = m_header->buffer_size;
+		uint32_t output_offset = LOAD_ATOMIC_RELAXED(m_header->output_offset);
+		length = std::min(length, m_header->input_offset.load(std::memory_order_acquire) - output_offset);
+		if (0 == length) {
+			return 0;
+		}
+
+		uint32_t read_offset = output_offset & (buffer_size - 1);
+
+		// first get the data from out until the end of the buffer, then the rest (if any) from the beginning
+		uint32_t first_part = std::min(length, buffer_size - read_offset);
+		std::memcpy(output_buffer, m_ring_buffer + read_offset, sizeof(T) * first_part);
+		std::memcpy(output_buffer + first_part, m_ring_buffer, sizeof(T) * (length - first_part));
+
+		// the producer may overwrite the items after the new offset
+		m_header->output_offset.store(output_offset + length, std::memory_order_release);
+
+		return length;
+	}
+
+	// wait until at least one item was taken or the ring is stopping
+	uint32_t get_if_not_empty(T *output_buffer, uint32_t length)
+	{
+		while (!is_stopping()) {
+			uint32_t c = get(output_buffer, length);
+			if (c > 0) {
+				return c;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+		}
+		return 0;
+	}
+
+
+private:
+	// inside memory of the owner
+	SharedSpscHeader *m_header;
+	T *m_ring_buffer;
+};
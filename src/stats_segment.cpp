@@ -0,0 +1,148 @@
+// self
+#include "stats_segment.hpp"
+
+// c
+#include <string.h>
+
+// c++
+#include <algorithm>
+#include <thread>
+
+// qt
+#include <QtCore/QSharedMemory>
+#include <QtCore/QString>
+
+// spdlog
+#include <spdlog/spdlog.h>
+
+
+#define STATS_READ_RETRIES 16
+
+
+
+StatsSegment::StatsSegment()
+	: m_memory(nullptr)
+	, m_writer(false)
+{
+}
+
+
+StatsSegment::~StatsSegment()
+{
+	detach();
+}
+
+
+bool StatsSegment::create(const std::string &key)
+{
+	detach();
+
+	m_memory = new QSharedMemory(QString::fromStdString(key));
+	if (!m_memory->create((int)sizeof(StatsSegmentLayout))) {
+		// a crashed writer leaves the segment on unix, the last detach removes it
+		if (m_memory->attach()) {
+			m_memory->detach();
+		}
+		if (!m_memory->create((int)sizeof(StatsSegmentLayout))) {
+			SPDLOG_ERROR("[stats] create shared memory {} error, {}\n", key, m_memory->errorString().toStdString());
+			delete m_memory;
+			m_memory = nullptr;
+			return false;
+		}
+	}
+
+	// the magic goes last, a reader attaching meanwhile sees no segment yet
+	StatsSegmentLayout *layout = (StatsSegmentLayout *)m_memory->data();
+	memset((void *)layout, 0, sizeof(StatsSegmentLayout));
+	layout->version = STATS_SEGMENT_VERSION;
+	layout->sequence.store(0);
+	std::atomic_thread_fence(std::memory_order_release);
+	layout->magic = STATS_SEGMENT_MAGIC;
+
+	m_writer = true;
+	SPDLOG_INFO("[stats] shared memory {} created, {} bytes\n", key, sizeof(StatsSegmentLayout));
+
+	return true;
+}
+
+
+bool StatsSegment::attach(const std::string &key)
+{
+	detach();
+
+	m_memory = new QSharedMemory(QString::fromStdString(key));
+	if (!m_memory->attach(QSharedMemory::ReadOnly) || m_memory->size() < (int)sizeof(StatsSegmentLayout)) {
+		delete m_memory;
+		m_memory = nullptr;
+		return false;
+	}
+
+	m_writer = false;
+	return true;
+}
+
+
+void StatsSegment::detach()
+{
+	if (m_memory != nullptr) {
+		m_memory->detach();
+		delete m_memory;
+	}
+	m_memory = nullptr;
+	m_writer = false;
+}
+
+
+bool StatsSegment::is_attached()
+{
+	return m_memory != nullptr;
+}
+
+
+void StatsSegment::publish(const StatsSnapshot &snapshot)
+{
+	if (nullptr == m_memory || !m_writer) {
+		return;
+	}
+
+	StatsSegmentLayout *layout = (StatsSegmentLayout *)m_memory->data();
+	uint32_t sequence = layout->sequence.load(std::memory_order_relaxed);
+	layout->sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	memcpy((void *)&layout->snapshot, &snapshot, sizeof(StatsSnapshot));
+
+	layout->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+
+bool StatsSegment::read(StatsSnapshot &snapshot)
+{
+	if (nullptr == m_memory) {
+		return false;
+	}
+
+	const StatsSegmentLayout *layout = (const StatsSegmentLayout *)m_memory->constData();
+	if (layout->magic != STATS_SEGMENT_MAGIC || layout->version != STATS_SEGMENT_VERSION) {
+		return false;
+	}
+
+	for (int i = 0; i < STATS_READ_RETRIES; i++) {
+		uint32_t begin = layout->sequence.load(std::memory_order_acquire);
+		if (begin & 1) {
+			std::this_thread::yield();
+			continue;
+		}
+
+		memcpy(&snapshot, (const void *)&layout->snapshot, sizeof(StatsSnapshot));
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (layout->sequence.load(std::memory_order_relaxed) == begin) {
+			snapshot.tile_count = std::min(snapshot.tile_count, (uint32_t)STATS_MAX_TILES);
+			return true;
+		}
+	}
+
+	return false;
+}
+
@@ -0,0 +1,101 @@
+#pragma once
+
+// c
+#include <stdint.h>
+
+// c++
+#include <atomic>
+#include <string>
+
+// qt
+class QSharedMemory;
+
+
+#ifndef DEFAULT_STATS_KEY
+#define DEFAULT_STATS_KEY "qt-mpv-stats"
+#endif // !DEFAULT_STATS_KEY
+
+#define STATS_SEGMENT_MAGIC 0x504d5451
+#define STATS_SEGMENT_VERSION 1
+#define STATS_MAX_TILES 256
+
+
+
+// counters of one tile, fixed width so writer and reader builds agree on the layout
+struct StatsTile {
+	// source index
+	int32_t index;
+	// player session id
+	uint32_t player_id;
+	// spsc size and bytes waiting in it
+	uint32_t buffer_size;
+	uint32_t buffer_fill;
+	// bytes written to and read from spsc
+	uint64_t input_bytes;
+	uint64_t output_bytes;
+	// bytes per second written to spsc
+	uint32_t bitrate;
+	// ShedLevel
+	uint32_t shed_level;
+	double fps;
+	double speed;
+	int64_t frame_drops;
+	int64_t decoder_frame_drops;
+	uint64_t restarts;
+	uint64_t write_stalls;
+	uint64_t read_stalls;
+};
+
+
+// one published state of the wall
+struct StatsSnapshot {
+	int64_t pid;
+	// milliseconds since epoch of the last publish
+	int64_t update_time_ms;
+	// process cpu, 100 is one core
+	double cpu_percent;
+	uint32_t cpu_cores;
+	uint32_t tile_count;
+	uint64_t rss_bytes;
+	StatsTile tiles[STATS_MAX_TILES];
+};
+
+
+// layout of the shared memory
+struct StatsSegmentLayout {
+	uint32_t magic;
+	uint32_t version;
+	// seqlock, odd while the writer copies a snapshot in
+	std::atomic<uint32_t> sequence;
+	uint32_t reserved;
+	StatsSnapshot snapshot;
+};
+
+
+// shared memory segment holding the latest snapshot, one process writes and any number reads
+// neither side takes a lock, a reader retries when it raced the writer
+class StatsSegment {
+public:
+	StatsSegment();
+	~StatsSegment();
+
+	// writer: create the segment of key, taking over one left behind by a crashed writer
+	bool create(const std::string &key);
+	// reader: attach read only to the segment of key
+	bool attach(const std::string &key);
+	// leave the segment, it goes away with its last user
+	void detach();
+	bool is_attached();
+
+	// writer: copy snapshot in
+	void publish(const StatsSnapshot &snapshot);
+	// reader: copy a consistent snapshot out, false if the segment is not ours or the writer kept changing it
+	bool read(StatsSnapshot &snapshot);
+
+
+private:
+	QSharedMemory *m_memory;
+	// created by this process
+	bool m_writer;
+};
+
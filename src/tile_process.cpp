@@ -0,0 +1,579 @@
+// self
+#include "tile_process.hpp"
+
+// c
+#include <string.h>
+
+// c++
+#include <thread>
+#include <vector>
+
+// qt
+#include <QtCore/QCoreApplication>
+#include <QtCore/QProcess>
+#include <QtCore/QSharedMemory>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+
+// fmt
+#include <fmt/format.h>
+
+// spdlog
+#include <spdlog/spdlog.h>
+
+// project
+#include "mpv_wrapper.hpp"
+#include "trace.hpp"
+
+// windows
+#ifdef _WIN32
+#ifndef VC_EXTRALEAN
+#define VC_EXTRALEAN
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <Windows.h>
+#else
+#include <signal.h>
+#include <sys/types.h>
+#endif // _WIN32
+
+
+// ring starts on its own cache line after the control block
+#define TILE_RING_OFFSET ((sizeof(TileControl) + 63) & ~(size_t)63)
+#define WORKER_PUMP_SIZE 32768
+#define WORKER_SLEEP_MS 50
+#define STATS_READ_RETRIES 16
+
+
+
+// both processes compare heartbeats, so a clock they share
+static int64_t system_now_ms()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+
+std::atomic<uint32_t> TileProcess::s_index(0);
+
+
+TileProcess::TileProcess()
+	: m_id(0)
+	, m_index(-1)
+	, m_wid(0)
+	, m_shown(true)
+	, m_memory(nullptr)
+	, m_control(nullptr)
+	, m_pid(0)
+	, m_stopping(true)
+	, m_input_bytes(0)
+	, m_write_stalls(0)
+	, m_relaunches(0)
+	, m_visible(true)
+	, m_shed_level(ShedLevel::Off)
+	, m_audio_enabled(true)
+{
+}
+
+
+TileProcess::~TileProcess()
+{
+	stop();
+}
+
+
+bool TileProcess::start(int index, int64_t wid, std::string video_url, bool shown, const TileProcessOptions &options)
+{
+	stop();
+
+	std::lock_guard<std::mutex> lock(m_write_mutex);
+	m_id = s_index++;
+	m_index = index;
+	m_wid = wid;
+	m_video_url = video_url;
+	m_shown = shown;
+	m_options = options;
+	m_visible = true;
+	m_shed_level = ShedLevel::Off;
+	m_audio_enabled = options.audio_enabled;
+
+	// unique per wall, session and source, a wall that crashed leaves no key we could collide with
+	m_key = fmt::format("qt-mpv-tile-{}-{}-{}", QCoreApplication::applicationPid(), index, m_id);
+	size_t size = TILE_RING_OFFSET + lock_free_shared_spsc<uint8_t>::memory_size(options.ring_size);
+	m_memory = new QSharedMemory(QString::fromStdString(m_key));
+	if (!m_memory->create((int)size)) {
+		SPDLOG_ERROR("[tile {}] create shared memory {} of {} bytes error, {}\n", index, m_key, size, m_memory->errorString().toStdString());
+		delete m_memory;
+		m_memory = nullptr;
+		return false;
+	}
+
+	uint8_t *data = (uint8_t *)m_memory->data();
+	memset(data, 0, TILE_RING_OFFSET);
+	m_control = (TileControl *)data;
+	m_control->version = TILE_CONTROL_VERSION;
+	m_control->decoder_threads = options.decoder_threads;
+	m_control->quality_governor = options.quality_governor ? 1 : 0;
+	m_control->shown = shown ? 1 : 0;
+	m_control->fed_input = options.fed_input ? 1 : 0;
+	m_control->visible.store(1);
+	m_control->audio_enabled.store(options.audio_enabled ? 1 : 0);
+	m_control->shed_level.store((uint32_t)ShedLevel::Off);
+	m_control->wall_heartbeat_ms.store(system_now_ms());
+	m_control->state.store((uint32_t)WorkerState::Starting);
+	m_ring.create(data + TILE_RING_OFFSET, size - TILE_RING_OFFSET);
+	std::atomic_thread_fence(std::memory_order_release);
+	m_control->magic = TILE_CONTROL_MAGIC;
+
+	if (!launch()) {
+		m_ring.detach();
+		m_control = nullptr;
+		m_memory->detach();
+		delete m_memory;
+		m_memory = nullptr;
+		return false;
+	}
+
+	m_input_bytes = 0;
+	m_write_stalls = 0;
+	m_relaunches = 0;
+	m_stopping = false;
+
+	return true;
+}
+
+
+void TileProcess::stop()
+{
+	stopping();
+
+	// the worker stops its player and reports, a hung one is killed
+	if (m_control != nullptr && m_pid != 0) {
+		auto begin = std::chrono::steady_clock::now();
+		while ((WorkerState)m_control->state.load() != WorkerState::Exited && std::chrono::steady_clock::now() - begin < std::chrono::milliseconds(WORKER_STOP_TIMEOUT_MS)) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+		if ((WorkerState)m_control->state.load() != WorkerState::Exited) {
+			SPDLOG_WARN("[tile {}] worker {} did not exit within {} ms, kill it\n", m_index, m_pid, WORKER_STOP_TIMEOUT_MS);
+			kill();
+		}
+	}
+	m_pid = 0;
+
+	// the feeder may still hold us, it sees stopping under the write lock
+	std::lock_guard<std::mutex> lock(m_write_mutex);
+	m_ring.detach();
+	m_control = nullptr;
+	if (m_memory != nullptr) {
+		m_memory->detach();
+		delete m_memory;
+	}
+	m_memory = nullptr;
+}
+
+
+void TileProcess::stopping()
+{
+	m_stopping = true;
+
+	// the worker stops waiting for data and starts exiting, so a wall of workers stops in parallel
+	m_ring.stopping();
+	if (m_control != nullptr) {
+		m_control->stopping.store(1);
+	}
+}
+
+
+uint32_t TileProcess::get_id()
+{
+	return m_id;
+}
+
+
+bool TileProcess::write(const uint8_t *buf, uint32_t length, int64_t id)
+{
+	TraceSpan span("stream", "write", m_id);
+	span.set_value(length);
+
+	std::lock_guard<std::mutex> lock(m_write_mutex);
+
+	if (m_stopping || (id >= 0 && (uint32_t)id != m_id)) {
+		return false;
+	}
+
+	uint32_t offset = 0;
+	while (!m_stopping && offset < length) {
+		uint32_t c = m_ring.put(buf + offset, length - offset);
+		offset += c;
+		if (0 == c) {
+			// a dead or hung worker must not hold up the other tiles
+			if (!is_alive()) {
+				TRACE_INSTANT("stream", "worker_drop", m_id, length - offset);
+				break;
+			}
+			m_write_stalls++;
+			TRACE_INSTANT("stream", "write_stall", m_id, length - offset);
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+		}
+	}
+	// a dropped worker got only part of the chunk
+	m_input_bytes += offset;
+
+	return offset == length;
+}
+
+
+bool TileProcess::is_alive()
+{
+	if (nullptr == m_control || 0 == m_pid) {
+		return false;
+	}
+
+	WorkerState state = (WorkerState)m_control->state.load();
+	if (WorkerState::Exited == state || WorkerState::Failed == state) {
+		return false;
+	}
+
+	int64_t heartbeat_ms = m_control->worker_heartbeat_ms.load();
+	if (heartbeat_ms > 0 && system_now_ms() - heartbeat_ms < WORKER_HEARTBEAT_TIMEOUT_MS) {
+		return true;
+	}
+
+	// not reported yet, give it the timeout to start mpv
+	return std::chrono::steady_clock::now() - m_launch_time < std::chrono::milliseconds(WORKER_HEARTBEAT_TIMEOUT_MS);
+}
+
+
+bool TileProcess::supervise()
+{
+	if (m_stopping || nullptr == m_control) {
+		return true;
+	}
+
+	m_control->wall_heartbeat_ms.store(system_now_ms());
+	// one launch per timeout at most, a source that fails at once does not spin
+	if (is_alive() || std::chrono::steady_clock::now() - m_launch_time < std::chrono::milliseconds(WORKER_HEARTBEAT_TIMEOUT_MS)) {
+		return true;
+	}
+
+	SPDLOG_WARN("[tile {}] worker {} is gone or hung, state {}, relaunch\n", m_index, m_pid, m_control->state.load());
+	TRACE_INSTANT("worker", "relaunch", m_id, m_index);
+	kill();
+
+	// the feeder gave up on the dead worker, so the lock comes soon
+	std::lock_guard<std::mutex> lock(m_write_mutex);
+	if (m_stopping || nullptr == m_control) {
+		return true;
+	}
+	// the new player resyncs at the next key frame, what the old one left unread is dropped
+	m_ring.reset();
+	m_control->stopping.store(0);
+	m_control->worker_heartbeat_ms.store(0);
+	m_control->state.store((uint32_t)WorkerState::Starting);
+	m_relaunches++;
+	launch();
+
+	return false;
+}
+
+
+void TileProcess::get_statistics(PlayerStatistics &stats)
+{
+	StatsTile tile;
+	memset(&tile, 0, sizeof(StatsTile));
+	for (int i = 0; m_control != nullptr && i < STATS_READ_RETRIES; i++) {
+		uint32_t begin = m_control->stats_sequence.load(std::memory_order_acquire);
+		if (begin & 1) {
+			std::this_thread::yield();
+			continue;
+		}
+
+		memcpy(&tile, (const void *)&m_control->stats, sizeof(StatsTile));
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (m_control->stats_sequence.load(std::memory_order_relaxed) == begin) {
+			break;
+		}
+	}
+
+	stats.fps = tile.fps;
+	stats.frame_drops = tile.frame_drops;
+	stats.decoder_frame_drops = tile.decoder_frame_drops;
+	stats.input_bytes = m_input_bytes;
+	stats.output_bytes = tile.output_bytes;
+	// both rings hold data on its way to the demuxer
+	stats.buffer_size = tile.buffer_size + m_ring.buffer_size();
+	stats.buffer_fill = tile.buffer_fill + m_ring.available_data_size();
+	stats.speed = tile.speed;
+	stats.restarts = tile.restarts + m_relaunches;
+	stats.write_stalls = m_write_stalls;
+	stats.read_stalls = tile.read_stalls;
+	stats.input_bitrate = tile.bitrate;
+	stats.demuxer_cache_bytes = 0;
+}
+
+
+void TileProcess::set_visible(bool state)
+{
+	m_visible = state;
+	if (m_control != nullptr) {
+		m_control->visible.store(state ? 1 : 0);
+	}
+}
+
+
+bool TileProcess::is_visible()
+{
+	return m_visible;
+}
+
+
+void TileProcess::set_audio_enabled(bool state)
+{
+	m_audio_enabled = state;
+	if (m_control != nullptr) {
+		m_control->audio_enabled.store(state ? 1 : 0);
+	}
+}
+
+
+bool TileProcess::is_audio_enabled()
+{
+	return m_audio_enabled;
+}
+
+
+void TileProcess::set_tile_size(int width, int height)
+{
+	if (m_control != nullptr) {
+		m_control->tile_width.store(width);
+		m_control->tile_height.store(height);
+	}
+}
+
+
+void TileProcess::set_shed_level(ShedLevel level)
+{
+	m_shed_level = level;
+	if (m_control != nullptr) {
+		m_control->shed_level.store((uint32_t)level);
+	}
+}
+
+
+ShedLevel TileProcess::get_shed_level()
+{
+	return m_shed_level;
+}
+
+
+bool TileProcess::launch()
+{
+	QStringList arguments;
+	arguments << "--worker_key" << QString::fromStdString(m_key);
+	arguments << "--worker_wid" << QString::fromStdString(std::to_string(m_wid));
+	arguments << "--worker_buffer_size" << QString::fromStdString(std::to_string(m_options.buffer_size));
+	arguments << "--video_url" << QString::fromStdString(m_video_url);
+	arguments << "--profile" << QString::fromStdString(m_options.profile);
+	// empty means the cpu decodes, the worker would take it as its default
+	arguments << "--hwdec" << QString::fromStdString(m_options.hwdec.empty() ? "no" : m_options.hwdec);
+	arguments << "--mpv_log_level" << QString::fromStdString(m_options.log_level);
+	arguments << "--log_level" << QString::fromStdString(std::to_string((int)spdlog::get_level()));
+	if (!m_options.vo.empty()) {
+		arguments << "--vo" << QString::fromStdString(m_options.vo);
+	}
+	if (!m_options.gpu_api.empty()) {
+		arguments << "--gpu_api" << QString::fromStdString(m_options.gpu_api);
+	}
+	if (!m_options.gpu_context.empty()) {
+		arguments << "--gpu_context" << QString::fromStdString(m_options.gpu_context);
+	}
+	if (!m_options.log_path.empty()) {
+		arguments << "--log_path" << QString::fromStdString(m_options.log_path);
+	}
+
+	qint64 pid = 0;
+	m_launch_time = std::chrono::steady_clock::now();
+	if (!QProcess::startDetached(QString::fromStdString(m_options.program), arguments, QString(), &pid)) {
+		SPDLOG_ERROR("[tile {}] launch worker {} error\n", m_index, m_options.program);
+		m_pid = 0;
+		return false;
+	}
+
+	m_pid = pid;
+	SPDLOG_INFO("[tile {}] worker {} launched for {}, shared memory {}\n", m_index, m_pid, m_video_url, m_key);
+
+	return true;
+}
+
+
+void TileProcess::kill()
+{
+	if (0 == m_pid) {
+		return;
+	}
+
+#ifdef _WIN32
+	HANDLE process = OpenProcess(PROCESS_TERMINATE, FALSE, (DWORD)m_pid);
+	if (process != nullptr) {
+		TerminateProcess(process, 1);
+		CloseHandle(process);
+	}
+#else
+	::kill((pid_t)m_pid, SIGKILL);
+#endif // _WIN32
+
+	m_pid = 0;
+}
+
+
+
+int run_tile_worker(
+	std::string key, int64_t wid, std::string video_url,
+	std::string profile, std::string vo, std::string hwdec,
+	std::string gpu_api, std::string gpu_context, std::string log_level,
+	uint32_t buffer_size
+)
+{
+	Tracer::set_thread_name("worker");
+
+	QSharedMemory memory(QString::fromStdString(key));
+	if (!memory.attach()) {
+		SPDLOG_ERROR("[worker] attach shared memory {} error, {}\n", key, memory.errorString().toStdString());
+		return -1;
+	}
+
+	TileControl *control = (TileControl *)memory.data();
+	lock_free_shared_spsc<uint8_t> ring;
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if ((size_t)memory.size() < TILE_RING_OFFSET || control->magic != TILE_CONTROL_MAGIC || control->version != TILE_CONTROL_VERSION
+		|| !ring.attach((uint8_t *)memory.data() + TILE_RING_OFFSET, memory.size() - TILE_RING_OFFSET)) {
+		SPDLOG_ERROR("[worker] shared memory {} is not a tile of this version\n", key);
+		memory.detach();
+		return -1;
+	}
+
+	control->worker_heartbeat_ms.store(system_now_ms());
+
+	MpvWrapper mpv(buffer_size);
+	mpv.set_decoder_threads(control->decoder_threads);
+	mpv.set_quality_governor(control->quality_governor != 0);
+	mpv.set_audio_enabled(control->audio_enabled.load() != 0);
+	mpv.set_fed_input(control->fed_input != 0);
+	if (!mpv.start(wid, video_url, profile, vo, hwdec, gpu_api, gpu_context, log_level)) {
+		SPDLOG_ERROR("[worker] start player error, {}\n", video_url);
+		control->state.store((uint32_t)WorkerState::Failed);
+		memory.detach();
+		return -2;
+	}
+	if (0 == control->shown) {
+		mpv.set_container_window_visible(false);
+	}
+	control->state.store((uint32_t)WorkerState::Playing);
+	SPDLOG_INFO("[worker] player {} playing {}\n", mpv.get_id(), video_url);
+
+	// move what the feeder wrote into the player, its own ring keeps the key frames a reload rewinds to
+	std::thread pump([&ring, &mpv]() {
+		Tracer::set_thread_name("pump");
+		std::vector<uint8_t> buf(WORKER_PUMP_SIZE);
+		while (!ring.is_stopping()) {
+			uint32_t c = ring.get_if_not_empty(buf.data(), (uint32_t)buf.size());
+			if (c > 0) {
+				mpv.write(buf.data(), c);
+			}
+		}
+	});
+
+	bool applied_visible = true;
+	ShedLevel applied_shed_level = ShedLevel::Off;
+	int applied_width = 0;
+	int applied_height = 0;
+	bool applied_audio = mpv.is_audio_enabled();
+	auto last_beat_time = std::chrono::steady_clock::now();
+	while (0 == control->stopping.load()) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(WORKER_SLEEP_MS));
+		if (control->stopping.load() != 0) {
+			break;
+		}
+
+		// commands every tick, so an audio focus switch is heard at once
+		bool audio = control->audio_enabled.load() != 0;
+		if (audio != applied_audio) {
+			mpv.set_audio_enabled(audio);
+			applied_audio = audio;
+		}
+
+		bool visible = control->visible.load() != 0;
+		if (visible != applied_visible) {
+			mpv.set_visible(visible);
+			applied_visible = visible;
+		}
+		ShedLevel shed_level = (ShedLevel)control->shed_level.load();
+		if (shed_level != applied_shed_level) {
+			mpv.set_shed_level(shed_level);
+			applied_shed_level = shed_level;
+		}
+		int width = control->tile_width.load();
+		int height = control->tile_height.load();
+		if (width != applied_width || height != applied_height) {
+			mpv.set_tile_size(width, height);
+			applied_width = width;
+			applied_height = height;
+		}
+
+		if (std::chrono::steady_clock::now() - last_beat_time < std::chrono::milliseconds(WORKER_HEARTBEAT_INTERVAL_MS)) {
+			continue;
+		}
+		last_beat_time = std::chrono::steady_clock::now();
+
+		// nobody would ever stop us
+		int64_t wall_heartbeat_ms = control->wall_heartbeat_ms.load();
+		if (system_now_ms() - wall_heartbeat_ms > WORKER_WALL_TIMEOUT_MS) {
+			SPDLOG_WARN("[worker] wall silent for {} ms, exit\n", system_now_ms() - wall_heartbeat_ms);
+			break;
+		}
+
+		// a hung core blocks here, the missing heartbeat tells the wall
+		PlayerStatistics stats;
+		mpv.get_statistics(stats);
+
+		StatsTile tile;
+		memset(&tile, 0, sizeof(StatsTile));
+		tile.index = -1;
+		tile.player_id = mpv.get_id();
+		tile.buffer_size = stats.buffer_size;
+		tile.buffer_fill = stats.buffer_fill;
+		tile.input_bytes = stats.input_bytes;
+		tile.output_bytes = stats.output_bytes;
+		tile.bitrate = stats.input_bitrate;
+		tile.shed_level = (uint32_t)applied_shed_level;
+		tile.fps = stats.fps;
+		tile.speed = stats.speed;
+		tile.frame_drops = stats.frame_drops;
+		tile.decoder_frame_drops = stats.decoder_frame_drops;
+		tile.restarts = stats.restarts;
+		tile.write_stalls = stats.write_stalls;
+		tile.read_stalls = stats.read_stalls;
+
+		uint32_t sequence = control->stats_sequence.load(std::memory_order_relaxed);
+		control->stats_sequence.store(sequence + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		memcpy((void *)&control->stats, &tile, sizeof(StatsTile));
+		control->stats_sequence.store(sequence + 2, std::memory_order_release);
+
+		control->worker_heartbeat_ms.store(system_now_ms());
+	}
+
+	ring.stopping();
+	mpv.stopping();
+	pump.join();
+	mpv.stop();
+
+	control->state.store((uint32_t)WorkerState::Exited);
+	SPDLOG_INFO("[worker] player exited\n");
+	memory.detach();
+
+	return 0;
+}
+
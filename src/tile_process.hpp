@@ -0,0 +1,196 @@
+#pragma once
+
+// c
+#include <stdint.h>
+
+// c++
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+
+// project
+#include "spsc.hpp"
+#include "stats_segment.hpp"
+
+// qt
+class QSharedMemory;
+
+// project
+struct PlayerStatistics;
+enum class ShedLevel : uint8_t;
+
+
+#ifndef DEFAULT_WORKER_RING_SIZE
+#define DEFAULT_WORKER_RING_SIZE (1024 * 1024)
+#endif // !DEFAULT_WORKER_RING_SIZE
+
+#define TILE_CONTROL_MAGIC 0x4c495451
+#define TILE_CONTROL_VERSION 3
+#define WORKER_HEARTBEAT_INTERVAL_MS 500
+// a worker silent this long is hung or dead and gets relaunched
+#define WORKER_HEARTBEAT_TIMEOUT_MS 5000
+// a worker whose wall is silent this long exits
+#define WORKER_WALL_TIMEOUT_MS 10000
+#define WORKER_STOP_TIMEOUT_MS 2000
+
+
+
+// life of a worker as it reports it
+enum class WorkerState : uint32_t {
+	Starting = 0,
+	Playing = 1,
+	// player did not start, relaunching will not help before the source changes
+	Failed = 2,
+	Exited = 3,
+};
+
+
+// head of the shared memory of one tile, the ring follows it
+// fixed width fields only, wall and worker may be different builds of the same version
+struct TileControl {
+	uint32_t magic;
+	uint32_t version;
+
+	// set by the wall before launch
+	int32_t decoder_threads;
+	uint32_t quality_governor;
+	uint32_t shown;
+	// the wall feeds video_url even though it is not a local file
+	uint32_t fed_input;
+
+	// wall -> worker, applied within a tick of the worker
+	std::atomic<uint32_t> stopping;
+	std::atomic<uint32_t> visible;
+	std::atomic<uint32_t> audio_enabled;
+	std::atomic<uint32_t> shed_level;
+	std::atomic<int32_t> tile_width;
+	std::atomic<int32_t> tile_height;
+	// milliseconds since epoch the wall last supervised this tile
+	std::atomic<int64_t> wall_heartbeat_ms;
+
+	// worker -> wall
+	std::atomic<uint32_t> state;
+	std::atomic<int64_t> worker_heartbeat_ms;
+	// seqlock of stats, odd while the worker copies them in
+	std::atomic<uint32_t> stats_sequence;
+	StatsTile stats;
+};
+
+
+// how the wall launches workers
+struct TileProcessOptions {
+	// executable of the worker, the wall itself
+	std::string program;
+	std::string profile;
+	std::string vo;
+	std::string hwdec;
+	std::string gpu_api;
+	std::string gpu_context;
+	std::string log_level;
+	// worker log, empty keeps the worker default
+	std::string log_path;
+	// ring of the player inside the worker
+	uint32_t buffer_size;
+	// shared ring the feeder writes into
+	uint32_t ring_size;
+	// vd-lavc-threads, 0 means mpv default
+	int decoder_threads;
+	bool quality_governor;
+	// audio track selected from the start
+	bool audio_enabled;
+	// the feeder writes video_url, a network source ingested by the wall
+	bool fed_input;
+};
+
+
+// wall side of a tile hosted by a child process
+// the feeder writes into a ring in shared memory, the worker pumps it into its own player
+// a crashed or hung worker only takes its tile down and is relaunched by supervise
+class TileProcess {
+public:
+	TileProcess();
+	~TileProcess();
+
+	// lay out the shared memory of the tile and launch its worker, shown false keeps the container hidden
+	bool start(int index, int64_t wid, std::string video_url, bool shown, const TileProcessOptions &options);
+	// ask the worker to exit, kill it if it does not in time, then free the shared memory
+	void stop();
+	// writes fail from now on, stop may follow
+	void stopping();
+
+	// id of current session, changes on every start
+	uint32_t get_id();
+
+	// write av stream to the shared ring, a non-negative id drops data meant for a previous session
+	// data is discarded instead of waiting on a worker that is not alive
+	bool write(const uint8_t *buf, uint32_t length, int64_t id = -1);
+
+	// the worker reported within the heartbeat timeout, or was launched that recently
+	bool is_alive();
+	// beat for the worker, relaunch it when it died or hung, returns false when it was relaunched
+	bool supervise();
+
+	// counters the worker published last
+	void get_statistics(PlayerStatistics &stats);
+
+	// forwarded to the player in the worker
+	void set_visible(bool state);
+	bool is_visible();
+	void set_audio_enabled(bool state);
+	bool is_audio_enabled();
+	void set_tile_size(int width, int height);
+	void set_shed_level(ShedLevel level);
+	ShedLevel get_shed_level();
+
+
+private:
+	// start a worker on the current shared memory
+	bool launch();
+	// end the worker without asking
+	void kill();
+
+	// session id
+	uint32_t m_id;
+	// auto-incrementing index
+	static std::atomic<uint32_t> s_index;
+	// source index, names the shared memory and the worker log
+	int m_index;
+	// shared memory key handed to the worker
+	std::string m_key;
+	int64_t m_wid;
+	std::string m_video_url;
+	bool m_shown;
+	TileProcessOptions m_options;
+	// shared memory of control and ring
+	QSharedMemory *m_memory;
+	TileControl *m_control;
+	lock_free_shared_spsc<uint8_t> m_ring;
+	// worker process id, 0 when none runs
+	int64_t m_pid;
+	std::chrono::steady_clock::time_point m_launch_time;
+	// flag to fail writes
+	std::atomic<bool> m_stopping;
+	// keep the feeder away while the ring is reset or freed
+	std::mutex m_write_mutex;
+	// bytes written to the ring, dropped ones included
+	std::atomic<uint64_t> m_input_bytes;
+	// times the feeder waited for space in the ring
+	std::atomic<uint64_t> m_write_stalls;
+	// workers launched again after a crash or hang
+	std::atomic<uint64_t> m_relaunches;
+	// requested visibility, shed level and audio, kept across relaunches
+	std::atomic<bool> m_visible;
+	std::atomic<ShedLevel> m_shed_level;
+	std::atomic<bool> m_audio_enabled;
+};
+
+
+// worker side: play video_url in wid, fed from the shared memory of key, until the wall says stop or goes away
+int run_tile_worker(
+	std::string key, int64_t wid, std::string video_url,
+	std::string profile, std::string vo, std::string hwdec,
+	std::string gpu_api, std::string gpu_context, std::string log_level,
+	uint32_t buffer_size
+);
+
@@ -0,0 +1,300 @@
+// self
+#include "trace.hpp"
+
+// c
+#include <stdio.h>
+
+// c++
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+// fmt
+#include <fmt/format.h>
+
+// spdlog
+#include <spdlog/spdlog.h>
+
+
+#define TRACE_PID 1
+
+
+
+// ring of one thread, a single writer publishes events by moving head
+struct Tracer::ThreadBuffer {
+	// events written so far, slot is head modulo events per thread
+	std::atomic<uint64_t> head;
+	// taken by a living thread
+	std::atomic<bool> owned;
+	// tracer number of the owner
+	uint32_t thread;
+	TraceEvent *events;
+};
+
+
+// returns the ring when the thread exits
+struct TraceThreadSlot {
+	TraceThreadSlot()
+		: buffer(nullptr)
+		, tried(false)
+	{
+	}
+
+	~TraceThreadSlot();
+
+	Tracer::ThreadBuffer *buffer;
+	// do not scan the rings again after they were all taken
+	bool tried;
+	std::string name;
+};
+
+
+static thread_local TraceThreadSlot t_slot;
+static const std::chrono::steady_clock::time_point s_epoch = std::chrono::steady_clock::now();
+
+
+std::atomic<bool> Tracer::s_enabled(false);
+std::atomic<Tracer::ThreadBuffer *> Tracer::s_buffers(nullptr);
+uint32_t Tracer::s_buffer_count = DEFAULT_TRACE_THREADS;
+uint32_t Tracer::s_events_per_thread = DEFAULT_TRACE_EVENTS_PER_THREAD;
+std::atomic<uint32_t> Tracer::s_next_thread(1);
+std::atomic<uint64_t> Tracer::s_dropped_count(0);
+std::map<uint32_t, std::string> Tracer::s_thread_names;
+std::mutex Tracer::s_mutex;
+std::string Tracer::s_output_path(DEFAULT_TRACE_PATH);
+
+
+
+TraceThreadSlot::~TraceThreadSlot()
+{
+	Tracer::release_buffer(buffer);
+	buffer = nullptr;
+}
+
+
+void Tracer::set_capacity(uint32_t threads, uint32_t events_per_thread)
+{
+	std::lock_guard<std::mutex> lock(s_mutex);
+	if (s_buffers.load() != nullptr) {
+		SPDLOG_WARN("[trace] buffers are allocated, capacity stays {} threads of {} events\n", s_buffer_count, s_events_per_thread);
+		return;
+	}
+	s_buffer_count = std::max(threads, (uint32_t)1);
+	s_events_per_thread = std::max(events_per_thread, (uint32_t)1);
+}
+
+
+void Tracer::set_enabled(bool state)
+{
+	if (state) {
+		std::lock_guard<std::mutex> lock(s_mutex);
+		if (nullptr == s_buffers.load()) {
+			// one block for all events, pages are only touched by threads that record
+			TraceEvent *events = new TraceEvent[(size_t)s_buffer_count * s_events_per_thread];
+			ThreadBuffer *buffers = new ThreadBuffer[s_buffer_count];
+			for (uint32_t i = 0; i < s_buffer_count; i++) {
+				buffers[i].head = 0;
+				buffers[i].owned = false;
+				buffers[i].thread = 0;
+				buffers[i].events = events + (size_t)i * s_events_per_thread;
+			}
+			s_buffers.store(buffers, std::memory_order_release);
+			SPDLOG_INFO("[trace] {} threads of {} events allocated\n", s_buffer_count, s_events_per_thread);
+		}
+	}
+
+	s_enabled.store(state);
+	SPDLOG_INFO("[trace] recording {}\n", state ? "on" : "off");
+}
+
+
+void Tracer::set_thread_name(const std::string &name)
+{
+	t_slot.name = name;
+
+	// a ring taken before the thread was named
+	if (t_slot.buffer != nullptr) {
+		std::lock_guard<std::mutex> lock(s_mutex);
+		s_thread_names[t_slot.buffer->thread] = name;
+	}
+}
+
+
+uint64_t Tracer::now_ns()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - s_epoch).count();
+}
+
+
+void Tracer::complete(const char *category, const char *name, uint64_t begin_ns, int64_t id, int64_t value)
+{
+	uint64_t end_ns = now_ns();
+	record(TracePhase::Complete, category, name, begin_ns, end_ns > begin_ns ? end_ns - begin_ns : 0, id, value);
+}
+
+
+void Tracer::instant(const char *category, const char *name, int64_t id, int64_t value)
+{
+	record(TracePhase::Instant, category, name, now_ns(), 0, id, value);
+}
+
+
+void Tracer::counter(const char *category, const char *name, int64_t id, int64_t value)
+{
+	record(TracePhase::Counter, category, name, now_ns(), 0, id, value);
+}
+
+
+void Tracer::set_output_path(const std::string &path)
+{
+	std::lock_guard<std::mutex> lock(s_mutex);
+	s_output_path = path;
+}
+
+
+bool Tracer::dump()
+{
+	std::string path;
+	{
+		std::lock_guard<std::mutex> lock(s_mutex);
+		path = s_output_path;
+	}
+	return dump(path);
+}
+
+
+bool Tracer::dump(const std::string &path)
+{
+	FILE *file = fopen(path.c_str(), "w");
+	if (nullptr == file) {
+		SPDLOG_ERROR("[trace] open {} error\n", path);
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(s_mutex);
+
+	fmt::print(file, "{{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	fmt::print(file, "{{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":{},\"tid\":0,\"args\":{{\"name\":\"qt-mpv\"}}}}", TRACE_PID);
+	for (auto iter = s_thread_names.begin(); iter != s_thread_names.end(); iter++) {
+		fmt::print(file, ",\n{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":{},\"tid\":{},\"args\":{{\"name\":\"{}\"}}}}", TRACE_PID, iter->first, iter->second);
+	}
+
+	uint64_t count = 0;
+	ThreadBuffer *buffers = s_buffers.load(std::memory_order_acquire);
+	std::vector<TraceEvent> events(buffers != nullptr ? s_events_per_thread : 0);
+	for (uint32_t i = 0; buffers != nullptr && i < s_buffer_count; i++) {
+		ThreadBuffer *buffer = &buffers[i];
+
+		// copy, then drop what the owner overwrote meanwhile, including the slot it may be writing
+		uint64_t head = buffer->head.load(std::memory_order_acquire);
+		uint64_t begin = head > s_events_per_thread ? head - s_events_per_thread : 0;
+		for (uint64_t index = begin; index < head; index++) {
+			events[index - begin] = buffer->events[index % s_events_per_thread];
+		}
+		uint64_t new_head = buffer->head.load(std::memory_order_acquire);
+		uint64_t valid_begin = new_head > s_events_per_thread ? new_head - s_events_per_thread : 0;
+		if (new_head != head) {
+			valid_begin++;
+		}
+
+		for (uint64_t index = std::max(begin, valid_begin); index < head; index++) {
+			const TraceEvent &event = events[index - begin];
+			double ts = event.begin_ns / 1000.0;
+			switch (event.phase) {
+			case TracePhase::Complete:
+				fmt::print(
+					file, ",\n{{\"name\":\"{}\",\"cat\":\"{}\",\"ph\":\"X\",\"ts\":{:.3f},\"dur\":{:.3f},\"pid\":{},\"tid\":{},\"args\":{{\"id\":{},\"value\":{}}}}}",
+					event.name, event.category, ts, event.duration_ns / 1000.0, TRACE_PID, event.thread, event.id, event.value
+				);
+				break;
+			case TracePhase::Instant:
+				fmt::print(
+					file, ",\n{{\"name\":\"{}\",\"cat\":\"{}\",\"ph\":\"i\",\"s\":\"t\",\"ts\":{:.3f},\"pid\":{},\"tid\":{},\"args\":{{\"id\":{},\"value\":{}}}}}",
+					event.name, event.category, ts, TRACE_PID, event.thread, event.id, event.value
+				);
+				break;
+			case TracePhase::Counter:
+				// one track per counter and player
+				fmt::print(
+					file, ",\n{{\"name\":\"{} {}\",\"cat\":\"{}\",\"ph\":\"C\",\"ts\":{:.3f},\"pid\":{},\"args\":{{\"value\":{}}}}}",
+					event.name, event.id, event.category, ts, TRACE_PID, event.value
+				);
+				break;
+			}
+			count++;
+		}
+	}
+
+	fmt::print(file, "\n]}}\n");
+	fclose(file);
+
+	SPDLOG_INFO("[trace] {} events written to {}, {} dropped for lack of thread buffers\n", count, path, s_dropped_count.load());
+
+	return true;
+}
+
+
+Tracer::ThreadBuffer *Tracer::thread_buffer()
+{
+	if (t_slot.buffer != nullptr || t_slot.tried) {
+		return t_slot.buffer;
+	}
+
+	t_slot.tried = true;
+	t_slot.buffer = acquire_buffer();
+	return t_slot.buffer;
+}
+
+
+Tracer::ThreadBuffer *Tracer::acquire_buffer()
+{
+	ThreadBuffer *buffers = s_buffers.load(std::memory_order_acquire);
+	if (nullptr == buffers) {
+		return nullptr;
+	}
+
+	for (uint32_t i = 0; i < s_buffer_count; i++) {
+		bool owned = false;
+		if (buffers[i].owned.compare_exchange_strong(owned, true, std::memory_order_acquire)) {
+			// events of the previous owner keep their thread number
+			buffers[i].thread = s_next_thread++;
+			std::lock_guard<std::mutex> lock(s_mutex);
+			s_thread_names[buffers[i].thread] = t_slot.name.empty() ? fmt::format("thread {}", buffers[i].thread) : t_slot.name;
+			return &buffers[i];
+		}
+	}
+
+	SPDLOG_WARN("[trace] all {} thread buffers are taken, events of this thread are dropped\n", s_buffer_count);
+	return nullptr;
+}
+
+
+void Tracer::release_buffer(ThreadBuffer *buffer)
+{
+	if (buffer != nullptr) {
+		buffer->owned.store(false, std::memory_order_release);
+	}
+}
+
+
+void Tracer::record(TracePhase phase, const char *category, const char *name, uint64_t begin_ns, uint64_t duration_ns, int64_t id, int64_t value)
+{
+	ThreadBuffer *buffer = thread_buffer();
+	if (nullptr == buffer) {
+		s_dropped_count++;
+		return;
+	}
+
+	uint64_t head = buffer->head.load(std::memory_order_relaxed);
+	TraceEvent &event = buffer->events[head % s_events_per_thread];
+	event.category = category;
+	event.name = name;
+	event.begin_ns = begin_ns;
+	event.duration_ns = duration_ns;
+	event.id = id;
+	event.value = value;
+	event.thread = buffer->thread;
+	event.phase = phase;
+	buffer->head.store(head + 1, std::memory_order_release);
+}
+
@@ -0,0 +1,170 @@
+#pragma once
+
+// c
+#include <stdint.h>
+
+// c++
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+
+
+#ifndef DEFAULT_TRACE_THREADS
+#define DEFAULT_TRACE_THREADS 256
+#endif // !DEFAULT_TRACE_THREADS
+
+#ifndef DEFAULT_TRACE_EVENTS_PER_THREAD
+#define DEFAULT_TRACE_EVENTS_PER_THREAD 4096
+#endif // !DEFAULT_TRACE_EVENTS_PER_THREAD
+
+#ifndef DEFAULT_TRACE_PATH
+#define DEFAULT_TRACE_PATH "qt-mpv-trace.json"
+#endif // !DEFAULT_TRACE_PATH
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+// span from here to the end of the scope, names must outlive the process (string literals)
+#define TRACE_SPAN(category, name, id) TraceSpan TRACE_CONCAT(trace_span_, __LINE__)(category, name, id)
+// point in time
+#define TRACE_INSTANT(category, name, id, value) do { if (Tracer::is_enabled()) { Tracer::instant(category, name, id, value); } } while (false)
+// value over time
+#define TRACE_COUNTER(category, name, id, value) do { if (Tracer::is_enabled()) { Tracer::counter(category, name, id, value); } } while (false)
+
+
+
+// chrome trace-event phase of an event
+enum class TracePhase : char {
+	Complete = 'X',
+	Instant = 'i',
+	Counter = 'C',
+};
+
+
+// one recorded event
+struct TraceEvent {
+	// string literals, never copied
+	const char *category;
+	const char *name;
+	// since tracer epoch
+	uint64_t begin_ns;
+	uint64_t duration_ns;
+	// player id, negative means none
+	int64_t id;
+	// bytes, speed, counter value
+	int64_t value;
+	// tracer number of the recording thread
+	uint32_t thread;
+	TracePhase phase;
+};
+
+
+// records spans, instants and counters into per-thread rings and dumps them as chrome trace-event json for perfetto
+// buffers are allocated on first enable, recording only takes a relaxed load when disabled and never allocates
+class Tracer {
+public:
+	// takes effect on first enable
+	static void set_capacity(uint32_t threads, uint32_t events_per_thread);
+
+	// switch recording at runtime
+	static void set_enabled(bool state);
+	static bool is_enabled()
+	{
+		return s_enabled.load(std::memory_order_relaxed);
+	}
+
+	// name of calling thread in the timeline, call once when a thread starts
+	static void set_thread_name(const std::string &name);
+
+	// nanoseconds since tracer epoch
+	static uint64_t now_ns();
+
+	// record an event on calling thread
+	static void complete(const char *category, const char *name, uint64_t begin_ns, int64_t id, int64_t value = 0);
+	static void instant(const char *category, const char *name, int64_t id, int64_t value = 0);
+	static void counter(const char *category, const char *name, int64_t id, int64_t value);
+
+	// file of dump without path
+	static void set_output_path(const std::string &path);
+	// write the events still in the rings, recording may go on meanwhile
+	static bool dump();
+	static bool dump(const std::string &path);
+
+
+protected:
+	friend struct TraceThreadSlot;
+	struct ThreadBuffer;
+
+	// ring of calling thread, nullptr when all are taken
+	static ThreadBuffer *thread_buffer();
+
+	// hand a ring to calling thread
+	static ThreadBuffer *acquire_buffer();
+	// a thread exited, its events stay until the next owner overwrites them
+	static void release_buffer(ThreadBuffer *buffer);
+
+	static void record(TracePhase phase, const char *category, const char *name, uint64_t begin_ns, uint64_t duration_ns, int64_t id, int64_t value);
+
+
+private:
+	// recording switch
+	static std::atomic<bool> s_enabled;
+	// rings, allocated once and never freed, threads keep pointers to them
+	static std::atomic<ThreadBuffer *> s_buffers;
+	static uint32_t s_buffer_count;
+	static uint32_t s_events_per_thread;
+	// next thread number
+	static std::atomic<uint32_t> s_next_thread;
+	// events lost because every ring was taken
+	static std::atomic<uint64_t> s_dropped_count;
+	// thread names by thread number
+	static std::map<uint32_t, std::string> s_thread_names;
+	// guard allocation, names and output path
+	static std::mutex s_mutex;
+	static std::string s_output_path;
+};
+
+
+// records a complete event when it leaves scope
+class TraceSpan {
+public:
+	TraceSpan(const char *category, const char *name, int64_t id)
+		: m_category(category)
+		, m_name(name)
+		, m_id(id)
+		, m_value(0)
+		, m_begin_ns(0)
+		, m_active(Tracer::is_enabled())
+	{
+		if (m_active) {
+			m_begin_ns = Tracer::now_ns();
+		}
+	}
+
+	~TraceSpan()
+	{
+		if (m_active) {
+			Tracer::complete(m_category, m_name, m_begin_ns, m_id, m_value);
+		}
+	}
+
+	TraceSpan(const TraceSpan &) = delete;
+	TraceSpan &operator=(const TraceSpan &) = delete;
+
+	// shown as an arg of the span
+	void set_value(int64_t value)
+	{
+		m_value = value;
+	}
+
+
+private:
+	const char *m_category;
+	const char *m_name;
+	int64_t m_id;
+	int64_t m_value;
+	uint64_t m_begin_ns;
+	bool m_active;
+};
+
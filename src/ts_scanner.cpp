@@ -0,0 +1,190 @@
+// self
+#include "ts_scanner.hpp"
+
+// c++
+#include <algorithm>
+
+
+#define TS_SYNC_BYTE 0x47
+#define TS_PAT_PID 0x0000
+#define TS_NULL_PID 0x1fff
+#define TS_PAT_TABLE_ID 0x00
+#define TS_PMT_TABLE_ID 0x02
+// crc32 closing every section
+#define TS_CRC_SIZE 4
+
+
+
+// stream types of video elementary streams in a pmt
+static bool is_video_stream_type(uint8_t stream_type)
+{
+	switch (stream_type) {
+	case 0x01: // mpeg-1
+	case 0x02: // mpeg-2
+	case 0x10: // mpeg-4 part 2
+	case 0x1b: // h.264
+	case 0x20: // h.264 mvc
+	case 0x24: // hevc
+	case 0x33: // vvc
+	case 0x42: // avs
+	case 0xd1: // dirac
+	case 0xea: // vc-1
+		return true;
+	default:
+		return false;
+	}
+}
+
+
+TsKeyframeScanner::TsKeyframeScanner()
+{
+	reset();
+}
+
+
+void TsKeyframeScanner::reset()
+{
+	m_packet_pos = 0;
+	m_packet_offset = 0;
+	m_pmt_pid = -1;
+	m_video_pid = -1;
+	m_has_keyframe = false;
+	m_keyframe_offset = 0;
+}
+
+
+void TsKeyframeScanner::feed(const uint8_t *buf, uint32_t length, uint32_t offset)
+{
+	uint32_t i = 0;
+	while (i < length) {
+		if (0 == m_packet_pos) {
+			// lost sync, wait for the next sync byte
+			if (buf[i] != TS_SYNC_BYTE) {
+				i++;
+				continue;
+			}
+			m_packet_offset = offset + i;
+		}
+
+		uint32_t copy = std::min(TS_PACKET_SIZE - m_packet_pos, length - i);
+		std::copy(buf + i, buf + i + copy, m_packet + m_packet_pos);
+		i += copy;
+		m_packet_pos += copy;
+		if (TS_PACKET_SIZE == m_packet_pos) {
+			parse_packet();
+			m_packet_pos = 0;
+		}
+	}
+}
+
+
+bool TsKeyframeScanner::get_last_keyframe(uint32_t &offset)
+{
+	if (!m_has_keyframe) {
+		return false;
+	}
+	offset = m_keyframe_offset;
+	return true;
+}
+
+
+void TsKeyframeScanner::parse_packet()
+{
+	bool payload_unit_start = (m_packet[1] & 0x40) != 0;
+	int pid = ((m_packet[1] & 0x1f) << 8) | m_packet[2];
+	bool has_adaptation_field = (m_packet[3] & 0x20) != 0;
+	bool has_payload = (m_packet[3] & 0x10) != 0;
+	if (TS_NULL_PID == pid) {
+		return;
+	}
+
+	uint32_t payload_pos = 4;
+	bool random_access = false;
+	if (has_adaptation_field) {
+		uint8_t adaptation_field_length = m_packet[4];
+		random_access = adaptation_field_length > 0 && (m_packet[5] & 0x40) != 0;
+		payload_pos += 1 + adaptation_field_length;
+	}
+	if (!has_payload || !payload_unit_start || payload_pos >= TS_PACKET_SIZE) {
+		return;
+	}
+	const uint8_t *payload = m_packet + payload_pos;
+	uint32_t payload_length = TS_PACKET_SIZE - payload_pos;
+
+	if (TS_PAT_PID == pid) {
+		parse_pat(payload, payload_length);
+		return;
+	}
+	if (pid == m_pmt_pid) {
+		parse_pmt(payload, payload_length);
+		return;
+	}
+
+	if (!random_access) {
+		return;
+	}
+
+	// the video pid when the pmt told it, a pes of a video stream id (0xe0 - 0xef) before that
+	bool video = false;
+	if (m_video_pid >= 0) {
+		video = pid == m_video_pid;
+	}
+	else {
+		video = payload_length >= 4 && 0x00 == payload[0] && 0x00 == payload[1] && 0x01 == payload[2] && (payload[3] & 0xf0) == 0xe0;
+	}
+	if (video) {
+		m_has_keyframe = true;
+		m_keyframe_offset = m_packet_offset;
+	}
+}
+
+
+void TsKeyframeScanner::parse_pat(const uint8_t *payload, uint32_t length)
+{
+	// pointer field, then the section, which fits the packet in any real stream
+	uint32_t table_pos = 1 + payload[0];
+	if (table_pos + 8 > length || payload[table_pos] != TS_PAT_TABLE_ID) {
+		return;
+	}
+	const uint8_t *table = payload + table_pos;
+	uint32_t section_end = std::min((uint32_t)(3 + (((table[1] & 0x0f) << 8) | table[2])), length - table_pos);
+	if (section_end < 8 + TS_CRC_SIZE) {
+		return;
+	}
+
+	// first program, 0 is the network pid
+	for (uint32_t pos = 8; pos + 4 <= section_end - TS_CRC_SIZE; pos += 4) {
+		int program_number = (table[pos] << 8) | table[pos + 1];
+		if (program_number != 0) {
+			m_pmt_pid = ((table[pos + 2] & 0x1f) << 8) | table[pos + 3];
+			return;
+		}
+	}
+}
+
+
+void TsKeyframeScanner::parse_pmt(const uint8_t *payload, uint32_t length)
+{
+	uint32_t table_pos = 1 + payload[0];
+	if (table_pos + 12 > length || payload[table_pos] != TS_PMT_TABLE_ID) {
+		return;
+	}
+	const uint8_t *table = payload + table_pos;
+	uint32_t section_end = std::min((uint32_t)(3 + (((table[1] & 0x0f) << 8) | table[2])), length - table_pos);
+	if (section_end < 12 + TS_CRC_SIZE) {
+		return;
+	}
+	uint32_t program_info_length = ((table[10] & 0x0f) << 8) | table[11];
+
+	// first video stream of the program
+	for (uint32_t pos = 12 + program_info_length; pos + 5 <= section_end - TS_CRC_SIZE;) {
+		uint8_t stream_type = table[pos];
+		int pid = ((table[pos + 1] & 0x1f) << 8) | table[pos + 2];
+		uint32_t es_info_length = ((table[pos + 3] & 0x0f) << 8) | table[pos + 4];
+		if (is_video_stream_type(stream_type)) {
+			m_video_pid = pid;
+			return;
+		}
+		pos += 5 + es_info_length;
+	}
+}
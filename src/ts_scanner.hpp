@@ -0,0 +1,47 @@
+#pragma once
+
+// c
+#include <stdint.h>
+
+
+
+#define TS_PACKET_SIZE 188
+
+
+
+// finds mpeg-ts packets that start a random access point (key frame) of the video stream in a byte stream
+// the video pid comes from pat and pmt, until they show up a pes of a video stream id counts
+// audio pes carry the random access indicator on every frame and never count
+class TsKeyframeScanner {
+public:
+	TsKeyframeScanner();
+
+	// forget everything, next byte is at offset 0
+	void reset();
+
+	// scan bytes that follow the previous ones, offset is the stream position of buf
+	void feed(const uint8_t *buf, uint32_t length, uint32_t offset);
+
+	// stream position of the last key frame packet
+	bool get_last_keyframe(uint32_t &offset);
+
+
+private:
+	// a whole packet is in m_packet
+	void parse_packet();
+	void parse_pat(const uint8_t *payload, uint32_t length);
+	void parse_pmt(const uint8_t *payload, uint32_t length);
+
+	// byte of current packet being scanned, 0 waits for sync byte
+	uint32_t m_packet_pos;
+	// stream position of current packet
+	uint32_t m_packet_offset;
+	uint8_t m_packet[TS_PACKET_SIZE];
+	// pid of the pmt of the first program and of its video stream, -1 until known
+	int m_pmt_pid;
+	int m_video_pid;
+	// last key frame was found
+	bool m_has_keyframe;
+	// stream position of last key frame packet
+	uint32_t m_keyframe_offset;
+};
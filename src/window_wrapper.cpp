@@ -4,12 +4,34 @@
 // c
 #include <math.h>
 
+// c++
+#include <algorithm>
+#include <set>
 
+// spdlog
+#include <spdlog/spdlog.h>
 
-WindowWrapper::WindowWrapper()
+// qt
+#include <QtCore/QEvent>
+#include <QtCore/QMetaObject>
+#include <QtCore/QTimer>
+#include <QtGui/QKeyEvent>
+#include <QtGui/QRegion>
+#include <QtGui/QWindow>
+
+// project
+#include "trace.hpp"
+
+
+
+WindowWrapper::WindowWrapper(RenderMode render_mode)
 	: m_layout_ways(PlayerWays::Zero)
 	, m_central_widget(nullptr)
 	, m_grid_layout(nullptr)
+	, m_compositor(nullptr)
+	, m_prefetch_tiles(0)
+	, m_page(0)
+	, m_change_serial(0)
 {
 	setContextMenuPolicy(Qt::NoContextMenu);
 
@@ -20,6 +42,16 @@ WindowWrapper::WindowWrapper()
 	m_grid_layout->setHorizontalSpacing(0);
 	m_grid_layout->setVerticalSpacing(0);
 	m_grid_layout->setContentsMargins(0, 0, 0, 0);
+
+	if (RenderMode::Software == render_mode) {
+		m_compositor = new RenderCompositor(&m_mpv_manager, m_central_widget);
+		m_compositor->installEventFilter(this);
+		m_grid_layout->addWidget(m_compositor, 0, 0);
+
+		RenderCompositor *compositor = m_compositor;
+		m_mpv_manager.set_render_mode(RenderMode::Software);
+		m_mpv_manager.set_render_update_callback([compositor]() { compositor->request_update(); });
+	}
 }
 
 
@@ -30,7 +62,7 @@ WindowWrapper::~WindowWrapper()
 
 
 bool WindowWrapper::create_players(
-	int ways, int gpu_ways, std::string video_url,
+	int ways, int gpu_ways, std::vector<std::string> sources, int prefetch_tiles,
 	std::string profile, std::string vo, std::string hwdec,
 	std::string gpu_api, std::string gpu_context, std::string log_level
 )
@@ -48,6 +80,10 @@ bool WindowWrapper::create_players(
 		return false;
 	}
 
+	if (sources.empty()) {
+		return false;
+	}
+
 	// no need to re-create
 	if (player_ways == m_layout_ways) {
 		return false;
@@ -57,9 +93,13 @@ bool WindowWrapper::create_players(
 
 	// remove exists
 	for (auto iter = m_index_to_widget.begin(); iter != m_index_to_widget.end(); iter++) {
+		m_mpv_manager.detach_player(iter->first);
+		release_standby_widget(iter->first);
 		iter->second->hide();
 		m_grid_layout->removeWidget(iter->second);
+		m_idle_widgets.push_back(iter->second);
 	}
+	m_index_to_widget.clear();
 
 	// re-create
 	const double epsinon = 1e-8;
@@ -89,7 +129,7 @@ bool WindowWrapper::create_players(
 		}
 	}
 
-	int index = 0;
+	m_tile_cells.clear();
 	for (int row_index = 0; row_index < rows; row_index++) {
 		for (int column_index = 0; column_index < columns; column_index++) {
 			int row_span = -1;
@@ -104,33 +144,447 @@ bool WindowWrapper::create_players(
 			}
 
 			if (row_span > 0 && column_span > 0) {
-				QWidget *w = nullptr;
-				auto iter = m_index_to_widget.find(index);
-				if (iter != m_index_to_widget.end()) {
-					w = iter->second;
-				}
-				else {
-					w = new QWidget();
-					m_index_to_widget.insert(std::make_pair(index, w));
-				}
+				m_tile_cells.push_back(TileCell{ row_index, column_index, row_span, column_span });
+			}
+		}
+	}
 
-				m_grid_layout->addWidget(w, row_index, column_index, row_span, column_span);
+	if (m_compositor != nullptr) {
+		m_compositor->clear_tiles();
+		for (int index : m_mpv_manager.get_attached_indexes()) {
+			m_mpv_manager.detach_player(index);
+		}
+		m_compositor->set_grid(rows, columns);
+	}
 
-				w->show();
+	m_sources = sources;
+	m_prefetch_tiles = std::max(0, prefetch_tiles);
+	m_page = 0;
 
-				index++;
-			}
-		}
+	m_mpv_manager.set_player_options(gpu_ways, profile, vo, hwdec, gpu_api, gpu_context, log_level);
+	m_mpv_manager.reserve_buffers((uint32_t)std::min((int)m_sources.size(), ways + 2 * m_prefetch_tiles));
+
+	// expose events of the native window tell when it is fully covered
+	if (windowHandle() != nullptr) {
+		windowHandle()->removeEventFilter(this);
+		windowHandle()->installEventFilter(this);
 	}
 
-	return m_mpv_manager.start_players(m_index_to_widget, gpu_ways, video_url, profile, vo, hwdec, gpu_api, gpu_context, log_level);
+	return show_page(0);
 }
 
 
 void WindowWrapper::destroy_players()
 {
+	if (m_compositor != nullptr) {
+		m_compositor->clear_tiles();
+	}
 	m_index_to_widget.clear();
+	m_index_to_standby_widget.clear();
+	m_index_to_change_serial.clear();
 	m_layout_ways = PlayerWays::Zero;
 
 	m_mpv_manager.stop_players();
 }
+
+
+bool WindowWrapper::show_page(int page)
+{
+	int ways = (int)m_tile_cells.size();
+	if (0 == ways || m_sources.empty()) {
+		return false;
+	}
+
+	page = std::max(0, std::min(page, get_page_count() - 1));
+
+	// sources on page, then sources kept decoding around it
+	int page_begin = page * ways;
+	int page_end = std::min((int)m_sources.size(), page_begin + ways);
+	int active_begin = std::max(0, page_begin - m_prefetch_tiles);
+	int active_end = std::min((int)m_sources.size(), page_end + m_prefetch_tiles);
+
+	if (m_compositor != nullptr) {
+		bool result = show_page_sw(page_begin, page_end, active_begin, active_end);
+		m_page = page;
+		SPDLOG_INFO("show page {} of {}, sources [{}, {}), decoding [{}, {})\n", page + 1, get_page_count(), page_begin, page_end, active_begin, active_end);
+		update_tiles_visibility();
+		return result;
+	}
+
+	// recycle sources that left the window, take tiles that left the page out of the grid
+	for (auto iter = m_index_to_widget.begin(); iter != m_index_to_widget.end();) {
+		QWidget *w = iter->second;
+		if (iter->first < page_begin || iter->first >= page_end) {
+			w->hide();
+			m_grid_layout->removeWidget(w);
+		}
+
+		if (iter->first < active_begin || iter->first >= active_end) {
+			m_mpv_manager.detach_player(iter->first);
+			release_standby_widget(iter->first);
+			m_idle_widgets.push_back(w);
+			iter = m_index_to_widget.erase(iter);
+		}
+		else {
+			iter++;
+		}
+	}
+
+	std::vector<int> new_indexes;
+	for (int index = active_begin; index < active_end; index++) {
+		QWidget *w = nullptr;
+		auto iter = m_index_to_widget.find(index);
+		if (iter != m_index_to_widget.end()) {
+			w = iter->second;
+		}
+		else {
+			w = acquire_widget();
+			m_index_to_widget.insert(std::make_pair(index, w));
+			new_indexes.push_back(index);
+		}
+
+		if (index >= page_begin && index < page_end) {
+			const TileCell &cell = m_tile_cells[index - page_begin];
+			m_grid_layout->addWidget(w, cell.row, cell.column, cell.row_span, cell.column_span);
+			w->show();
+		}
+	}
+
+	// lay out now, so the manager sees real tile sizes
+	m_grid_layout->activate();
+
+	// tiles on page first, they get the gpu decoders and the larger thread shares
+	std::stable_partition(new_indexes.begin(), new_indexes.end(), [page_begin, page_end](int index) { return index >= page_begin && index < page_end; });
+
+	bool result = true;
+	for (int index : new_indexes) {
+		QWidget *w = m_index_to_widget[index];
+		bool on_page = index >= page_begin && index < page_end;
+		int64_t area = on_page ? (int64_t)w->width() * w->height() : 0;
+		if (!m_mpv_manager.attach_player(index, (int64_t)w->winId(), m_sources[index], area, on_page)) {
+			result = false;
+			continue;
+		}
+		if (on_page) {
+			m_mpv_manager.set_tile_size(index, w->width(), w->height());
+		}
+	}
+
+	m_page = page;
+	SPDLOG_INFO("show page {} of {}, sources [{}, {}), decoding [{}, {})\n", page + 1, get_page_count(), page_begin, page_end, active_begin, active_end);
+
+	update_tiles_visibility();
+
+	return result;
+}
+
+
+bool WindowWrapper::show_page_sw(int page_begin, int page_end, int active_begin, int active_end)
+{
+	std::set<int> attached = m_mpv_manager.get_attached_indexes();
+	for (int index : attached) {
+		if (index < active_begin || index >= active_end) {
+			m_mpv_manager.detach_player(index);
+		}
+	}
+
+	m_compositor->clear_tiles();
+
+	// tiles on page first, they get the gpu decoders and the larger thread shares
+	bool result = true;
+	for (int pass = 0; pass < 2; pass++) {
+		for (int index = active_begin; index < active_end; index++) {
+			bool on_page = index >= page_begin && index < page_end;
+			if (on_page != (0 == pass)) {
+				continue;
+			}
+
+			if (attached.count(index) == 0) {
+				int64_t area = 0;
+				if (on_page) {
+					QRect rect = m_compositor->get_cell_rect(m_tile_cells[index - page_begin]);
+					area = (int64_t)rect.width() * rect.height();
+				}
+				if (!m_mpv_manager.attach_player(index, 0, m_sources[index], area, on_page)) {
+					result = false;
+					continue;
+				}
+			}
+
+			if (on_page) {
+				m_compositor->set_tile(index, m_tile_cells[index - page_begin]);
+			}
+		}
+	}
+
+	return result;
+}
+
+
+int WindowWrapper::get_page()
+{
+	return m_page;
+}
+
+
+int WindowWrapper::get_page_count()
+{
+	int ways = (int)m_tile_cells.size();
+	if (0 == ways) {
+		return 0;
+	}
+	return ((int)m_sources.size() + ways - 1) / ways;
+}
+
+
+
+bool WindowWrapper::change_source(int index, std::string video_url)
+{
+	if (index < 0 || index >= (int)m_sources.size()) {
+		return false;
+	}
+
+	m_sources[index] = video_url;
+	if (m_mpv_manager.get_attached_indexes().count(index) == 0) {
+		return true;
+	}
+
+	int ways = (int)m_tile_cells.size();
+	bool on_page = index >= m_page * ways && index < (m_page + 1) * ways;
+	auto iter = m_index_to_widget.find(index);
+	QWidget *w = iter != m_index_to_widget.end() ? iter->second : nullptr;
+
+	// a change still in flight is superseded
+	release_standby_widget(index);
+
+	// software render mode draws by index, the standby needs no container
+	QWidget *standby = nullptr;
+	if (w != nullptr) {
+		standby = acquire_widget();
+		standby->setGeometry(w->geometry().x(), w->geometry().y(), w->width(), w->height());
+	}
+
+	auto callback = [this](int ready_index) {
+		QMetaObject::invokeMethod(this, [this, ready_index]() { finish_channel_change(ready_index, false); }, Qt::QueuedConnection);
+	};
+	if (!m_mpv_manager.change_channel(index, nullptr == standby ? 0 : (int64_t)standby->winId(), video_url, callback)) {
+		if (standby != nullptr) {
+			m_idle_widgets.push_back(standby);
+		}
+
+		// switch cold in the current container
+		SPDLOG_INFO("tile {} switches cold to {}\n", index, video_url);
+		int64_t area = on_page && w != nullptr ? (int64_t)w->width() * w->height() : 0;
+		if (!m_mpv_manager.attach_player(index, nullptr == w ? 0 : (int64_t)w->winId(), video_url, area, on_page)) {
+			return false;
+		}
+		if (on_page && w != nullptr) {
+			m_mpv_manager.set_tile_size(index, w->width(), w->height());
+		}
+		update_tiles_visibility();
+		return true;
+	}
+
+	if (standby != nullptr) {
+		m_index_to_standby_widget[index] = standby;
+	}
+
+	// a standby that never shows a frame still takes the tile, as a cold start would
+	uint32_t serial = ++m_change_serial;
+	m_index_to_change_serial[index] = serial;
+	QTimer::singleShot(DEFAULT_CHANNEL_CHANGE_TIMEOUT_MS, this, [this, index, serial]() {
+		auto serial_iter = m_index_to_change_serial.find(index);
+		if (serial_iter != m_index_to_change_serial.end() && serial_iter->second == serial) {
+			finish_channel_change(index, true);
+		}
+	});
+
+	return true;
+}
+
+
+MpvManager *WindowWrapper::get_mpv_manager()
+{
+	return &m_mpv_manager;
+}
+
+
+bool WindowWrapper::eventFilter(QObject *watched, QEvent *event)
+{
+	switch (event->type()) {
+	case QEvent::Resize:
+		for (auto iter = m_index_to_widget.begin(); iter != m_index_to_widget.end(); iter++) {
+			if (iter->second == watched) {
+				m_mpv_manager.set_tile_size(iter->first, iter->second->width(), iter->second->height());
+				break;
+			}
+		}
+		break;
+	case QEvent::Show:
+	case QEvent::Hide:
+	case QEvent::Expose:
+		update_tiles_visibility();
+		break;
+	default:
+		break;
+	}
+
+	return QMainWindow::eventFilter(watched, event);
+}
+
+
+void WindowWrapper::changeEvent(QEvent *event)
+{
+	if (QEvent::WindowStateChange == event->type()) {
+		update_tiles_visibility();
+	}
+
+	QMainWindow::changeEvent(event);
+}
+
+
+void WindowWrapper::keyPressEvent(QKeyEvent *event)
+{
+	switch (event->key()) {
+	case Qt::Key_PageDown:
+		show_page(m_page + 1);
+		break;
+	case Qt::Key_PageUp:
+		show_page(m_page - 1);
+		break;
+	case Qt::Key_Home:
+		show_page(0);
+		break;
+	case Qt::Key_End:
+		show_page(get_page_count() - 1);
+		break;
+	case Qt::Key_1:
+	case Qt::Key_2:
+	case Qt::Key_3:
+	case Qt::Key_4:
+	case Qt::Key_5:
+	case Qt::Key_6:
+	case Qt::Key_7:
+	case Qt::Key_8:
+	case Qt::Key_9:
+	{
+		// n-th tile of the page takes audio focus, a key past the page is ignored
+		int index = m_page * (int)m_tile_cells.size() + (event->key() - Qt::Key_1);
+		if ((event->key() - Qt::Key_1) < (int)m_tile_cells.size() && index < (int)m_sources.size()) {
+			m_mpv_manager.set_audio_focus(index);
+		}
+		break;
+	}
+	case Qt::Key_0:
+		m_mpv_manager.set_audio_focus(AUDIO_FOCUS_NONE);
+		break;
+	case Qt::Key_F9:
+		// start recording a timeline, or stop and write it
+		if (Tracer::is_enabled()) {
+			Tracer::set_enabled(false);
+			Tracer::dump();
+		}
+		else {
+			Tracer::set_enabled(true);
+		}
+		break;
+	default:
+		QMainWindow::keyPressEvent(event);
+		break;
+	}
+}
+
+
+QWidget *WindowWrapper::acquire_widget()
+{
+	QWidget *w = nullptr;
+	if (!m_idle_widgets.empty()) {
+		w = m_idle_widgets.back();
+		m_idle_widgets.pop_back();
+	}
+	else {
+		// hidden until it gets a cell, so prefetched sources stay off screen
+		w = new QWidget(m_central_widget);
+		w->hide();
+		w->installEventFilter(this);
+	}
+	return w;
+}
+
+
+void WindowWrapper::finish_channel_change(int index, bool force)
+{
+	// a late reply of a cancelled standby
+	if (m_index_to_change_serial.count(index) == 0 || (!force && !m_mpv_manager.is_channel_ready(index))) {
+		return;
+	}
+	m_index_to_change_serial.erase(index);
+
+	QWidget *standby = nullptr;
+	auto standby_iter = m_index_to_standby_widget.find(index);
+	if (standby_iter != m_index_to_standby_widget.end()) {
+		standby = standby_iter->second;
+		m_index_to_standby_widget.erase(standby_iter);
+	}
+
+	if (!m_mpv_manager.swap_channel(index)) {
+		if (standby != nullptr) {
+			m_idle_widgets.push_back(standby);
+		}
+		return;
+	}
+
+	auto iter = m_index_to_widget.find(index);
+	if (nullptr == standby || iter == m_index_to_widget.end()) {
+		update_tiles_visibility();
+		return;
+	}
+
+	// the standby container takes the cell in one event loop turn, shown before the old one goes
+	QWidget *w = iter->second;
+	int ways = (int)m_tile_cells.size();
+	if (index >= m_page * ways && index < (m_page + 1) * ways) {
+		m_grid_layout->replaceWidget(w, standby);
+		standby->show();
+		m_mpv_manager.set_tile_size(index, standby->width(), standby->height());
+	}
+	w->hide();
+	m_grid_layout->removeWidget(w);
+	iter->second = standby;
+	m_idle_widgets.push_back(w);
+
+	update_tiles_visibility();
+}
+
+
+void WindowWrapper::release_standby_widget(int index)
+{
+	m_index_to_change_serial.erase(index);
+
+	auto standby_iter = m_index_to_standby_widget.find(index);
+	if (standby_iter == m_index_to_standby_widget.end()) {
+		return;
+	}
+	standby_iter->second->hide();
+	m_idle_widgets.push_back(standby_iter->second);
+	m_index_to_standby_widget.erase(standby_iter);
+}
+
+
+void WindowWrapper::update_tiles_visibility()
+{
+	bool window_visible = isVisible() && !isMinimized() && (nullptr == windowHandle() || windowHandle()->isExposed());
+
+	if (m_compositor != nullptr) {
+		for (int index : m_mpv_manager.get_attached_indexes()) {
+			m_mpv_manager.set_tile_visible(index, window_visible && m_compositor->has_tile(index));
+		}
+		return;
+	}
+
+	for (auto iter = m_index_to_widget.begin(); iter != m_index_to_widget.end(); iter++) {
+		QWidget *w = iter->second;
+		bool visible = window_visible && w->isVisible() && !w->visibleRegion().isEmpty();
+		m_mpv_manager.set_tile_visible(iter->first, visible);
+	}
+}
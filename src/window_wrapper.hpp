@@ -3,9 +3,12 @@
 // c++
 #include <map>
 #include <string>
+#include <vector>
 
 // project
 #include "mpv_manager.hpp"
+#include "mpv_wrapper.hpp"
+#include "render_compositor.hpp"
 
 // qt
 #include <QtWidgets/QGridLayout>
@@ -38,16 +41,54 @@ class WindowWrapper : public QMainWindow {
 
 
 public:
-	WindowWrapper();
+	// software render mode composites all tiles in one widget instead of a native window per tile
+	WindowWrapper(RenderMode render_mode = RenderMode::Window);
 	~WindowWrapper();
 
+	// a page shows ways of the sources, prefetch_tiles sources on each side of it decode hidden
 	bool create_players(
-		int ways, int gpu_ways, std::string video_url,
+		int ways, int gpu_ways, std::vector<std::string> sources, int prefetch_tiles,
 		std::string profile,std::string vo, std::string hwdec,
 		std::string gpu_api, std::string gpu_context, std::string log_level
 	);
 	void destroy_players();
 
+	// show a page of sources, players of sources out of page and prefetch margin are recycled
+	bool show_page(int page);
+	int get_page();
+	int get_page_count();
+
+	// switch source at index to video_url, a hidden standby player takes the tile on its first frame
+	// sources without a player take it on the page turn that reaches them
+	bool change_source(int index, std::string video_url);
+
+	MpvManager *get_mpv_manager();
+
+
+protected:
+	// forward tile resize, show, hide and window expose to players
+	bool eventFilter(QObject *watched, QEvent *event) override;
+
+	// minimized or restored
+	void changeEvent(QEvent *event) override;
+
+	// page up and page down turn pages, 1 to 9 move audio focus to a tile of the page, 0 mutes all
+	void keyPressEvent(QKeyEvent *event) override;
+
+	// a container of the idle pool or a new one
+	QWidget *acquire_widget();
+
+	// show_page of software render mode, tiles are cells of the compositor
+	bool show_page_sw(int page_begin, int page_end, int active_begin, int active_end);
+
+	// tell players whether their tile can be seen
+	void update_tiles_visibility();
+
+	// put the standby of index in its tile, force swaps a standby that has no frame yet
+	void finish_channel_change(int index, bool force);
+	// recycle the standby container of index
+	void release_standby_widget(int index);
+
 
 private:
 	MpvManager m_mpv_manager;
@@ -55,6 +96,24 @@ private:
 	PlayerWays m_layout_ways;
 	QWidget* m_central_widget;
 	QGridLayout* m_grid_layout;
+	// only in software render mode
+	RenderCompositor *m_compositor;
+	// cells of one page
+	std::vector<TileCell> m_tile_cells;
+	// all sources of the wall
+	std::vector<std::string> m_sources;
+	// sources decoded hidden on each side of the page
+	int m_prefetch_tiles;
+	// current page
+	int m_page;
+	// containers of sources that have a player, by source index
 	std::map<int, QWidget *> m_index_to_widget;
+	// containers without a source
+	std::vector<QWidget *> m_idle_widgets;
+	// containers of standby players of channel changes in flight, by source index
+	std::map<int, QWidget *> m_index_to_standby_widget;
+	// channel change in flight by source index, a timeout of an earlier one must not end it
+	std::map<int, uint32_t> m_index_to_change_serial;
+	uint32_t m_change_serial;
 };
 
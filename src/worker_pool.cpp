@@ -0,0 +1,83 @@
+// self
+#include "worker_pool.hpp"
+
+// project
+#include "cpu_usage.hpp"
+
+
+
+WorkerPool::WorkerPool(uint32_t threads)
+	: m_stopping(false)
+{
+	if (0 == threads) {
+		threads = cpu_core_count();
+	}
+
+	for (uint32_t i = 0; i < threads; i++) {
+		m_threads.push_back(new std::thread(work_loop, this));
+	}
+}
+
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_tasks_mutex);
+		m_stopping = true;
+	}
+	m_tasks_cond.notify_all();
+
+	for (auto thread : m_threads) {
+		if (thread->joinable()) {
+			thread->join();
+		}
+		delete thread;
+	}
+	m_threads.clear();
+}
+
+
+bool WorkerPool::submit(std::function<void()> task)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_tasks_mutex);
+		if (m_stopping) {
+			return false;
+		}
+		m_tasks.push_back(std::move(task));
+	}
+	m_tasks_cond.notify_one();
+	return true;
+}
+
+
+uint32_t WorkerPool::size()
+{
+	return (uint32_t)m_threads.size();
+}
+
+
+void WorkerPool::work_loop(void *ptr)
+{
+	if (nullptr == ptr) {
+		return;
+	}
+
+	WorkerPool *thiz = (WorkerPool *)ptr;
+
+	while (true) {
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(thiz->m_tasks_mutex);
+			thiz->m_tasks_cond.wait(lock, [thiz]() { return thiz->m_stopping || !thiz->m_tasks.empty(); });
+			// tasks queued before stopping still run, their owners wait for the result
+			if (thiz->m_tasks.empty()) {
+				break;
+			}
+			task = std::move(thiz->m_tasks.front());
+			thiz->m_tasks.pop_front();
+		}
+
+		task();
+	}
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+// c
+#include <stdint.h>
+
+// c++
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+
+// fixed number of threads running submitted tasks in order of submission
+class WorkerPool {
+public:
+	// 0 threads means one per core
+	WorkerPool(uint32_t threads = 0);
+	~WorkerPool();
+
+	// queue a task, false after the pool started stopping
+	bool submit(std::function<void()> task);
+
+	// number of threads
+	uint32_t size();
+
+
+protected:
+	// run tasks until stopping and the queue is drained
+	static void work_loop(void *ptr);
+
+
+private:
+	// flag to break infinite loop
+	bool m_stopping;
+	// pending tasks
+	std::deque<std::function<void()>> m_tasks;
+	// guard pending tasks and stopping flag
+	std::mutex m_tasks_mutex;
+	// wake idle workers
+	std::condition_variable m_tasks_cond;
+	// worker threads
+	std::vector<std::thread *> m_threads;
+};
+
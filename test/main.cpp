@@ -0,0 +1,291 @@
+// project
+#include "gop_cache.hpp"
+#include "ts_scanner.hpp"
+
+// c
+#include <stdio.h>
+
+// c++
+#include <algorithm>
+#include <vector>
+
+#ifdef TEST_PLAYER
+// c++
+#include <chrono>
+#include <future>
+#include <memory>
+
+// project
+#include "mpv_manager.hpp"
+#include "mpv_wrapper.hpp"
+#endif // TEST_PLAYER
+
+
+#define VIDEO_PID 0x100
+#define AUDIO_PID 0x101
+#define PMT_PID 0x1000
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            failures++; \
+        } \
+    } while (false)
+
+
+static int failures = 0;
+
+
+// one packet, payload padded with stuffing, random_access puts the indicator in an adaptation field
+static void put_packet(std::vector<uint8_t> &stream, int pid, bool payload_unit_start, bool random_access, std::vector<uint8_t> payload)
+{
+    std::vector<uint8_t> packet = {
+        0x47, (uint8_t)((payload_unit_start ? 0x40 : 0x00) | (pid >> 8)), (uint8_t)(pid & 0xff), (uint8_t)(random_access ? 0x30 : 0x10)
+    };
+    if (random_access) {
+        packet.push_back(0x01);
+        packet.push_back(0x40);
+    }
+    packet.insert(packet.end(), payload.begin(), payload.end());
+    packet.resize(TS_PACKET_SIZE, 0xff);
+    stream.insert(stream.end(), packet.begin(), packet.end());
+}
+
+
+static void put_pat(std::vector<uint8_t> &stream)
+{
+    put_packet(stream, 0x0000, true, false, {
+        0x00,
+        0x00, 0xb0, 13, 0x00, 0x01, 0xc1, 0x00, 0x00,
+        0x00, 0x01, (uint8_t)(0xe0 | (PMT_PID >> 8)), (uint8_t)(PMT_PID & 0xff),
+        0x00, 0x00, 0x00, 0x00
+    });
+}
+
+
+// h.264 video and aac audio
+static void put_pmt(std::vector<uint8_t> &stream)
+{
+    put_packet(stream, PMT_PID, true, false, {
+        0x00,
+        0x02, 0xb0, 23, 0x00, 0x01, 0xc1, 0x00, 0x00,
+        (uint8_t)(0xe0 | (VIDEO_PID >> 8)), (uint8_t)(VIDEO_PID & 0xff), 0xf0, 0x00,
+        0x1b, (uint8_t)(0xe0 | (VIDEO_PID >> 8)), (uint8_t)(VIDEO_PID & 0xff), 0xf0, 0x00,
+        0x0f, (uint8_t)(0xe0 | (AUDIO_PID >> 8)), (uint8_t)(AUDIO_PID & 0xff), 0xf0, 0x00,
+        0x00, 0x00, 0x00, 0x00
+    });
+}
+
+
+static void put_video(std::vector<uint8_t> &stream, bool keyframe)
+{
+    put_packet(stream, VIDEO_PID, true, keyframe, { 0x00, 0x00, 0x01, 0xe0 });
+    put_packet(stream, VIDEO_PID, false, false, {});
+}
+
+
+// every audio frame is a random access point, as ffmpeg and most muxers mark it
+static void put_audio(std::vector<uint8_t> &stream)
+{
+    put_packet(stream, AUDIO_PID, true, true, { 0x00, 0x00, 0x01, 0xc0 });
+}
+
+
+// an a/v stream whose last video key frame is followed by audio key packets, returns the offset of that key frame
+static uint32_t make_av_stream(std::vector<uint8_t> &stream, bool with_psi)
+{
+    if (with_psi) {
+        put_pat(stream);
+        put_pmt(stream);
+    }
+    put_video(stream, true);
+    put_audio(stream);
+    put_video(stream, false);
+    put_audio(stream);
+    uint32_t keyframe_offset = (uint32_t)stream.size();
+    put_video(stream, true);
+    put_audio(stream);
+    put_video(stream, false);
+    put_audio(stream);
+    put_video(stream, false);
+    put_audio(stream);
+    return keyframe_offset;
+}
+
+
+static void test_scanner_skips_audio(bool with_psi)
+{
+    std::vector<uint8_t> stream;
+    uint32_t keyframe_offset = make_av_stream(stream, with_psi);
+
+    // chunks that split packets, as the feeder writes them
+    TsKeyframeScanner scanner;
+    for (uint32_t offset = 0; offset < stream.size(); offset += 100) {
+        uint32_t length = std::min((uint32_t)stream.size() - offset, 100u);
+        scanner.feed(stream.data() + offset, length, offset);
+    }
+
+    uint32_t offset = 0;
+    CHECK(scanner.get_last_keyframe(offset));
+    CHECK(keyframe_offset == offset);
+}
+
+
+static void test_scanner_audio_only()
+{
+    std::vector<uint8_t> stream;
+    put_pat(stream);
+    put_pmt(stream);
+    put_audio(stream);
+    put_audio(stream);
+
+    TsKeyframeScanner scanner;
+    scanner.feed(stream.data(), (uint32_t)stream.size(), 0);
+
+    uint32_t offset = 0;
+    CHECK(!scanner.get_last_keyframe(offset));
+}
+
+
+// a player joining the stream must get bytes that begin at the video key frame, not at an audio packet after it
+static void test_gop_cache_starts_at_video_keyframe()
+{
+    std::vector<uint8_t> stream;
+    uint32_t keyframe_offset = make_av_stream(stream, true);
+
+    GopCache cache;
+    for (uint32_t offset = 0; offset < stream.size(); offset += 1000) {
+        uint32_t length = std::min((uint32_t)stream.size() - offset, 1000u);
+        cache.append(stream.data() + offset, length);
+    }
+
+    CHECK(cache.has_gop());
+    CHECK((uint32_t)stream.size() - keyframe_offset == cache.size());
+    if (cache.size() >= TS_PACKET_SIZE) {
+        const uint8_t *packet = cache.data();
+        int pid = ((packet[1] & 0x1f) << 8) | packet[2];
+        CHECK(0x47 == packet[0]);
+        CHECK(VIDEO_PID == pid);
+        // payload unit start with the random access indicator
+        CHECK((packet[1] & 0x40) != 0);
+        CHECK((packet[3] & 0x20) != 0 && (packet[5] & 0x40) != 0);
+    }
+}
+
+
+#ifdef TEST_PLAYER
+// made by lavfi inside mpv, needs no file or network
+#define TEST_SOURCE "av://lavfi:testsrc=size=64x48:rate=25"
+#define TEST_TIMEOUT_MS 5000
+
+
+// restart runs on the event thread after a codec change or a decoder failure, the tests call it directly
+class TestPlayer : public MpvWrapper {
+public:
+    using MpvWrapper::call_command_async;
+    using MpvWrapper::restart;
+};
+
+
+// headless, no profile and no hwdec, true once the first frame is out
+static bool start_and_wait_first_frame(TestPlayer &player, int timeout_ms = TEST_TIMEOUT_MS)
+{
+    auto first_frame = std::make_shared<std::promise<void>>();
+    std::future<void> first_frame_future = first_frame->get_future();
+    player.set_first_frame_callback([first_frame]() { first_frame->set_value(); });
+    if (!player.start(0, TEST_SOURCE, "", "null", "", "auto", "auto", "")) {
+        return false;
+    }
+    return first_frame_future.wait_for(std::chrono::milliseconds(timeout_ms)) == std::future_status::ready;
+}
+
+
+// replies of async requests come through the event thread only
+static bool replies_arrive(TestPlayer &player)
+{
+    std::future<bool> reply = player.pause_async();
+    return reply.wait_for(std::chrono::milliseconds(TEST_TIMEOUT_MS)) == std::future_status::ready && reply.get();
+}
+
+
+// a stopped player started again, as acquire_player hands out an idle one, still has its event thread
+static void test_recycled_player_gets_events()
+{
+    TestPlayer player;
+    CHECK(start_and_wait_first_frame(player));
+    player.stop();
+
+    CHECK(start_and_wait_first_frame(player));
+    CHECK(replies_arrive(player));
+    player.stop();
+}
+
+
+// the full restart fallback of a codec change, run from a reply on the event thread like the real one
+static bool restart_on_event_thread(TestPlayer &player)
+{
+    auto restarted = std::make_shared<std::promise<void>>();
+    std::future<void> restarted_future = restarted->get_future();
+    bool sent = player.call_command_async({ "ignore" }, [&player, restarted](int, struct mpv_node *) {
+        player.restart();
+        restarted->set_value();
+    });
+    return sent && restarted_future.wait_for(std::chrono::milliseconds(TEST_TIMEOUT_MS)) == std::future_status::ready;
+}
+
+
+// the event thread of the old handle leaves on restart, the new handle gets one of its own
+static void test_restarted_player_gets_events()
+{
+    TestPlayer player;
+    CHECK(start_and_wait_first_frame(player));
+
+    CHECK(restart_on_event_thread(player));
+    CHECK(replies_arrive(player));
+    // only an event thread of the restarted handle can run the second restart
+    CHECK(restart_on_event_thread(player));
+    CHECK(replies_arrive(player));
+    player.stop();
+}
+
+
+// channel changes alternate two players, the one a swap released is the standby of the next change
+// each standby, recycled ones too, must have its first frame before the change times out
+static void test_recycled_standby_reports_first_frame()
+{
+    TestPlayer players[2];
+    CHECK(start_and_wait_first_frame(players[0]));
+    for (int change = 1; change <= 3; change++) {
+        TestPlayer &standby = players[change % 2];
+        TestPlayer &current = players[(change + 1) % 2];
+        // the current player keeps the sound until the swap
+        standby.set_audio_enabled(false);
+        CHECK(start_and_wait_first_frame(standby, DEFAULT_CHANNEL_CHANGE_TIMEOUT_MS));
+        // the swap stops the old player, it waits in the idle pool for the next change
+        current.stop();
+    }
+    players[0].stop();
+    players[1].stop();
+}
+#endif // TEST_PLAYER
+
+
+int main() {
+    test_scanner_skips_audio(true);
+    test_scanner_skips_audio(false);
+    test_scanner_audio_only();
+    test_gop_cache_starts_at_video_keyframe();
+#ifdef TEST_PLAYER
+    test_recycled_player_gets_events();
+    test_restarted_player_gets_events();
+    test_recycled_standby_reports_first_frame();
+#endif // TEST_PLAYER
+
+    if (failures > 0) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,132 @@
+// project
+#include "stats_segment.hpp"
+
+// c++
+#include <chrono>
+#include <map>
+#include <memory>
+#include <thread>
+
+// fmt
+#include <fmt/format.h>
+
+// cli11
+#include <CLI/CLI.hpp>
+
+
+#define CLEAR_SCREEN "\033[H\033[2J"
+
+
+
+class CommandArguments {
+public:
+    CommandArguments()
+        : key(DEFAULT_STATS_KEY)
+        , interval_ms(1000)
+        , count(0)
+        , clear(true)
+    {
+    }
+
+    void add_options(CLI::App& app)
+    {
+        app.add_option("--key", key, fmt::format("shared memory key given to qt-mpv --stats_key (default {})", key));
+        app.add_option("--interval_ms", interval_ms, fmt::format("refresh interval (default {})", interval_ms));
+        app.add_option("--count", count, "refreshes before exit, 0 runs until killed (default 0)");
+        app.add_option("--clear", clear, "redraw in place instead of appending (default true)");
+    }
+
+    std::string key;
+    int interval_ms;
+    int count;
+    bool clear;
+};
+
+
+// per second rates need the previous sample of the same player
+static double rate(uint64_t value, uint64_t last_value, double seconds)
+{
+    return seconds > 0.0 && value >= last_value ? (value - last_value) / seconds : 0.0;
+}
+
+
+static std::string render(const StatsSnapshot &snapshot, const StatsSnapshot *last)
+{
+    double seconds = nullptr == last ? 0.0 : (snapshot.update_time_ms - last->update_time_ms) / 1000.0;
+    std::map<int32_t, const StatsTile *> last_tiles;
+    for (uint32_t i = 0; last != nullptr && i < last->tile_count; i++) {
+        last_tiles[last->tiles[i].index] = &last->tiles[i];
+    }
+
+    int64_t age_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count() - snapshot.update_time_ms;
+    std::string text = fmt::format(
+        "qt-mpv pid {}, updated {} ms ago, cpu {:.1f}% of {} cores, rss {:.1f} MB, {} tiles\n\n"
+        "{:>5} {:>6} {:>7} {:>6} {:>9} {:>9} {:>9} {:>6} {:>8} {:>8} {:>8} {:>8} {:>8} {:>5}\n",
+        snapshot.pid, age_ms, snapshot.cpu_percent, snapshot.cpu_cores, snapshot.rss_bytes / 1024.0 / 1024.0, snapshot.tile_count,
+        "tile", "id", "fps", "speed", "bitrate", "in_kB/s", "out_kB/s", "fill%", "drops", "dec_drop", "restarts", "w_stalls", "r_stalls", "shed"
+    );
+    for (uint32_t i = 0; i < snapshot.tile_count; i++) {
+        const StatsTile &tile = snapshot.tiles[i];
+        auto last_iter = last_tiles.find(tile.index);
+        const StatsTile *last_tile = last_iter != last_tiles.end() && last_iter->second->player_id == tile.player_id ? last_iter->second : nullptr;
+        double in_rate = nullptr == last_tile ? 0.0 : rate(tile.input_bytes, last_tile->input_bytes, seconds);
+        double out_rate = nullptr == last_tile ? 0.0 : rate(tile.output_bytes, last_tile->output_bytes, seconds);
+        double fill = tile.buffer_size > 0 ? tile.buffer_fill * 100.0 / tile.buffer_size : 0.0;
+        text += fmt::format(
+            "{:>5} {:>6} {:>7.2f} {:>6.2f} {:>9.1f} {:>9.1f} {:>9.1f} {:>6.1f} {:>8} {:>8} {:>8} {:>8} {:>8} {:>5}\n",
+            tile.index, tile.player_id, tile.fps, tile.speed, tile.bitrate / 1024.0, in_rate / 1024.0, out_rate / 1024.0, fill,
+            tile.frame_drops, tile.decoder_frame_drops, tile.restarts, tile.write_stalls, tile.read_stalls, tile.shed_level
+        );
+    }
+
+    return text;
+}
+
+
+int main(int argc, char** argv) {
+    // parse cli
+    CLI::App app("qt-mpv-top");
+    CommandArguments args;
+    args.add_options(app);
+    CLI11_PARSE(app, argc, argv);
+
+    StatsSegment segment;
+    // large, keep them off the stack
+    std::unique_ptr<StatsSnapshot> snapshot(new StatsSnapshot());
+    std::unique_ptr<StatsSnapshot> current(new StatsSnapshot());
+    std::unique_ptr<StatsSnapshot> previous(new StatsSnapshot());
+    bool has_current = false;
+    bool has_previous = false;
+    for (int n = 0; 0 == args.count || n < args.count; n++) {
+        if (n > 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(args.interval_ms));
+        }
+
+        if (!segment.is_attached() && !segment.attach(args.key)) {
+            fmt::print("{}waiting for qt-mpv to publish {}\n", args.clear ? CLEAR_SCREEN : "", args.key);
+            fflush(stdout);
+            continue;
+        }
+
+        // the writer went away or was replaced, attach again next time
+        if (!segment.read(*snapshot)) {
+            segment.detach();
+            has_current = false;
+            has_previous = false;
+            continue;
+        }
+
+        // rates come from the last two distinct publishes of the same process
+        if (!has_current || current->update_time_ms != snapshot->update_time_ms) {
+            has_previous = has_current && current->pid == snapshot->pid;
+            previous.swap(current);
+            current.swap(snapshot);
+            has_current = true;
+        }
+
+        fmt::print("{}{}", args.clear ? CLEAR_SCREEN : "", render(*current, has_previous ? previous.get() : nullptr));
+        fflush(stdout);
+    }
+
+    return 0;
+}